@@ -0,0 +1,184 @@
+// Single-threaded throughput, latency, false positive rate and space of the
+// filters.
+//
+// Usage: bench [--sizes=N,...] [--loads=F,...] [--filters=NAME,...]
+//              [--sample-every=N] [--seed=N] [--format=csv|json]
+//
+// For each filter, size (max_num_keys passed to the constructor) and load
+// (fraction of the size to insert), one row reports the Mops/s and p50/p99/p999
+// latency of inserts, positive lookups, negative lookups and deletes, together
+// with the measured false positive rate, BitsPerItem() and LoadFactor(). The
+// *Aligned rows store remainders or counters with fieldutil::AlignedFields,
+// their bits_per_item next to that of the packed row is the memory it costs.
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "bench_util.h"
+#include "fieldutil.h"
+#include "hashutil.h"
+#include "vecbf/blocked_vecbf.h"
+#include "vecbf/vecbf.h"
+#include "vecf/scalable_vecf.h"
+#include "vecf/vecf.h"
+#include "veqf/veqf.h"
+
+namespace
+{
+
+struct Config
+{
+    uint64_t sample_every, seed;
+};
+
+template <typename Filter>
+void Run(const std::string &name, uint64_t size, double load, const Config &config,
+         bench::Report *report)
+{
+    Filter filter(size);
+
+    bench::KeyGenerator gen(config.seed);
+    std::vector<uint64_t> keys(static_cast<uint64_t>(size * load)), negatives(size);
+    for (auto &key : keys)
+    {
+        key = gen();
+    }
+    for (auto &key : negatives)
+    {
+        key = gen();
+    }
+
+    bench::Report::Row row;
+    row.Add("filter", name).Add("size", size).Add("target_load", load);
+
+    auto add_op = [&row](const std::string &op, uint64_t ops, uint64_t nanos,
+                         bench::LatencySampler *sampler) {
+        row.Add(op + "_mops", bench::Mops(ops, nanos))
+            .Add(op + "_p50_ns", sampler->Percentile(0.5))
+            .Add(op + "_p99_ns", sampler->Percentile(0.99))
+            .Add(op + "_p999_ns", sampler->Percentile(0.999));
+    };
+
+    // Inserting stops at the first failure
+    uint64_t inserted, done;
+    bench::LatencySampler insert_latency(config.sample_every);
+    uint64_t nanos{bench::TimeOps(keys.size(), &insert_latency, true, &inserted,
+                                  [&](uint64_t i) { return filter.Insert(keys[i]); })};
+    row.Add("inserted", inserted)
+        .Add("load_factor", filter.LoadFactor())
+        .Add("bits_per_item", filter.BitsPerItem());
+    add_op("insert", inserted, nanos, &insert_latency);
+
+    uint64_t false_negatives{0};
+    bench::LatencySampler positive_latency(config.sample_every);
+    nanos = bench::TimeOps(inserted, &positive_latency, false, &done, [&](uint64_t i) {
+        false_negatives += !filter.Lookup(keys[i]);
+        return true;
+    });
+    add_op("positive_lookup", inserted, nanos, &positive_latency);
+
+    uint64_t false_positives{0};
+    bench::LatencySampler negative_latency(config.sample_every);
+    nanos = bench::TimeOps(negatives.size(), &negative_latency, false, &done,
+                           [&](uint64_t i) {
+                               false_positives += filter.Lookup(negatives[i]);
+                               return true;
+                           });
+    add_op("negative_lookup", negatives.size(), nanos, &negative_latency);
+    row.Add("fpr", 1.0 * false_positives / negatives.size());
+
+    bench::LatencySampler delete_latency(config.sample_every);
+    nanos = bench::TimeOps(inserted, &delete_latency, false, &done,
+                           [&](uint64_t i) { return filter.Delete(keys[i]); });
+    add_op("delete", inserted, nanos, &delete_latency);
+
+    if (false_negatives != 0)
+    {
+        fprintf(stderr, "%s: %lu false negatives\n", name.c_str(), false_negatives);
+    }
+    report->Print(row);
+}
+
+// A VEQF which expands instead of refusing inserts, see --loads above 1
+template <uint64_t kBitsPerItem>
+class ExpandingVEQF : public veqf::VEQF<uint64_t, kBitsPerItem>
+{
+  public:
+    explicit ExpandingVEQF(uint64_t max_num_keys)
+        : veqf::VEQF<uint64_t, kBitsPerItem>(max_num_keys)
+    {
+        this->SetAutoExpandThreshold(0.9);
+    }
+};
+
+template <uint64_t kBitsPerItem>
+using AlignedVEQF = veqf::VEQF<uint64_t, kBitsPerItem, hashutil::TwoIndependentMultiplyShift,
+                               fieldutil::AlignedFields>;
+
+template <uint64_t kBitsPerCounter>
+using AlignedVECBF = vecbf::VECBF<uint64_t, kBitsPerCounter,
+                                  hashutil::TwoIndependentMultiplyShift,
+                                  fieldutil::AlignedFields>;
+
+struct Benchmark
+{
+    const char *name;
+    void (*run)(const std::string &, uint64_t, double, const Config &,
+                bench::Report *);
+};
+
+const Benchmark kBenchmarks[]{
+    {"VECF8", Run<vecf::VECF<uint64_t, 8>>},
+    {"VECF12", Run<vecf::VECF<uint64_t, 12>>},
+    {"VECF16", Run<vecf::VECF<uint64_t, 16>>},
+    {"VECF12Aligned", Run<vecf::VECF<uint64_t, 12, vecf::AlignedSingleTable>>},
+    // grows past its size with loads above 1
+    {"ScalableVECF12", Run<vecf::ScalableVECF<uint64_t, 12>>},
+    {"VEQF8", Run<veqf::VEQF<uint64_t, 8>>},
+    {"VEQF10", Run<veqf::VEQF<uint64_t, 10>>},
+    {"VEQF12", Run<veqf::VEQF<uint64_t, 12>>},
+    {"VEQF14", Run<veqf::VEQF<uint64_t, 14>>},
+    {"VEQF16", Run<veqf::VEQF<uint64_t, 16>>},
+    {"VEQF10Aligned", Run<AlignedVEQF<10>>},
+    {"VEQF12Aligned", Run<AlignedVEQF<12>>},
+    {"VEQF14Aligned", Run<AlignedVEQF<14>>},
+    {"ExpandingVEQF12", Run<ExpandingVEQF<12>>},
+    {"VECBF8", Run<vecbf::VECBF<uint64_t, 8>>},
+    {"VECBF10", Run<vecbf::VECBF<uint64_t, 10>>},
+    {"VECBF10Aligned", Run<AlignedVECBF<10>>},
+    // one cache miss per operation, for a slightly higher fpr than VECBF
+    {"BlockedVECBF8", Run<vecbf::BlockedVECBF<uint64_t, 8>>},
+    {"BlockedVECBF10", Run<vecbf::BlockedVECBF<uint64_t, 10>>},
+};
+
+}
+
+int main(int argc, char **argv)
+{
+    const bench::Args args(argc, argv);
+    const Config config{args.GetUint("sample-every", 16), args.GetUint("seed", 1)};
+    const std::vector<std::string> sizes{args.GetList("sizes", "1048576")};
+    const std::vector<std::string> loads{args.GetList("loads", "0.5,0.9")};
+    const std::vector<std::string> filters{args.GetList("filters", "")};
+
+    bench::Report report(args.GetFormat());
+    for (const auto &benchmark : kBenchmarks)
+    {
+        if (!filters.empty() &&
+            std::find(filters.begin(), filters.end(), benchmark.name) == filters.end())
+        {
+            continue;
+        }
+        for (const auto &size : sizes)
+        {
+            for (const auto &load : loads)
+            {
+                benchmark.run(benchmark.name, strtoull(size.c_str(), nullptr, 0),
+                              strtod(load.c_str(), nullptr), config, &report);
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,304 @@
+#ifndef BENCH_UTIL_H_
+#define BENCH_UTIL_H_
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace bench
+{
+
+// SplitMix64, a fast generator of distinct-looking keys
+class KeyGenerator
+{
+    uint64_t state_;
+
+  public:
+    explicit KeyGenerator(uint64_t seed)
+        : state_(seed)
+    {
+    }
+
+    uint64_t operator()()
+    {
+        uint64_t z{state_ += 0x9e3779b97f4a7c15ULL};
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+};
+
+inline uint64_t NowNanos()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+// Per-op latencies of one in every `sample_every` ops
+class LatencySampler
+{
+    const uint64_t sample_every_;
+    std::vector<uint64_t> samples_;
+
+  public:
+    explicit LatencySampler(uint64_t sample_every)
+        : sample_every_(sample_every)
+    {
+    }
+
+    bool ShouldSample(uint64_t i) const
+    {
+        return i % sample_every_ == 0;
+    }
+
+    void Add(uint64_t nanos)
+    {
+        samples_.push_back(nanos);
+    }
+
+    // Return the q-quantile in nanoseconds, 0 without samples
+    uint64_t Percentile(double q)
+    {
+        if (samples_.empty())
+        {
+            return 0;
+        }
+        const size_t k{std::min(samples_.size() - 1,
+                                static_cast<size_t>(q * samples_.size()))};
+        std::nth_element(samples_.begin(), samples_.begin() + k, samples_.end());
+        return samples_[k];
+    }
+};
+
+// Run op(i) for i in [0, n) and return the elapsed nanoseconds. Ops stop at the
+// first one returning false if `stop_on_failure`, and *done is set to the number
+// of ops run.
+template <typename Op>
+uint64_t TimeOps(uint64_t n, LatencySampler *sampler, bool stop_on_failure,
+                 uint64_t *done, Op &&op)
+{
+    const uint64_t start{NowNanos()};
+    uint64_t i{0};
+    for (; i < n; ++i)
+    {
+        bool ok;
+        if (sampler->ShouldSample(i))
+        {
+            const uint64_t t{NowNanos()};
+            ok = op(i);
+            sampler->Add(NowNanos() - t);
+        }
+        else
+        {
+            ok = op(i);
+        }
+        if (!ok && stop_on_failure)
+        {
+            break;
+        }
+    }
+    *done = i;
+    return NowNanos() - start;
+}
+
+inline double Mops(uint64_t ops, uint64_t nanos)
+{
+    return nanos == 0 ? 0.0 : 1e3 * ops / nanos;
+}
+
+// Rows of named columns, printed as CSV or as a JSON array of objects
+class Report
+{
+  public:
+    enum Format
+    {
+        kCsv,
+        kJson,
+    };
+
+    class Row
+    {
+        friend class Report;
+        std::vector<std::pair<std::string, std::string>> fields_;
+
+      public:
+        Row &Add(const std::string &name, const std::string &value)
+        {
+            fields_.emplace_back(name, '"' + value + '"');
+            return *this;
+        }
+        Row &Add(const std::string &name, uint64_t value)
+        {
+            fields_.emplace_back(name, std::to_string(value));
+            return *this;
+        }
+        Row &Add(const std::string &name, double value)
+        {
+            char buf[32];
+            snprintf(buf, sizeof(buf), "%.6g", value);
+            fields_.emplace_back(name, buf);
+            return *this;
+        }
+    };
+
+  private:
+    const Format format_;
+    FILE *out_;
+    size_t rows_{0};
+
+  public:
+    Report(Format format, FILE *out = stdout)
+        : format_(format), out_(out)
+    {
+    }
+
+    ~Report()
+    {
+        if (format_ == kJson)
+        {
+            fprintf(out_, rows_ == 0 ? "[]\n" : "\n]\n");
+        }
+        fflush(out_);
+    }
+
+    // Rows are flushed as they come so that a long run can be followed
+    void Print(const Row &row)
+    {
+        if (format_ == kCsv)
+        {
+            if (rows_ == 0)
+            {
+                for (size_t i = 0; i < row.fields_.size(); ++i)
+                {
+                    fprintf(out_, "%s%s", i ? "," : "", row.fields_[i].first.c_str());
+                }
+                fprintf(out_, "\n");
+            }
+            for (size_t i = 0; i < row.fields_.size(); ++i)
+            {
+                fprintf(out_, "%s%s", i ? "," : "", row.fields_[i].second.c_str());
+            }
+            fprintf(out_, "\n");
+        }
+        else
+        {
+            fprintf(out_, "%s\n  {", rows_ == 0 ? "[" : ",");
+            for (size_t i = 0; i < row.fields_.size(); ++i)
+            {
+                fprintf(out_, "%s\"%s\": %s", i ? ", " : "",
+                        row.fields_[i].first.c_str(), row.fields_[i].second.c_str());
+            }
+            fprintf(out_, "}");
+        }
+        ++rows_;
+        fflush(out_);
+    }
+};
+
+// Parse "--name=value" style arguments
+class Args
+{
+    std::vector<std::pair<std::string, std::string>> args_;
+
+  public:
+    Args(int argc, char **argv)
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            const char *arg{argv[i]};
+            if (strncmp(arg, "--", 2) != 0)
+            {
+                fprintf(stderr, "unexpected argument: %s\n", arg);
+                exit(1);
+            }
+            const char *eq{strchr(arg, '=')};
+            if (eq == nullptr)
+            {
+                args_.emplace_back(arg + 2, "");
+            }
+            else
+            {
+                args_.emplace_back(std::string(arg + 2, eq), eq + 1);
+            }
+        }
+    }
+
+    bool Has(const std::string &name) const
+    {
+        for (const auto &arg : args_)
+        {
+            if (arg.first == name)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::string Get(const std::string &name, const std::string &fallback) const
+    {
+        for (const auto &arg : args_)
+        {
+            if (arg.first == name)
+            {
+                return arg.second;
+            }
+        }
+        return fallback;
+    }
+
+    uint64_t GetUint(const std::string &name, uint64_t fallback) const
+    {
+        return Has(name) ? strtoull(Get(name, "").c_str(), nullptr, 0) : fallback;
+    }
+
+    double GetDouble(const std::string &name, double fallback) const
+    {
+        return Has(name) ? strtod(Get(name, "").c_str(), nullptr) : fallback;
+    }
+
+    // Comma separated list
+    std::vector<std::string> GetList(const std::string &name,
+                                     const std::string &fallback) const
+    {
+        std::vector<std::string> ret;
+        const std::string value{Get(name, fallback)};
+        size_t begin{0};
+        while (begin <= value.size())
+        {
+            size_t end{value.find(',', begin)};
+            if (end == std::string::npos)
+            {
+                end = value.size();
+            }
+            if (end > begin)
+            {
+                ret.push_back(value.substr(begin, end - begin));
+            }
+            begin = end + 1;
+        }
+        return ret;
+    }
+
+    Report::Format GetFormat() const
+    {
+        const std::string format{Get("format", "csv")};
+        if (format != "csv" && format != "json")
+        {
+            fprintf(stderr, "unknown format: %s\n", format.c_str());
+            exit(1);
+        }
+        return format == "csv" ? Report::kCsv : Report::kJson;
+    }
+};
+
+}
+
+#endif
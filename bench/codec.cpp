@@ -0,0 +1,171 @@
+// Cost of the pext/pdep codecs of bmiutil.h, alone and inside the filters.
+//
+// Usage: codec [--n=N] [--size=N] [--codecs=NAME,...] [--seed=N]
+//              [--format=csv|json]
+//
+// For each codec this CPU supports (bmi2, vbmi2, portable), the pext and pdep
+// rows report the nanoseconds per call on --n random values, for masks taken
+// from the VECF bucket encodings and for random masks, the operand of the VEQF
+// select. The cost of the portable codec grows with the runs of set bits of
+// the mask; the others do not depend on it.
+//
+// Built with -DVEFILTER_ISA=dispatch, the filter rows switch all filters to
+// each codec with bmiutil::SetCodec and report the nanoseconds per insert and
+// lookup of a VECF12 and VEQF12 of --size slots filled to 0.9. Other builds
+// compile pext/pdep to the instructions and report the bmi2 filter rows only.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "bench_util.h"
+#include "bmiutil.h"
+#include "vecf/vecf.h"
+#include "veqf/veqf.h"
+
+namespace
+{
+
+struct Codec
+{
+    const char *name;
+    bmiutil::Codec codec;
+};
+
+const Codec kCodecs[]{
+    {"bmi2", bmiutil::Codec::kBmi2},
+    {"vbmi2", bmiutil::Codec::kVbmi2},
+    {"portable", bmiutil::Codec::kPortable},
+};
+
+// 0 stands for a random mask per value
+struct Mask
+{
+    const char *name;
+    uint64_t mask;
+};
+
+const Mask kMasks[]{
+    {"vecf8_two_tags", 0x017f41ff},
+    {"vecf8_three_tags", 0x0f7b7eff},
+    {"vecf16_two_tags", 0xffff3ff7ff7fffff},
+    {"random", 0},
+};
+
+void Print(const char *codec, const std::string &op, const char *mask, uint64_t ops,
+           uint64_t nanos, bench::Report *report)
+{
+    bench::Report::Row row;
+    row.Add("codec", codec).Add("op", op).Add("mask", mask).Add("ns", 1.0 * nanos / ops);
+    report->Print(row);
+}
+
+void RunOps(const Codec &codec, uint64_t n, uint64_t seed, bench::Report *report)
+{
+    const bmiutil::CodecOps ops{bmiutil::OpsOf(codec.codec)};
+    bench::KeyGenerator gen(seed);
+    std::vector<uint64_t> values(n), masks(n);
+    for (auto &value : values)
+    {
+        value = gen();
+    }
+    for (const auto &mask : kMasks)
+    {
+        for (auto &m : masks)
+        {
+            m = mask.mask != 0 ? mask.mask : gen();
+        }
+        uint64_t sink{0};
+        uint64_t start{bench::NowNanos()};
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            sink ^= ops.pext(values[i], masks[i]);
+        }
+        Print(codec.name, "pext", mask.name, n, bench::NowNanos() - start, report);
+        start = bench::NowNanos();
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            sink ^= ops.pdep(values[i], masks[i]);
+        }
+        Print(codec.name, "pdep", mask.name, n, bench::NowNanos() - start, report);
+        // keeps the loops from being optimized away
+        if (sink == 1)
+        {
+            fprintf(stderr, "\n");
+        }
+    }
+}
+
+template <typename Filter>
+void RunFilter(const Codec &codec, const char *name, uint64_t size, uint64_t seed,
+               bench::Report *report)
+{
+    Filter filter(size);
+    bench::KeyGenerator gen(seed);
+    std::vector<uint64_t> keys(static_cast<uint64_t>(size * 0.9)), negatives(keys.size());
+    for (auto &key : keys)
+    {
+        key = gen();
+    }
+    for (auto &key : negatives)
+    {
+        key = gen();
+    }
+    uint64_t inserted{0};
+    uint64_t start{bench::NowNanos()};
+    while (inserted < keys.size() && filter.Insert(keys[inserted]))
+    {
+        ++inserted;
+    }
+    Print(codec.name, std::string(name) + "_insert", "", inserted,
+          bench::NowNanos() - start, report);
+    uint64_t found{0};
+    start = bench::NowNanos();
+    for (uint64_t i = 0; i < inserted; ++i)
+    {
+        found += filter.Lookup(keys[i]);
+    }
+    Print(codec.name, std::string(name) + "_positive_lookup", "", inserted,
+          bench::NowNanos() - start, report);
+    start = bench::NowNanos();
+    for (const auto key : negatives)
+    {
+        found += filter.Lookup(key);
+    }
+    Print(codec.name, std::string(name) + "_negative_lookup", "", negatives.size(),
+          bench::NowNanos() - start, report);
+    if (found == 0)
+    {
+        fprintf(stderr, "%s found no key\n", name);
+    }
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    const bench::Args args(argc, argv);
+    const uint64_t n{args.GetUint("n", 1 << 22)}, size{args.GetUint("size", 1 << 22)},
+        seed{args.GetUint("seed", 1)};
+    const std::vector<std::string> codecs{args.GetList("codecs", "")};
+
+    bench::Report report(args.GetFormat());
+    for (const auto &codec : kCodecs)
+    {
+        if ((!codecs.empty() &&
+             std::find(codecs.begin(), codecs.end(), codec.name) == codecs.end()) ||
+            !bmiutil::IsSupported(codec.codec))
+        {
+            continue;
+        }
+        RunOps(codec, n, seed, &report);
+        if (bmiutil::SetCodec(codec.codec))
+        {
+            RunFilter<vecf::VECF<uint64_t, 12>>(codec, "vecf12", size, seed, &report);
+            RunFilter<veqf::VEQF<uint64_t, 12>>(codec, "veqf12", size, seed, &report);
+        }
+    }
+    return 0;
+}
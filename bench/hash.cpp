@@ -0,0 +1,245 @@
+// Cost of the hash families, alone and as a share of lookups.
+//
+// Usage: hash [--sizes=N,...] [--load=F] [--lookups=N] [--key-length=N]
+//             [--filters=NAME,...] [--hashes=NAME,...] [--seed=N]
+//             [--format=csv|json]
+//
+// For each filter, hash family and size, a filter seeded with --seed is filled
+// up to --load and probed with random negative lookups. Each row reports the
+// nanoseconds per lookup, per scalar hash and per hash of a batch (HashBatch
+// where the family has one, a loop of scalar hashes otherwise), and hash_share,
+// the fraction of a lookup spent hashing: hashes per lookup * hash_ns /
+// lookup_ns. Small sizes show the share when the table is in cache, large ones
+// when lookups wait on memory. prehashed_lookup_ns is the cost of LookupHash,
+// which takes the key as its own hash.
+//
+// The string_* columns repeat the lookups with byte string keys of
+// --key-length bytes, which are first folded by hashutil::HashBytes (one key
+// at a time) or HashBytesBatch (4 keys per AVX2 instruction).
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "bench_util.h"
+#include "hashutil.h"
+#include "vecbf/vecbf.h"
+#include "vecf/vecf.h"
+#include "veqf/veqf.h"
+
+namespace
+{
+
+struct Config
+{
+    uint64_t lookups, seed, key_length;
+    double load;
+};
+
+template <typename HashFamily>
+void HashBatch(const HashFamily &hasher, const std::vector<uint64_t> &keys,
+               std::vector<uint64_t> *hashes)
+{
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        (*hashes)[i] = hasher(keys[i]);
+    }
+}
+
+void HashBatch(const hashutil::SimdMultiplyShift &hasher, const std::vector<uint64_t> &keys,
+               std::vector<uint64_t> *hashes)
+{
+    hasher.HashBatch(keys.data(), keys.size(), hashes->data());
+}
+
+// VECF hashes every key twice, except in single-hash mode, the other filters
+// once
+template <template <typename> class Filter, typename HashFamily, uint64_t kHashesPerLookup>
+void Run(const std::string &name, const std::string &hash, uint64_t size,
+         const Config &config, bench::Report *report)
+{
+    Filter<HashFamily> filter(size, config.seed);
+    bench::KeyGenerator gen(config.seed);
+    const uint64_t num_keys{static_cast<uint64_t>(size * config.load)};
+    for (uint64_t i = 0; i < num_keys && filter.Insert(gen()); ++i)
+    {
+    }
+    std::vector<uint64_t> negatives(config.lookups), hashes(config.lookups);
+    for (auto &key : negatives)
+    {
+        key = gen();
+    }
+
+    uint64_t found{0};
+    uint64_t start{bench::NowNanos()};
+    for (const auto key : negatives)
+    {
+        found += filter.Lookup(key);
+    }
+    const uint64_t lookup_nanos{bench::NowNanos() - start};
+
+    // the negative keys taken as hashes, which skips the hash family
+    uint64_t prehashed_found{0};
+    start = bench::NowNanos();
+    for (const auto key : negatives)
+    {
+        prehashed_found += filter.LookupHash(key);
+    }
+    const uint64_t prehashed_nanos{bench::NowNanos() - start};
+
+    const HashFamily hasher(config.seed);
+    uint64_t sink{0};
+    start = bench::NowNanos();
+    for (const auto key : negatives)
+    {
+        sink ^= hasher(key);
+    }
+    const uint64_t hash_nanos{bench::NowNanos() - start};
+
+    start = bench::NowNanos();
+    HashBatch(hasher, negatives, &hashes);
+    const uint64_t batch_nanos{bench::NowNanos() - start};
+    for (const auto h : hashes)
+    {
+        sink ^= h;
+    }
+
+    // the same negative keys, as printable strings
+    std::string text(negatives.size() * config.key_length, ' ');
+    std::vector<std::string_view> strings(negatives.size());
+    for (size_t i = 0; i < negatives.size(); ++i)
+    {
+        char *p{&text[i * config.key_length]};
+        for (uint64_t j = 0; j < config.key_length; ++j)
+        {
+            p[j] = 'a' + (negatives[i] >> (j * 5 % 60)) % 26;
+        }
+        strings[i] = std::string_view(p, config.key_length);
+    }
+
+    start = bench::NowNanos();
+    for (const auto key : strings)
+    {
+        found += filter.Lookup(key);
+    }
+    const uint64_t string_lookup_nanos{bench::NowNanos() - start};
+
+    start = bench::NowNanos();
+    for (const auto key : strings)
+    {
+        sink ^= hashutil::HashBytes(key);
+    }
+    const uint64_t bytes_nanos{bench::NowNanos() - start};
+
+    start = bench::NowNanos();
+    hashutil::HashBytesBatch(strings.data(), strings.size(), hashes.data());
+    const uint64_t bytes_batch_nanos{bench::NowNanos() - start};
+    for (const auto h : hashes)
+    {
+        sink ^= h;
+    }
+
+    const double lookup_ns{1.0 * lookup_nanos / negatives.size()},
+        hash_ns{1.0 * hash_nanos / negatives.size()},
+        string_lookup_ns{1.0 * string_lookup_nanos / strings.size()},
+        bytes_hash_ns{1.0 * bytes_nanos / strings.size()};
+    bench::Report::Row row;
+    row.Add("filter", name)
+        .Add("hash", hash)
+        .Add("size", size)
+        .Add("lookup_ns", lookup_ns)
+        .Add("hash_ns", hash_ns)
+        .Add("batch_hash_ns", 1.0 * batch_nanos / negatives.size())
+        .Add("hash_share", lookup_ns == 0 ? 0.0 : kHashesPerLookup * hash_ns / lookup_ns)
+        .Add("prehashed_lookup_ns", 1.0 * prehashed_nanos / negatives.size())
+        .Add("prehashed_fpr", 1.0 * prehashed_found / negatives.size())
+        .Add("string_lookup_ns", string_lookup_ns)
+        .Add("string_bytes_hash_ns", bytes_hash_ns)
+        .Add("string_bytes_batch_hash_ns", 1.0 * bytes_batch_nanos / strings.size())
+        .Add("string_hash_share", string_lookup_ns == 0
+                                      ? 0.0
+                                      : (bytes_hash_ns + kHashesPerLookup * hash_ns) /
+                                            string_lookup_ns)
+        .Add("fpr", 0.5 * found / negatives.size())
+        // keeps the hash loops from being optimized away
+        .Add("checksum", sink & 0xff);
+    report->Print(row);
+}
+
+template <typename HashFamily>
+using VECF12 = vecf::VECF<uint64_t, 12, vecf::SingleTable, HashFamily>;
+
+template <typename HashFamily>
+using VECF12SingleHash = vecf::VECF<uint64_t, 12, vecf::SingleTable, HashFamily, true>;
+
+template <typename HashFamily>
+using VEQF12 = veqf::VEQF<uint64_t, 12, HashFamily>;
+
+// VECBF takes the false positive rate before the seed
+template <typename HashFamily>
+class VECBF8 : public vecbf::VECBF<uint64_t, 8, HashFamily>
+{
+  public:
+    VECBF8(uint64_t max_num_keys, uint64_t seed)
+        : vecbf::VECBF<uint64_t, 8, HashFamily>(max_num_keys, 0.04, seed)
+    {
+    }
+};
+
+struct Benchmark
+{
+    const char *filter, *hash;
+    void (*run)(const std::string &, const std::string &, uint64_t, const Config &,
+                bench::Report *);
+};
+
+const Benchmark kBenchmarks[]{
+    {"VECF12", "multiply_shift", Run<VECF12, hashutil::TwoIndependentMultiplyShift, 2>},
+    {"VECF12", "wyhash", Run<VECF12, hashutil::WyHash, 2>},
+    {"VECF12", "simd_multiply_shift", Run<VECF12, hashutil::SimdMultiplyShift, 2>},
+    {"VECF12SingleHash", "multiply_shift",
+     Run<VECF12SingleHash, hashutil::TwoIndependentMultiplyShift, 1>},
+    {"VECF12SingleHash", "wyhash", Run<VECF12SingleHash, hashutil::WyHash, 1>},
+    {"VECF12SingleHash", "simd_multiply_shift",
+     Run<VECF12SingleHash, hashutil::SimdMultiplyShift, 1>},
+    {"VEQF12", "multiply_shift", Run<VEQF12, hashutil::TwoIndependentMultiplyShift, 1>},
+    {"VEQF12", "wyhash", Run<VEQF12, hashutil::WyHash, 1>},
+    {"VEQF12", "simd_multiply_shift", Run<VEQF12, hashutil::SimdMultiplyShift, 1>},
+    {"VECBF8", "multiply_shift", Run<VECBF8, hashutil::TwoIndependentMultiplyShift, 1>},
+    {"VECBF8", "wyhash", Run<VECBF8, hashutil::WyHash, 1>},
+    {"VECBF8", "simd_multiply_shift", Run<VECBF8, hashutil::SimdMultiplyShift, 1>},
+};
+
+bool Selected(const std::vector<std::string> &names, const char *name)
+{
+    return names.empty() || std::find(names.begin(), names.end(), name) != names.end();
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    const bench::Args args(argc, argv);
+    const Config config{args.GetUint("lookups", 1 << 20), args.GetUint("seed", 1),
+                        args.GetUint("key-length", 32), args.GetDouble("load", 0.9)};
+    const std::vector<std::string> sizes{args.GetList("sizes", "65536,16777216")};
+    const std::vector<std::string> filters{args.GetList("filters", "")};
+    const std::vector<std::string> hashes{args.GetList("hashes", "")};
+
+    bench::Report report(args.GetFormat());
+    for (const auto &benchmark : kBenchmarks)
+    {
+        if (!Selected(filters, benchmark.filter) || !Selected(hashes, benchmark.hash))
+        {
+            continue;
+        }
+        for (const auto &size : sizes)
+        {
+            benchmark.run(benchmark.filter, benchmark.hash,
+                          strtoull(size.c_str(), nullptr, 0), config, &report);
+        }
+    }
+    return 0;
+}
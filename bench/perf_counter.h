@@ -0,0 +1,97 @@
+#ifndef PERF_COUNTER_H_
+#define PERF_COUNTER_H_
+
+#include <cstdint>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace bench
+{
+
+// A hardware event counted on the calling thread, through perf_event_open(2).
+// Valid() is false where the event is not available, e.g. without permission
+// (see /proc/sys/kernel/perf_event_paranoid) or in most containers and VMs.
+class PerfCounter
+{
+    int fd_{-1};
+
+  public:
+    PerfCounter(uint32_t type, uint64_t config)
+    {
+#ifdef __linux__
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd_ = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+        (void)type;
+        (void)config;
+#endif
+    }
+
+    ~PerfCounter()
+    {
+#ifdef __linux__
+        if (fd_ >= 0)
+        {
+            close(fd_);
+        }
+#endif
+    }
+
+    PerfCounter(const PerfCounter &) = delete;
+    PerfCounter &operator=(const PerfCounter &) = delete;
+
+    bool Valid() const
+    {
+        return fd_ >= 0;
+    }
+
+    void Start()
+    {
+#ifdef __linux__
+        if (fd_ >= 0)
+        {
+            ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    void Stop()
+    {
+#ifdef __linux__
+        if (fd_ >= 0)
+        {
+            ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+        }
+#endif
+    }
+
+    uint64_t Read() const
+    {
+        uint64_t count{0};
+#ifdef __linux__
+        if (fd_ >= 0 && read(fd_, &count, sizeof(count)) != sizeof(count))
+        {
+            count = 0;
+        }
+#endif
+        return count;
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,263 @@
+// Multi-threaded scaling of the thread-safe filters.
+//
+// Usage: scaling [--threads=N,...] [--read-ratios=F,...] [--capacity=N]
+//                [--load=F] [--duration-ms=N] [--filters=NAME,...]
+//                [--perf-raw=0xCONFIG] [--seed=N] [--format=csv|json]
+//
+// For each filter, thread count and read ratio, N threads run a mix of lookups
+// and writes for a fixed time, once on one shared instance ("shared", the
+// Concurrent* filter) and once on a private instance per thread ("sharded", the
+// single-threaded filter with capacity / N keys). Every thread first fills its
+// share of the filter up to --load, then each write deletes its oldest key and
+// inserts a new one, so the load stays constant; reads look up live keys.
+//
+// Each row reports the aggregate Mops/s, the slowest and fastest thread, Jain's
+// fairness index of per-thread throughput, and a hardware event per op. The
+// event defaults to cache misses; pass the raw config of a cross-core transfer
+// event with --perf-raw (e.g. MEM_LOAD_L3_HIT_RETIRED.XSNP_HITM, 0x04d2, on
+// recent Intel cores) to count cache-line transfers. perf_per_op is -1 when
+// the event cannot be opened.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench_util.h"
+#include "perf_counter.h"
+#include "vecbf/concurrent_vecbf.h"
+#include "vecbf/vecbf.h"
+#include "vecf/concurrent_vecf.h"
+#include "vecf/vecf.h"
+#include "veqf/concurrent_veqf.h"
+#include "veqf/veqf.h"
+
+namespace
+{
+
+struct Config
+{
+    uint64_t capacity, duration_ms, seed;
+    double load;
+    uint32_t perf_type;
+    uint64_t perf_config;
+    std::string perf_name;
+};
+
+struct ThreadResult
+{
+    uint64_t ops{0}, hits{0}, perf_count{0};
+    bool perf_valid{false};
+};
+
+// Run one thread's share of the workload on `filter` once `start` is set
+template <typename Filter>
+void Worker(Filter *filter, uint64_t thread_id, uint64_t num_keys, double read_ratio,
+            const Config &config, std::atomic<uint64_t> *ready,
+            const std::atomic<bool> *start, const std::atomic<bool> *stop,
+            ThreadResult *result)
+{
+    bench::KeyGenerator gen(config.seed * 1000003 + thread_id);
+    std::vector<uint64_t> live(std::max<uint64_t>(num_keys, 1));
+    for (auto &key : live)
+    {
+        key = gen();
+        filter->Insert(key);
+    }
+    const uint64_t read_threshold{static_cast<uint64_t>(read_ratio * 1024)};
+    size_t oldest{0};
+
+    bench::PerfCounter counter(config.perf_type, config.perf_config);
+    ready->fetch_add(1);
+    while (!start->load(std::memory_order_acquire))
+    {
+        std::this_thread::yield();
+    }
+
+    counter.Start();
+    uint64_t ops{0}, found{0};
+    while (!stop->load(std::memory_order_relaxed))
+    {
+        // check the clock flag every 64 ops
+        for (int i = 0; i < 64; ++i, ++ops)
+        {
+            const uint64_t r{gen()};
+            if ((r & 1023) < read_threshold)
+            {
+                found += filter->Lookup(live[(r >> 10) % live.size()]);
+            }
+            else
+            {
+                filter->Delete(live[oldest]);
+                live[oldest] = gen();
+                filter->Insert(live[oldest]);
+                oldest = (oldest + 1) % live.size();
+            }
+        }
+    }
+    counter.Stop();
+
+    result->ops = ops;
+    result->hits = found;
+    result->perf_count = counter.Read();
+    result->perf_valid = counter.Valid();
+}
+
+template <typename Filter>
+std::vector<ThreadResult> RunThreads(std::vector<std::unique_ptr<Filter>> *filters,
+                                     uint64_t num_threads, double read_ratio,
+                                     const Config &config, uint64_t *nanos)
+{
+    const uint64_t keys_per_thread{
+        static_cast<uint64_t>(config.capacity * config.load / num_threads)};
+    std::vector<ThreadResult> results(num_threads);
+    std::atomic<uint64_t> ready{0};
+    std::atomic<bool> start{false}, stop{false};
+    std::vector<std::thread> threads;
+    for (uint64_t t = 0; t < num_threads; ++t)
+    {
+        Filter *filter{(*filters)[filters->size() == 1 ? 0 : t].get()};
+        threads.emplace_back(Worker<Filter>, filter, t, keys_per_thread, read_ratio,
+                             std::cref(config), &ready, &start, &stop, &results[t]);
+    }
+    while (ready.load() != num_threads)
+    {
+        std::this_thread::yield();
+    }
+    const uint64_t begin{bench::NowNanos()};
+    start.store(true, std::memory_order_release);
+    std::this_thread::sleep_for(std::chrono::milliseconds(config.duration_ms));
+    stop.store(true);
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+    *nanos = bench::NowNanos() - begin;
+    return results;
+}
+
+void Report(const std::string &mode, const std::string &name, uint64_t num_threads,
+            double read_ratio, const Config &config,
+            const std::vector<ThreadResult> &results, uint64_t nanos,
+            bench::Report *report)
+{
+    uint64_t ops{0}, perf_count{0}, min_ops{~0ULL}, max_ops{0};
+    double sum_squares{0};
+    bool perf_valid{true};
+    for (const auto &result : results)
+    {
+        ops += result.ops;
+        perf_count += result.perf_count;
+        perf_valid &= result.perf_valid;
+        min_ops = std::min(min_ops, result.ops);
+        max_ops = std::max(max_ops, result.ops);
+        sum_squares += 1.0 * result.ops * result.ops;
+    }
+
+    bench::Report::Row row;
+    row.Add("mode", mode)
+        .Add("filter", name)
+        .Add("threads", num_threads)
+        .Add("read_ratio", read_ratio)
+        .Add("mops", bench::Mops(ops, nanos))
+        .Add("min_thread_mops", bench::Mops(min_ops, nanos))
+        .Add("max_thread_mops", bench::Mops(max_ops, nanos))
+        .Add("jain_fairness",
+             sum_squares == 0 ? 0.0 : 1.0 * ops * ops / (num_threads * sum_squares))
+        .Add("perf_event", config.perf_name)
+        .Add("perf_per_op", perf_valid && ops != 0 ? 1.0 * perf_count / ops : -1.0);
+    report->Print(row);
+}
+
+template <typename SharedFilter, typename ShardFilter>
+void Run(const std::string &name, uint64_t num_threads, double read_ratio,
+         const Config &config, bench::Report *report)
+{
+    uint64_t nanos;
+    {
+        std::vector<std::unique_ptr<SharedFilter>> filters;
+        filters.emplace_back(new SharedFilter(config.capacity));
+        auto results{RunThreads(&filters, num_threads, read_ratio, config, &nanos)};
+        Report("shared", name, num_threads, read_ratio, config, results, nanos, report);
+    }
+    {
+        std::vector<std::unique_ptr<ShardFilter>> filters;
+        for (uint64_t t = 0; t < num_threads; ++t)
+        {
+            filters.emplace_back(new ShardFilter(config.capacity / num_threads));
+        }
+        auto results{RunThreads(&filters, num_threads, read_ratio, config, &nanos)};
+        Report("sharded", name, num_threads, read_ratio, config, results, nanos,
+               report);
+    }
+}
+
+struct Benchmark
+{
+    const char *name;
+    void (*run)(const std::string &, uint64_t, double, const Config &,
+                bench::Report *);
+};
+
+const Benchmark kBenchmarks[]{
+    {"VECF12", Run<vecf::ConcurrentVECF<uint64_t, 12>, vecf::VECF<uint64_t, 12>>},
+    {"VEQF12", Run<veqf::ConcurrentVEQF<uint64_t, 12>, veqf::VEQF<uint64_t, 12>>},
+    {"VECBF8", Run<vecbf::ConcurrentVECBF<uint64_t, 8>, vecbf::VECBF<uint64_t, 8>>},
+};
+
+std::string DefaultThreads()
+{
+    const uint64_t nproc{std::max(1U, std::thread::hardware_concurrency())};
+    std::string threads;
+    for (uint64_t n = 1; n < nproc; n *= 2)
+    {
+        threads += std::to_string(n) + ",";
+    }
+    return threads + std::to_string(nproc);
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    const bench::Args args(argc, argv);
+    Config config{args.GetUint("capacity", 1 << 22),
+                  args.GetUint("duration-ms", 1000),
+                  args.GetUint("seed", 1),
+                  args.GetDouble("load", 0.5),
+                  PERF_TYPE_HARDWARE,
+                  PERF_COUNT_HW_CACHE_MISSES,
+                  "cache_misses"};
+    if (args.Has("perf-raw"))
+    {
+        config.perf_type = PERF_TYPE_RAW;
+        config.perf_config = args.GetUint("perf-raw", 0);
+        config.perf_name = "raw:" + args.Get("perf-raw", "");
+    }
+    const std::vector<std::string> threads{args.GetList("threads", DefaultThreads())};
+    const std::vector<std::string> read_ratios{args.GetList("read-ratios", "0.5,0.9,1")};
+    const std::vector<std::string> filters{args.GetList("filters", "")};
+
+    bench::Report report(args.GetFormat());
+    for (const auto &benchmark : kBenchmarks)
+    {
+        if (!filters.empty() &&
+            std::find(filters.begin(), filters.end(), benchmark.name) == filters.end())
+        {
+            continue;
+        }
+        for (const auto &num_threads : threads)
+        {
+            for (const auto &read_ratio : read_ratios)
+            {
+                benchmark.run(benchmark.name,
+                              std::max<uint64_t>(1, strtoull(num_threads.c_str(), nullptr, 0)),
+                              strtod(read_ratio.c_str(), nullptr), config, &report);
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,180 @@
+// Effect of huge pages and NUMA placement on lookups into large filters.
+//
+// Usage: tlb [--size=N] [--load=F] [--lookups=N] [--pages=NAME,...]
+//            [--numa=default|interleave|bind] [--numa-nodes=MASK]
+//            [--filters=NAME,...] [--seed=N] [--format=csv|json]
+//
+// For each filter and page size (default, thp, 2mb, 1gb), a filter of --size
+// keys is filled up to --load and probed with random negative lookups. Each
+// row reports the lookup Mops/s and latency, the dTLB load misses per lookup
+// (-1 where perf_event_open is unavailable) and how much of the process is
+// backed by huge pages, which shows whether the request was honored.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "bench_util.h"
+#include "memutil.h"
+#include "perf_counter.h"
+#include "vecbf/vecbf.h"
+#include "vecf/vecf.h"
+#include "veqf/veqf.h"
+
+namespace
+{
+
+struct Config
+{
+    uint64_t size, lookups, seed, sample_every;
+    double load;
+};
+
+// AnonHugePages + Private_Hugetlb of the process, in KB
+uint64_t HugePagesKB()
+{
+    FILE *file{fopen("/proc/self/smaps_rollup", "r")};
+    if (file == nullptr)
+    {
+        return 0;
+    }
+    uint64_t total{0}, kb;
+    char line[256];
+    while (fgets(line, sizeof(line), file) != nullptr)
+    {
+        if (sscanf(line, "AnonHugePages: %lu kB", &kb) == 1 ||
+            sscanf(line, "Private_Hugetlb: %lu kB", &kb) == 1)
+        {
+            total += kb;
+        }
+    }
+    fclose(file);
+    return total;
+}
+
+template <typename Filter>
+void Run(const std::string &name, const std::string &pages,
+         const memutil::AllocOptions &options, const Config &config,
+         bench::Report *report)
+{
+    Filter filter(config.size, options);
+    bench::KeyGenerator gen(config.seed);
+    const uint64_t num_keys{static_cast<uint64_t>(config.size * config.load)};
+    for (uint64_t i = 0; i < num_keys && filter.Insert(gen()); ++i)
+    {
+    }
+    std::vector<uint64_t> negatives(config.lookups);
+    for (auto &key : negatives)
+    {
+        key = gen();
+    }
+
+    bench::PerfCounter dtlb_misses(
+        PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+                                (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+    bench::LatencySampler latency(config.sample_every);
+    uint64_t found{0}, done;
+    dtlb_misses.Start();
+    const uint64_t nanos{bench::TimeOps(negatives.size(), &latency, false, &done,
+                                        [&](uint64_t i) {
+                                            found += filter.Lookup(negatives[i]);
+                                            return true;
+                                        })};
+    dtlb_misses.Stop();
+
+    bench::Report::Row row;
+    row.Add("filter", name)
+        .Add("pages", pages)
+        .Add("size", config.size)
+        .Add("size_mb", 1.0 * filter.SizeInBytes() / (1 << 20))
+        .Add("huge_pages_mb", 1.0 * HugePagesKB() / 1024)
+        .Add("lookup_mops", bench::Mops(negatives.size(), nanos))
+        .Add("lookup_p50_ns", latency.Percentile(0.5))
+        .Add("lookup_p99_ns", latency.Percentile(0.99))
+        .Add("dtlb_misses_per_lookup",
+             dtlb_misses.Valid() ? 1.0 * dtlb_misses.Read() / negatives.size() : -1.0)
+        .Add("fpr", 1.0 * found / negatives.size());
+    report->Print(row);
+}
+
+struct Benchmark
+{
+    const char *name;
+    void (*run)(const std::string &, const std::string &, const memutil::AllocOptions &,
+                const Config &, bench::Report *);
+};
+
+// VECBF takes the false positive rate before the options
+template <uint64_t kBitsPerCounter>
+class DefaultVECBF : public vecbf::VECBF<uint64_t, kBitsPerCounter>
+{
+  public:
+    DefaultVECBF(uint64_t max_num_keys, const memutil::AllocOptions &options)
+        : vecbf::VECBF<uint64_t, kBitsPerCounter>(max_num_keys, 0.04, options)
+    {
+    }
+};
+
+const Benchmark kBenchmarks[]{
+    {"VECF12", Run<vecf::VECF<uint64_t, 12>>},
+    {"VECF12Aligned", Run<vecf::VECF<uint64_t, 12, vecf::AlignedSingleTable>>},
+    {"VEQF12", Run<veqf::VEQF<uint64_t, 12>>},
+    {"VECBF8", Run<DefaultVECBF<8>>},
+};
+
+const std::pair<const char *, memutil::PageSize> kPageSizes[]{
+    {"default", memutil::PageSize::kDefault},
+    {"thp", memutil::PageSize::kTransparentHuge},
+    {"2mb", memutil::PageSize::kHuge2MB},
+    {"1gb", memutil::PageSize::kHuge1GB},
+};
+
+}
+
+int main(int argc, char **argv)
+{
+    const bench::Args args(argc, argv);
+    const Config config{args.GetUint("size", 1 << 26), args.GetUint("lookups", 1 << 24),
+                        args.GetUint("seed", 1), args.GetUint("sample-every", 16),
+                        args.GetDouble("load", 0.9)};
+
+    memutil::AllocOptions options;
+    const std::string numa{args.Get("numa", "default")};
+    if (numa == "interleave" || numa == "bind")
+    {
+        options.numa = numa == "bind" ? memutil::NumaPolicy::kBind
+                                      : memutil::NumaPolicy::kInterleave;
+    }
+    else if (numa != "default")
+    {
+        fprintf(stderr, "unknown numa policy: %s\n", numa.c_str());
+        return 1;
+    }
+    options.numa_nodes = args.GetUint("numa-nodes", 0);
+
+    const std::vector<std::string> pages{args.GetList("pages", "default,thp,2mb")};
+    const std::vector<std::string> filters{args.GetList("filters", "")};
+
+    bench::Report report(args.GetFormat());
+    for (const auto &benchmark : kBenchmarks)
+    {
+        if (!filters.empty() &&
+            std::find(filters.begin(), filters.end(), benchmark.name) == filters.end())
+        {
+            continue;
+        }
+        for (const auto &page_size : kPageSizes)
+        {
+            if (std::find(pages.begin(), pages.end(), page_size.first) != pages.end())
+            {
+                options.page_size = page_size.second;
+                benchmark.run(benchmark.name, page_size.first, options, config, &report);
+            }
+        }
+    }
+    return 0;
+}
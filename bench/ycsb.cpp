@@ -0,0 +1,343 @@
+// Replay YCSB workloads against the filters.
+//
+// Usage: ycsb --load=FILE --run=FILE [--filters=NAME,...] [--capacity=N]
+//             [--save=PREFIX] [--format=csv|json]
+//
+// FILE is either the text output of a YCSB basic DB run (`bin/ycsb load basic
+// ...` / `bin/ycsb run basic ...`) or a binary trace written by --save.
+// INSERT lines insert the key, READ and UPDATE look it up, DELETE deletes it and
+// SCAN is skipped. Keys like "user6284781860667377211" keep their number, other
+// keys are hashed.
+//
+// Binary trace: the magic "VEFTRC01", the number of records as a little endian
+// uint64_t, then each record as a uint8_t op followed by its uint64_t key.
+//
+// Deletes of keys that are not in the filter are dropped while loading, since
+// they would corrupt counting filters. One row is printed per filter and phase
+// with its Mops/s and the FPR of its reads. The capacity defaults to the peak
+// number of keys in the filter.
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "bench_util.h"
+#include "vecbf/vecbf.h"
+#include "vecf/vecf.h"
+#include "veqf/veqf.h"
+
+namespace
+{
+
+enum Op : uint8_t
+{
+    kInsert,
+    kRead,
+    kDelete,
+};
+
+struct Record
+{
+    Op op;
+    uint64_t key;
+};
+
+// The records of one phase, and the expected result of its reads
+struct Phase
+{
+    std::string name;
+    std::vector<Record> records;
+    std::vector<bool> expected;
+    uint64_t num_reads{0}, num_negative_reads{0};
+};
+
+constexpr char kTraceMagic[8]{'V', 'E', 'F', 'T', 'R', 'C', '0', '1'};
+
+uint64_t ParseKey(const char *begin, const char *end)
+{
+    const char *digits{begin};
+    while (digits != end && !isdigit(static_cast<unsigned char>(*digits)))
+    {
+        ++digits;
+    }
+    if (digits != end && end - digits <= 19 &&
+        std::all_of(digits, end, [](char c) { return isdigit(static_cast<unsigned char>(c)); }))
+    {
+        return strtoull(std::string(digits, end).c_str(), nullptr, 10);
+    }
+    // FNV-1a
+    uint64_t hash{0xcbf29ce484222325ULL};
+    for (const char *c = begin; c != end; ++c)
+    {
+        hash = (hash ^ static_cast<unsigned char>(*c)) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+bool ReadBinaryTrace(FILE *file, std::vector<Record> *records)
+{
+    uint64_t num_records;
+    if (fread(&num_records, sizeof(num_records), 1, file) != 1)
+    {
+        return false;
+    }
+    records->resize(num_records);
+    for (auto &record : *records)
+    {
+        uint8_t op;
+        if (fread(&op, sizeof(op), 1, file) != 1 ||
+            fread(&record.key, sizeof(record.key), 1, file) != 1 || op > kDelete)
+        {
+            return false;
+        }
+        record.op = static_cast<Op>(op);
+    }
+    return true;
+}
+
+void ReadTextTrace(FILE *file, std::vector<Record> *records)
+{
+    static const std::pair<const char *, int> kOps[]{
+        {"INSERT", kInsert}, {"READ", kRead}, {"UPDATE", kRead}, {"DELETE", kDelete},
+        {"SCAN", -1}};
+    char line[4096];
+    while (fgets(line, sizeof(line), file) != nullptr)
+    {
+        // OP table key [ fields ]
+        char *table{strchr(line, ' ')};
+        if (table == nullptr)
+        {
+            continue;
+        }
+        *table = '\0';
+        int op{-2};
+        for (const auto &known : kOps)
+        {
+            if (strcmp(line, known.first) == 0)
+            {
+                op = known.second;
+            }
+        }
+        char *key{strchr(table + 1, ' ')};
+        if (op < 0 || key == nullptr)
+        {
+            continue;
+        }
+        ++key;
+        char *key_end{key};
+        while (*key_end != '\0' && !isspace(static_cast<unsigned char>(*key_end)))
+        {
+            ++key_end;
+        }
+        records->push_back({static_cast<Op>(op), ParseKey(key, key_end)});
+    }
+}
+
+std::vector<Record> ReadTrace(const std::string &path)
+{
+    FILE *file{fopen(path.c_str(), "rb")};
+    if (file == nullptr)
+    {
+        fprintf(stderr, "cannot open %s\n", path.c_str());
+        exit(1);
+    }
+    std::vector<Record> records;
+    char magic[sizeof(kTraceMagic)];
+    if (fread(magic, sizeof(magic), 1, file) == 1 &&
+        memcmp(magic, kTraceMagic, sizeof(magic)) == 0)
+    {
+        if (!ReadBinaryTrace(file, &records))
+        {
+            fprintf(stderr, "truncated trace %s\n", path.c_str());
+            exit(1);
+        }
+    }
+    else
+    {
+        rewind(file);
+        ReadTextTrace(file, &records);
+    }
+    fclose(file);
+    return records;
+}
+
+void WriteTrace(const std::string &path, const std::vector<Record> &records)
+{
+    FILE *file{fopen(path.c_str(), "wb")};
+    if (file == nullptr)
+    {
+        fprintf(stderr, "cannot open %s\n", path.c_str());
+        exit(1);
+    }
+    const uint64_t num_records{records.size()};
+    fwrite(kTraceMagic, sizeof(kTraceMagic), 1, file);
+    fwrite(&num_records, sizeof(num_records), 1, file);
+    for (const auto &record : records)
+    {
+        const uint8_t op{record.op};
+        fwrite(&op, sizeof(op), 1, file);
+        fwrite(&record.key, sizeof(record.key), 1, file);
+    }
+    fclose(file);
+}
+
+// Drop deletes of missing keys and compute the expected result of the reads.
+// Return the peak number of keys in the filter.
+uint64_t Prepare(std::vector<Phase> *phases)
+{
+    std::unordered_map<uint64_t, uint64_t> counts;
+    uint64_t num_keys{0}, peak{0};
+    for (auto &phase : *phases)
+    {
+        std::vector<Record> records;
+        for (const auto &record : phase.records)
+        {
+            uint64_t &count{counts[record.key]};
+            switch (record.op)
+            {
+            case kInsert:
+                ++count;
+                peak = std::max(peak, ++num_keys);
+                break;
+            case kRead:
+                phase.expected.push_back(count != 0);
+                ++phase.num_reads;
+                phase.num_negative_reads += count == 0;
+                break;
+            case kDelete:
+                if (count == 0)
+                {
+                    continue;
+                }
+                --count;
+                --num_keys;
+                break;
+            }
+            records.push_back(record);
+        }
+        phase.records.swap(records);
+    }
+    return peak;
+}
+
+template <typename Filter>
+void Run(const std::string &name, uint64_t capacity, const std::vector<Phase> &phases,
+         bench::Report *report)
+{
+    Filter filter(capacity);
+    std::vector<bool> found;
+    for (const auto &phase : phases)
+    {
+        uint64_t insert_failures{0};
+        found.clear();
+        found.reserve(phase.num_reads);
+
+        const uint64_t start{bench::NowNanos()};
+        for (const auto &record : phase.records)
+        {
+            switch (record.op)
+            {
+            case kInsert:
+                insert_failures += !filter.Insert(record.key);
+                break;
+            case kRead:
+                found.push_back(filter.Lookup(record.key));
+                break;
+            case kDelete:
+                filter.Delete(record.key);
+                break;
+            }
+        }
+        const uint64_t nanos{bench::NowNanos() - start};
+
+        uint64_t false_positives{0}, false_negatives{0};
+        for (size_t i = 0; i < found.size(); ++i)
+        {
+            false_positives += found[i] && !phase.expected[i];
+            false_negatives += !found[i] && phase.expected[i];
+        }
+
+        bench::Report::Row row;
+        row.Add("filter", name)
+            .Add("phase", phase.name)
+            .Add("capacity", capacity)
+            .Add("ops", uint64_t{phase.records.size()})
+            .Add("reads", phase.num_reads)
+            .Add("mops", bench::Mops(phase.records.size(), nanos))
+            .Add("fpr", phase.num_negative_reads == 0
+                            ? 0.0
+                            : 1.0 * false_positives / phase.num_negative_reads)
+            .Add("false_negatives", false_negatives)
+            .Add("insert_failures", insert_failures)
+            .Add("load_factor", filter.LoadFactor());
+        report->Print(row);
+    }
+}
+
+struct Benchmark
+{
+    const char *name;
+    void (*run)(const std::string &, uint64_t, const std::vector<Phase> &,
+                bench::Report *);
+};
+
+const Benchmark kBenchmarks[]{
+    {"VECF8", Run<vecf::VECF<uint64_t, 8>>},
+    {"VECF12", Run<vecf::VECF<uint64_t, 12>>},
+    {"VECF16", Run<vecf::VECF<uint64_t, 16>>},
+    {"VEQF8", Run<veqf::VEQF<uint64_t, 8>>},
+    {"VEQF10", Run<veqf::VEQF<uint64_t, 10>>},
+    {"VEQF12", Run<veqf::VEQF<uint64_t, 12>>},
+    {"VEQF14", Run<veqf::VEQF<uint64_t, 14>>},
+    {"VEQF16", Run<veqf::VEQF<uint64_t, 16>>},
+    {"VECBF8", Run<vecbf::VECBF<uint64_t, 8>>},
+};
+
+}
+
+int main(int argc, char **argv)
+{
+    const bench::Args args(argc, argv);
+    if (!args.Has("load") && !args.Has("run"))
+    {
+        fprintf(stderr, "usage: %s --load=FILE --run=FILE [--filters=NAME,...] "
+                        "[--capacity=N] [--save=PREFIX] [--format=csv|json]\n",
+                argv[0]);
+        return 1;
+    }
+
+    std::vector<Phase> phases;
+    for (const char *name : {"load", "run"})
+    {
+        if (args.Has(name))
+        {
+            phases.push_back({name, ReadTrace(args.Get(name, "")), {}});
+        }
+    }
+    if (args.Has("save"))
+    {
+        for (const auto &phase : phases)
+        {
+            WriteTrace(args.Get("save", "") + "." + phase.name + ".bin", phase.records);
+        }
+    }
+
+    const uint64_t capacity{args.GetUint("capacity", std::max<uint64_t>(Prepare(&phases), 1))};
+    const std::vector<std::string> filters{args.GetList("filters", "")};
+
+    bench::Report report(args.GetFormat());
+    for (const auto &benchmark : kBenchmarks)
+    {
+        if (filters.empty() ||
+            std::find(filters.begin(), filters.end(), benchmark.name) != filters.end())
+        {
+            benchmark.run(benchmark.name, capacity, phases, &report);
+        }
+    }
+    return 0;
+}
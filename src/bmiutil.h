@@ -0,0 +1,226 @@
+#ifndef BMIUTIL_H_
+#define BMIUTIL_H_
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+#include <cstdint>
+
+namespace bmiutil
+{
+
+// Parallel bit extract and deposit, the pext/pdep of BMI2, which the VECF
+// bucket encodings and the VEQF select are built on.
+//
+// Built with BMI2 (-mbmi2, the default, see VEFILTER_ISA in CMakeLists.txt),
+// Pext64 and friends are the instructions. Built with VEFILTER_DISPATCH
+// instead, they call the codec picked from cpuid at the first call, so that
+// one binary runs well on every x86-64 part:
+// - kBmi2, the instructions, where they are fast: Intel since Haswell and AMD
+//   since Zen 3. Zen 1/2 and earlier AMD parts run them as microcode, tens to
+//   hundreds of cycles depending on the mask.
+// - kVbmi2, one bit per byte of a 512-bit vector, compressed or expanded with
+//   AVX-512 VBMI2, a dozen cycles for any mask.
+// - kPortable, shifts over the runs of set bits of the mask, which the masks
+//   of the bucket encodings have a few of.
+enum class Codec
+{
+    kBmi2,
+    kVbmi2,
+    kPortable,
+};
+
+namespace detail
+{
+
+// lowest run of set bits of mask != 0
+inline uint64_t LowestRun(uint64_t mask)
+{
+    return mask & ~(mask + (mask & -mask));
+}
+
+inline uint64_t PextPortable(uint64_t x, uint64_t mask)
+{
+    uint64_t ret{0}, shift{0};
+    while (mask != 0)
+    {
+        const uint64_t run{LowestRun(mask)};
+        ret |= (x & run) >> __builtin_ctzll(run) << shift;
+        shift += __builtin_popcountll(run);
+        mask ^= run;
+    }
+    return ret;
+}
+
+inline uint64_t PdepPortable(uint64_t x, uint64_t mask)
+{
+    uint64_t ret{0};
+    while (mask != 0)
+    {
+        const uint64_t run{LowestRun(mask)};
+        ret |= (x << __builtin_ctzll(run)) & run;
+        x >>= __builtin_popcountll(run);
+        mask ^= run;
+    }
+    return ret;
+}
+
+__attribute__((target("bmi2"))) inline uint64_t PextBmi2(uint64_t x, uint64_t mask)
+{
+    return _pext_u64(x, mask);
+}
+
+__attribute__((target("bmi2"))) inline uint64_t PdepBmi2(uint64_t x, uint64_t mask)
+{
+    return _pdep_u64(x, mask);
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vbmi2"))) inline uint64_t PextVbmi2(
+    uint64_t x, uint64_t mask)
+{
+    return _mm512_movepi8_mask(_mm512_maskz_compress_epi8(mask, _mm512_movm_epi8(x)));
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vbmi2"))) inline uint64_t PdepVbmi2(
+    uint64_t x, uint64_t mask)
+{
+    return _mm512_movepi8_mask(_mm512_maskz_expand_epi8(mask, _mm512_movm_epi8(x)));
+}
+
+// pext and pdep run as microcode on AMD families before 19h (Zen 3)
+inline bool HasSlowBmi2()
+{
+    unsigned eax, ebx, ecx, edx;
+    if (!__get_cpuid(0, &eax, &ebx, &ecx, &edx) || ebx != signature_AMD_ebx ||
+        !__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    {
+        return false;
+    }
+    const unsigned family{((eax >> 8) & 0xf) + ((eax >> 20) & 0xff)};
+    return family < 0x19;
+}
+
+}
+
+struct CodecOps
+{
+    uint64_t (*pext)(uint64_t x, uint64_t mask);
+    uint64_t (*pdep)(uint64_t x, uint64_t mask);
+};
+
+inline bool IsSupported(Codec codec)
+{
+    __builtin_cpu_init();
+    switch (codec)
+    {
+    case Codec::kBmi2:
+        return __builtin_cpu_supports("bmi2");
+    case Codec::kVbmi2:
+        return __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vbmi2");
+    default:
+        return true;
+    }
+}
+
+// The fastest codec of this CPU
+inline Codec DetectCodec()
+{
+    if (IsSupported(Codec::kBmi2) && !detail::HasSlowBmi2())
+    {
+        return Codec::kBmi2;
+    }
+    if (IsSupported(Codec::kVbmi2))
+    {
+        return Codec::kVbmi2;
+    }
+    return Codec::kPortable;
+}
+
+// The functions of `codec`, which must be supported
+inline CodecOps OpsOf(Codec codec)
+{
+    switch (codec)
+    {
+    case Codec::kBmi2:
+        return {detail::PextBmi2, detail::PdepBmi2};
+    case Codec::kVbmi2:
+        return {detail::PextVbmi2, detail::PdepVbmi2};
+    default:
+        return {detail::PextPortable, detail::PdepPortable};
+    }
+}
+
+#if defined(VEFILTER_DISPATCH) || !defined(__BMI2__)
+
+namespace detail
+{
+
+// A function-local static, so that filters built by static initializers of
+// other translation units see it initialized
+inline CodecOps &ActiveOps()
+{
+    static CodecOps ops{OpsOf(DetectCodec())};
+    return ops;
+}
+
+}
+
+constexpr bool kDispatch{true};
+
+// Switch all filters to `codec`, for benchmarks and tests. Return false if it
+// is not supported. Not thread safe.
+inline bool SetCodec(Codec codec)
+{
+    if (!IsSupported(codec))
+    {
+        return false;
+    }
+    detail::ActiveOps() = OpsOf(codec);
+    return true;
+}
+
+inline uint64_t Pext64(uint64_t x, uint64_t mask)
+{
+    return detail::ActiveOps().pext(x, mask);
+}
+
+inline uint64_t Pdep64(uint64_t x, uint64_t mask)
+{
+    return detail::ActiveOps().pdep(x, mask);
+}
+
+#else
+
+constexpr bool kDispatch{false};
+
+// The filters always use the instructions
+inline bool SetCodec(Codec codec)
+{
+    return codec == Codec::kBmi2;
+}
+
+inline uint64_t Pext64(uint64_t x, uint64_t mask)
+{
+    return _pext_u64(x, mask);
+}
+
+inline uint64_t Pdep64(uint64_t x, uint64_t mask)
+{
+    return _pdep_u64(x, mask);
+}
+
+#endif
+
+inline uint32_t Pext32(uint32_t x, uint32_t mask)
+{
+    return static_cast<uint32_t>(Pext64(x, mask));
+}
+
+inline uint32_t Pdep32(uint32_t x, uint32_t mask)
+{
+    return static_cast<uint32_t>(Pdep64(x, mask));
+}
+
+}
+
+#endif
@@ -0,0 +1,116 @@
+#ifndef FIELDUTIL_H_
+#define FIELDUTIL_H_
+
+#include <cstdint>
+
+namespace fieldutil
+{
+
+// Storage policies for arrays of kBits-bit fields in 64-bit words, e.g. the
+// remainders of VEQF or the counters of VECBF. Word is uint64_t, or
+// std::atomic<uint64_t> for the tables of the concurrent filters.
+
+// Fields back to back, so no bit is wasted, but a field whose bits cross a
+// word boundary takes a second word and a branch.
+template <uint64_t kBits>
+struct PackedFields
+{
+    constexpr static bool kAligned{false};
+    constexpr static uint64_t kMask{(1ull << kBits) - 1};
+
+    // words holding `n` fields
+    constexpr static uint64_t Words(uint64_t n)
+    {
+        return (n * kBits + 63) / 64;
+    }
+
+    // first bit of field `i`
+    constexpr static uint64_t BitOf(uint64_t i)
+    {
+        return i * kBits;
+    }
+
+    // word holding the first bit of field `i`
+    static inline uint64_t WordOf(uint64_t i)
+    {
+        return i * kBits / 64;
+    }
+
+    template <typename Word>
+    static inline uint64_t Get(const Word *words, uint64_t i)
+    {
+        uint64_t bitpos{i * kBits};
+        uint64_t tabpos{bitpos / 64}, slotpos{bitpos % 64};
+        int64_t spillbits{static_cast<int64_t>(slotpos + kBits) - 64};
+        uint64_t ret{(words[tabpos] >> slotpos) & kMask};
+        if (spillbits > 0)
+        {
+            ++tabpos;
+            uint64_t x{words[tabpos] & ((1ull << spillbits) - 1)};
+            ret |= x << (kBits - spillbits);
+        }
+        return ret;
+    }
+
+    template <typename Word>
+    static inline void Set(Word *words, uint64_t i, uint64_t value)
+    {
+        uint64_t bitpos{i * kBits};
+        uint64_t tabpos{bitpos / 64}, slotpos{bitpos % 64};
+        int64_t spillbits{static_cast<int64_t>(slotpos + kBits) - 64};
+        value &= kMask;
+        words[tabpos] &= ~(kMask << slotpos);
+        words[tabpos] |= value << slotpos;
+        if (spillbits > 0)
+        {
+            ++tabpos;
+            words[tabpos] &= ~((1ull << spillbits) - 1);
+            words[tabpos] |= value >> (kBits - spillbits);
+        }
+    }
+};
+
+// floor(64 / kBits) fields per word, so that every field is read and written
+// in one word without a branch. The top 64 % kBits bits of each word are
+// unused: nothing for 8 and 16 bits, 4 bits in 64 for 10 and 12 bits, 8 in 64
+// for 14 bits.
+template <uint64_t kBits>
+struct AlignedFields
+{
+    constexpr static bool kAligned{true};
+    constexpr static uint64_t kMask{(1ull << kBits) - 1};
+    constexpr static uint64_t kFieldsPerWord{64 / kBits};
+
+    constexpr static uint64_t Words(uint64_t n)
+    {
+        return (n + kFieldsPerWord - 1) / kFieldsPerWord;
+    }
+
+    constexpr static uint64_t BitOf(uint64_t i)
+    {
+        return i / kFieldsPerWord * 64 + i % kFieldsPerWord * kBits;
+    }
+
+    static inline uint64_t WordOf(uint64_t i)
+    {
+        return i / kFieldsPerWord;
+    }
+
+    template <typename Word>
+    static inline uint64_t Get(const Word *words, uint64_t i)
+    {
+        return (words[i / kFieldsPerWord] >> (i % kFieldsPerWord * kBits)) & kMask;
+    }
+
+    template <typename Word>
+    static inline void Set(Word *words, uint64_t i, uint64_t value)
+    {
+        const uint64_t shift{i % kFieldsPerWord * kBits};
+        Word &word{words[i / kFieldsPerWord]};
+        word = (word & ~(kMask << shift)) | (value & kMask) << shift;
+    }
+};
+
+}
+
+#endif
@@ -1,10 +1,52 @@
 #ifndef HASHUTIL_H_
 #define HASHUTIL_H_
 
+#include <immintrin.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <random>
+#include <string_view>
 
 namespace hashutil
 {
+// Expand a seed into a stream of well mixed words, see Sebastiano Vigna's
+// SplitMix64. Used to derive all hash parameters from one seed.
+inline uint64_t SplitMix64(uint64_t *state)
+{
+    uint64_t z{*state += 0x9e3779b97f4a7c15ULL};
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+namespace detail
+{
+
+#ifdef __AVX2__
+// low 64 bits of a * b in each lane, from three 32x32->64 bit products
+inline __m256i MultiplyLow(__m256i a, __m256i b)
+{
+    const __m256i cross{_mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b),
+                                         _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)))};
+    return _mm256_add_epi64(_mm256_mul_epu32(a, b), _mm256_slli_epi64(cross, 32));
+}
+#endif
+
+}
+
+inline uint64_t RandomSeed()
+{
+    ::std::random_device random;
+    return random() | static_cast<uint64_t>(random()) << 32;
+}
+
+// Hash families are default constructible with random parameters, or
+// constructible from a seed, in which case equal seeds give equal functions
+// across instances and processes.
+
 // See Martin Dietzfelbinger, "Universal hashing and k-wise independent random
 // variables via integer arithmetic without primes".
 class TwoIndependentMultiplyShift
@@ -26,12 +68,280 @@ class TwoIndependentMultiplyShift
         }
     }
 
+    explicit TwoIndependentMultiplyShift(uint64_t seed)
+    {
+        for (auto v : {&multiply_, &add_})
+        {
+            *v = SplitMix64(&seed);
+            *v = (*v << 64) | SplitMix64(&seed);
+        }
+    }
+
     uint64_t operator()(uint64_t key) const
     {
         return (add_ + multiply_ * static_cast<decltype(multiply_)>(key)) >> 64;
     }
 };
 
+// wyhash-style 64-bit hash: two rounds of the 64x64->128 bit multiply-fold
+// mixer of Wang Yi's wyhash. One 64-bit multiply instead of the 128-bit one
+// above, but no universality guarantee.
+class WyHash
+{
+    uint64_t seed_;
+
+    constexpr static uint64_t kP0{0xa0761d6478bd642fULL}, kP1{0xe7037ed1a0b428dbULL};
+
+    static inline uint64_t Mix(uint64_t a, uint64_t b)
+    {
+        const unsigned __int128 r{static_cast<unsigned __int128>(a) * b};
+        return static_cast<uint64_t>(r) ^ static_cast<uint64_t>(r >> 64);
+    }
+
+  public:
+    WyHash()
+        : WyHash(RandomSeed())
+    {
+    }
+
+    explicit WyHash(uint64_t seed)
+        : seed_(SplitMix64(&seed))
+    {
+    }
+
+    uint64_t operator()(uint64_t key) const
+    {
+        return Mix(Mix(key ^ kP0, seed_ ^ kP1), key ^ kP1);
+    }
+};
+
+// Two multiply-add-shift hashes of 32 bits, the high halves of a_j * key + b_j
+// mod 2^64, concatenated. 64-bit products keep the universality of
+// multiply-shift while staying cheap in SIMD: AVX2 builds each one from three
+// 32x32->64 bit products (vpmuludq), so that HashBatch hashes 4 keys at once.
+class SimdMultiplyShift
+{
+    uint64_t multiply_[2], add_[2];
+
+    void Init(uint64_t seed)
+    {
+        for (int j = 0; j < 2; ++j)
+        {
+            multiply_[j] = SplitMix64(&seed) | 1;
+            add_[j] = SplitMix64(&seed);
+        }
+    }
+
+  public:
+    SimdMultiplyShift()
+    {
+        Init(RandomSeed());
+    }
+
+    explicit SimdMultiplyShift(uint64_t seed)
+    {
+        Init(seed);
+    }
+
+    uint64_t operator()(uint64_t key) const
+    {
+        return ((multiply_[0] * key + add_[0]) >> 32) |
+               ((multiply_[1] * key + add_[1]) & 0xffffffff00000000ULL);
+    }
+
+    // out[i] = (*this)(keys[i])
+    void HashBatch(const uint64_t *keys, size_t n, uint64_t *out) const
+    {
+        size_t i{0};
+#ifdef __AVX2__
+        const __m256i multiply0{_mm256_set1_epi64x(multiply_[0])},
+            multiply1{_mm256_set1_epi64x(multiply_[1])}, add0{_mm256_set1_epi64x(add_[0])},
+            add1{_mm256_set1_epi64x(add_[1])},
+            high_mask{_mm256_set1_epi64x(0xffffffff00000000ULL)};
+        for (; i + 4 <= n; i += 4)
+        {
+            const __m256i key{
+                _mm256_loadu_si256(reinterpret_cast<const __m256i *>(keys + i))};
+            const __m256i h0{_mm256_add_epi64(detail::MultiplyLow(key, multiply0), add0)};
+            const __m256i h1{_mm256_add_epi64(detail::MultiplyLow(key, multiply1), add1)};
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i),
+                                _mm256_or_si256(_mm256_srli_epi64(h0, 32),
+                                                _mm256_and_si256(h1, high_mask)));
+        }
+#endif
+        for (; i < n; ++i)
+        {
+            out[i] = (*this)(keys[i]);
+        }
+    }
+};
+
+// Byte strings are folded into a 64-bit word before the hash family of a
+// filter is applied: the fold xors each 8-byte little-endian word into an
+// accumulator, then multiplies and xorshifts it, which is a bijection of the
+// accumulator, so keys of equal length differing in a single word never
+// collide. The fold is not seeded; seeds act on the folded word. Only 64-bit
+// multiplies are used so that HashBytesBatch can fold 4 keys per AVX2 lane set.
+//
+// The std::string_view overloads of the filters hash the folded word with the
+// hash family of the filter and go through InsertHash/LookupHash/DeleteHash,
+// whatever their ItemType.
+//
+// InsertHash, LookupHash and DeleteHash take a pre-hashed key: a 64-bit hash
+// in place of the key, which skips the hash family and must be as uniform as a
+// good 64-bit hash of the key, e.g. a fingerprint computed upstream by a
+// seeded hash. Each filter picks its slots from given bits of it, so bias in
+// those bits raises the false positive rate. A filter must not mix pre-hashed
+// and ItemType keys.
+namespace detail
+{
+
+constexpr uint64_t kBytesSeed{0x243f6a8885a308d3ULL}, kBytesMultiply{0x9fb21c651e98df25ULL};
+
+inline uint64_t LoadWord(const char *p, size_t n = 8)
+{
+    uint64_t word{0};
+    memcpy(&word, p, n);
+    return word;
+}
+
+inline uint64_t BytesRound(uint64_t acc, uint64_t word)
+{
+    acc = (acc ^ word) * kBytesMultiply;
+    return acc ^ (acc >> 29);
+}
+
+inline uint64_t BytesFinish(uint64_t acc, uint64_t length)
+{
+    acc = BytesRound(acc, length);
+    return SplitMix64(&acc);
+}
+
+// Fold data[offset, length) into `acc` and finish, offset a multiple of 8
+inline uint64_t HashBytesFrom(uint64_t acc, const char *data, size_t length, size_t offset)
+{
+    for (; offset + 8 <= length; offset += 8)
+    {
+        acc = BytesRound(acc, LoadWord(data + offset));
+    }
+    if (offset != length)
+    {
+        acc = BytesRound(acc, LoadWord(data + offset, length - offset));
+    }
+    return BytesFinish(acc, length);
+}
+
+}
+
+inline uint64_t HashBytes(const void *data, size_t length)
+{
+    return detail::HashBytesFrom(detail::kBytesSeed, static_cast<const char *>(data), length,
+                                 0);
+}
+
+inline uint64_t HashBytes(std::string_view key)
+{
+    return HashBytes(key.data(), key.size());
+}
+
+// HashBytes of a key given in pieces, e.g. a URL split over buffers:
+// Update(a), Update(b) then Digest() equals HashBytes(a + b).
+class StreamingHash
+{
+    uint64_t acc_{detail::kBytesSeed}, length_{0};
+    char buffer_[8]; // the last length_ % 8 bytes, not folded yet
+
+  public:
+    void Update(const void *data, size_t n)
+    {
+        const char *p{static_cast<const char *>(data)};
+        size_t buffered{length_ % 8};
+        length_ += n;
+        if (buffered != 0)
+        {
+            const size_t fill{std::min(n, 8 - buffered)};
+            memcpy(buffer_ + buffered, p, fill);
+            p += fill;
+            n -= fill;
+            if (buffered + fill < 8)
+            {
+                return;
+            }
+            acc_ = detail::BytesRound(acc_, detail::LoadWord(buffer_));
+        }
+        for (; n >= 8; p += 8, n -= 8)
+        {
+            acc_ = detail::BytesRound(acc_, detail::LoadWord(p));
+        }
+        memcpy(buffer_, p, n);
+    }
+
+    void Update(std::string_view piece)
+    {
+        Update(piece.data(), piece.size());
+    }
+
+    uint64_t Digest() const
+    {
+        uint64_t acc{acc_};
+        if (length_ % 8 != 0)
+        {
+            acc = detail::BytesRound(acc, detail::LoadWord(buffer_, length_ % 8));
+        }
+        return detail::BytesFinish(acc, length_);
+    }
+};
+
+// out[i] = HashBytes(keys[i]). With AVX2, groups of 4 keys are folded together
+// up to the length of the shortest one, and each key is finished alone.
+inline void HashBytesBatch(const std::string_view *keys, size_t n, uint64_t *out)
+{
+    size_t i{0};
+#ifdef __AVX2__
+    const __m256i multiply{_mm256_set1_epi64x(detail::kBytesMultiply)};
+    for (; i + 4 <= n; i += 4)
+    {
+        const std::string_view *k{keys + i};
+        const size_t common{
+            std::min({k[0].size(), k[1].size(), k[2].size(), k[3].size()}) / 8 * 8};
+        __m256i acc{_mm256_set1_epi64x(detail::kBytesSeed)};
+        for (size_t offset = 0; offset < common; offset += 8)
+        {
+            const __m256i words{_mm256_set_epi64x(
+                detail::LoadWord(k[3].data() + offset), detail::LoadWord(k[2].data() + offset),
+                detail::LoadWord(k[1].data() + offset), detail::LoadWord(k[0].data() + offset))};
+            acc = detail::MultiplyLow(_mm256_xor_si256(acc, words), multiply);
+            acc = _mm256_xor_si256(acc, _mm256_srli_epi64(acc, 29));
+        }
+        uint64_t lanes[4];
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes), acc);
+        for (size_t j = 0; j < 4; ++j)
+        {
+            out[i + j] = detail::HashBytesFrom(lanes[j], k[j].data(), k[j].size(), common);
+        }
+    }
+#endif
+    for (; i < n; ++i)
+    {
+        out[i] = HashBytes(keys[i]);
+    }
+}
+
+// Hash `keys` with HashBytesBatch a chunk at a time and call
+// op(hashes, first key index, number of keys) on each chunk
+template <typename Op>
+void ForEachHashedChunk(const std::string_view *keys, size_t n, Op &&op)
+{
+    constexpr size_t kChunkSize{64};
+    uint64_t hashes[kChunkSize];
+    for (size_t base = 0; base < n; base += kChunkSize)
+    {
+        const size_t m{std::min(kChunkSize, n - base)};
+        HashBytesBatch(keys + base, m, hashes);
+        op(hashes, base, m);
+    }
+}
+
 }
 
 #endif
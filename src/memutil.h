@@ -0,0 +1,181 @@
+#ifndef MEMUTIL_H_
+#define MEMUTIL_H_
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+
+namespace memutil
+{
+
+enum class PageSize
+{
+    kDefault,         // 4 KB pages
+    kTransparentHuge, // madvise(MADV_HUGEPAGE), needs THP in madvise or always mode
+    kHuge2MB,         // MAP_HUGETLB, from the reserved 2 MB pool
+    kHuge1GB,         // MAP_HUGETLB, from the reserved 1 GB pool
+};
+
+enum class NumaPolicy
+{
+    kDefault,    // first touch
+    kInterleave, // pages round-robin over `numa_nodes`
+    kBind,       // pages only on `numa_nodes`
+};
+
+// How the tables of a filter are allocated. Tables are always 64-byte aligned
+// and zeroed. Huge pages fall back to transparent huge pages when the reserved
+// pool is empty, and NUMA policies are best effort.
+struct AllocOptions
+{
+    PageSize page_size{PageSize::kDefault};
+    NumaPolicy numa{NumaPolicy::kDefault};
+    // bit i selects node i, 0 for all nodes
+    uint64_t numa_nodes{0};
+};
+
+constexpr size_t kCacheLineSize = 64;
+
+class Deleter
+{
+    size_t mapped_bytes_{0}; // 0 if allocated with aligned_alloc
+
+  public:
+    Deleter() = default;
+    explicit Deleter(size_t mapped_bytes)
+        : mapped_bytes_(mapped_bytes)
+    {
+    }
+
+    void operator()(void *p) const
+    {
+        if (mapped_bytes_ == 0)
+        {
+            free(p);
+        }
+        else
+        {
+            munmap(p, mapped_bytes_);
+        }
+    }
+};
+
+// Arrays of trivial types, such as table words and buckets
+template <typename T>
+using UniquePtr = std::unique_ptr<T[], Deleter>;
+
+namespace detail
+{
+
+inline size_t RoundUp(size_t n, size_t alignment)
+{
+    return (n + alignment - 1) / alignment * alignment;
+}
+
+inline void *Map(size_t bytes, int flags)
+{
+    void *p{mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0)};
+    return p == MAP_FAILED ? nullptr : p;
+}
+
+// Map `bytes` at an `alignment` boundary, trimming the excess of the mapping
+inline void *MapAligned(size_t bytes, size_t alignment)
+{
+    char *p{static_cast<char *>(Map(bytes + alignment, 0))};
+    if (p == nullptr)
+    {
+        return nullptr;
+    }
+    char *aligned{reinterpret_cast<char *>(
+        RoundUp(reinterpret_cast<uintptr_t>(p), alignment))};
+    if (aligned != p)
+    {
+        munmap(p, aligned - p);
+    }
+    munmap(aligned + bytes, p + alignment - aligned);
+    return aligned;
+}
+
+inline void Bind(void *p, size_t bytes, const AllocOptions &options)
+{
+    // <numaif.h> constants, to avoid depending on libnuma
+    constexpr int kMpolBind{2}, kMpolInterleave{3};
+    const uint64_t nodes{options.numa_nodes == 0 ? ~0ULL : options.numa_nodes};
+    syscall(__NR_mbind, p, bytes,
+            options.numa == NumaPolicy::kBind ? kMpolBind : kMpolInterleave, &nodes,
+            sizeof(nodes) * 8, 0);
+}
+
+}
+
+// Allocate `n` zeroed elements of T following `options`. Throw std::bad_alloc
+// if out of memory.
+template <typename T>
+UniquePtr<T> Allocate(size_t n, const AllocOptions &options = {})
+{
+    static_assert(alignof(T) <= kCacheLineSize, "over-aligned type");
+    const size_t bytes{detail::RoundUp(std::max<size_t>(n, 1) * sizeof(T),
+                                       kCacheLineSize)};
+
+    if (options.page_size == PageSize::kDefault && options.numa == NumaPolicy::kDefault)
+    {
+        void *p{aligned_alloc(kCacheLineSize, bytes)};
+        if (p == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+        memset(p, 0, bytes);
+        return UniquePtr<T>(static_cast<T *>(p), Deleter());
+    }
+
+    // mmap returns zeroed, page aligned memory
+    size_t mapped_bytes{detail::RoundUp(bytes, 4096)};
+    void *p{nullptr};
+    if (options.page_size == PageSize::kHuge2MB || options.page_size == PageSize::kHuge1GB)
+    {
+        const bool is_1gb{options.page_size == PageSize::kHuge1GB};
+        const size_t huge_bytes{detail::RoundUp(bytes, is_1gb ? 1ULL << 30 : 1ULL << 21)};
+        p = detail::Map(huge_bytes, MAP_HUGETLB | ((is_1gb ? 30 : 21) << MAP_HUGE_SHIFT));
+        if (p != nullptr)
+        {
+            mapped_bytes = huge_bytes;
+        }
+    }
+    if (p == nullptr)
+    {
+        if (options.page_size == PageSize::kDefault)
+        {
+            p = detail::Map(mapped_bytes, 0);
+        }
+        else
+        {
+            // transparent huge pages need 2 MB aligned ranges
+            p = detail::MapAligned(mapped_bytes, 1ULL << 21);
+            if (p != nullptr)
+            {
+                madvise(p, mapped_bytes, MADV_HUGEPAGE);
+            }
+        }
+        if (p == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+    }
+    if (options.numa != NumaPolicy::kDefault)
+    {
+        detail::Bind(p, mapped_bytes, options);
+    }
+    return UniquePtr<T>(static_cast<T *>(p), Deleter(mapped_bytes));
+}
+
+}
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef SERIALIZE_H_
+#define SERIALIZE_H_
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+#include "memutil.h"
+
+namespace serialize
+{
+
+// On-disk format of a filter, in native byte order:
+//   Header
+//   filter metadata (counters, hash seeds, ...), `meta_bytes` long
+//   zero padding up to `table_offset`, a multiple of the page size
+//   the table, `table_bytes` long
+// The table is page aligned so that it can be mapped in place.
+constexpr char kMagic[8]{'V', 'E', 'F', 'I', 'L', 'T', 'E', 'R'};
+// bump on any change of the layout of the header, metadata or tables
+constexpr uint32_t kVersion{4};
+constexpr uint64_t kTableAlignment{4096};
+
+enum class FilterKind : uint32_t
+{
+    kVECF = 1,
+    kVEQF = 2,
+    kVECBF = 3,
+    kVECFSingleHash = 4,
+    kVEQFAligned = 5,
+    kVECBFAligned = 6,
+};
+
+struct Header
+{
+    char magic[8];
+    uint32_t version;
+    FilterKind kind;
+    uint64_t bits_per_item;
+    uint64_t meta_bytes;
+    uint64_t table_offset;
+    uint64_t table_bytes;
+};
+
+// Write a filter to `path`, return false on I/O errors
+template <typename Meta>
+bool Save(const std::string &path, FilterKind kind, uint64_t bits_per_item,
+          const Meta &meta, const void *table, uint64_t table_bytes)
+{
+    static_assert(std::is_trivially_copyable_v<Meta>, "metadata is copied as bytes");
+    Header header;
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.kind = kind;
+    header.bits_per_item = bits_per_item;
+    header.meta_bytes = sizeof(Meta);
+    header.table_offset = (sizeof(Header) + sizeof(Meta) + kTableAlignment - 1) /
+                          kTableAlignment * kTableAlignment;
+    header.table_bytes = table_bytes;
+
+    FILE *file{fopen(path.c_str(), "wb")};
+    if (file == nullptr)
+    {
+        return false;
+    }
+    const char padding[kTableAlignment]{};
+    bool ok{fwrite(&header, sizeof(header), 1, file) == 1 &&
+            fwrite(&meta, sizeof(meta), 1, file) == 1 &&
+            fwrite(padding, header.table_offset - sizeof(Header) - sizeof(Meta), 1,
+                   file) == 1 &&
+            fwrite(table, table_bytes, 1, file) == 1};
+    ok &= fclose(file) == 0;
+    return ok;
+}
+
+// Read the metadata of a filter saved at `path` and map its table. The mapping
+// is private: the file is never modified, and a page of the table is copied
+// only when the filter first writes to it. Return false if the file cannot be
+// read or was written for another filter or format version.
+template <typename Meta>
+bool Load(const std::string &path, FilterKind kind, uint64_t bits_per_item, Meta *meta,
+          memutil::UniquePtr<char> *table, uint64_t *table_bytes)
+{
+    static_assert(std::is_trivially_copyable_v<Meta>, "metadata is copied as bytes");
+    const int fd{open(path.c_str(), O_RDONLY)};
+    if (fd < 0)
+    {
+        return false;
+    }
+    Header header;
+    struct stat st;
+    bool ok{fstat(fd, &st) == 0 &&
+            pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+            memcmp(header.magic, kMagic, sizeof(kMagic)) == 0 &&
+            header.version == kVersion && header.kind == kind &&
+            header.bits_per_item == bits_per_item && header.meta_bytes == sizeof(Meta) &&
+            header.table_offset % kTableAlignment == 0 && header.table_bytes != 0 &&
+            header.table_offset + header.table_bytes <= static_cast<uint64_t>(st.st_size) &&
+            pread(fd, meta, sizeof(Meta), sizeof(Header)) == sizeof(Meta)};
+    void *p{MAP_FAILED};
+    if (ok)
+    {
+        p = mmap(nullptr, header.table_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd,
+                 header.table_offset);
+        ok = p != MAP_FAILED;
+    }
+    close(fd);
+    if (ok)
+    {
+        table->reset(static_cast<char *>(p));
+        table->get_deleter() = memutil::Deleter(header.table_bytes);
+        *table_bytes = header.table_bytes;
+    }
+    return ok;
+}
+
+}
+
+#endif
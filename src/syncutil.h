@@ -0,0 +1,32 @@
+#ifndef SYNCUTIL_H_
+#define SYNCUTIL_H_
+
+#include <immintrin.h>
+
+#include <cstddef>
+#include <thread>
+
+namespace syncutil
+{
+
+// spins on a held lock before yielding to its holder
+constexpr size_t kSpinsBeforeYield{64};
+
+// Wait step of a spin loop: pause for the first spins, then yield, as the
+// holder may be descheduled on an oversubscribed machine. `spins` counts the
+// steps taken by the loop and starts at 0.
+inline void Backoff(size_t *spins)
+{
+    if (++*spins < kSpinsBeforeYield)
+    {
+        _mm_pause();
+    }
+    else
+    {
+        std::this_thread::yield();
+    }
+}
+
+}
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef VECBF_BITSUTIL_H_
+#define VECBF_BITSUTIL_H_
+
+#include <cmath>
+#include <cstdint>
+
+namespace vecbf
+{
+// Bits [0, n) set, n < 64
+constexpr inline uint64_t LowMask(uint64_t n)
+{
+    return (1ULL << n) - 1;
+}
+
+// Counters of a Bloom filter of `max_num_keys` keys at a false positive rate
+inline uint64_t OptimalBitNum(uint64_t max_num_keys, double false_positive)
+{
+    return (uint64_t)(max_num_keys * (-1.0 * log(false_positive)) /
+                      (log(2) * log(2)));
+}
+
+inline uint64_t OptimalHashFunctionNum(uint64_t max_num_keys, uint64_t counter_num)
+{
+    uint64_t hash_function_num{(uint64_t)round(counter_num * log(2) / max_num_keys)};
+    return hash_function_num > 1 ? hash_function_num : 1;
+}
+}
+
+#endif
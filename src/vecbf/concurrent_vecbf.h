@@ -0,0 +1,439 @@
+#ifndef CONCURRENT_VECBF_H_
+#define CONCURRENT_VECBF_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+
+#include "hashutil.h"
+#include "memutil.h"
+#include "syncutil.h"
+#include "vecbf/bitsutil.h"
+
+namespace vecbf
+{
+
+// Thread-safe VECBF.
+//
+// Counters never spill into the next word, so every counter update is a CAS
+// loop on the word holding it. With 64 / kBitsPerCounter counters per word,
+// this costs a few unused bits per word when kBitsPerCounter does not divide
+// 64.
+//
+// The phase 1 -> phase 2 switch runs in three steps. The thread whose insertion
+// crosses the threshold marks the filter as draining and waits for in-flight
+// phase 1 writers, which register in striped counters. In the converting step
+// every thread that arrives, including the initiator, converts chunks of the
+// table in parallel; writers wait until the conversion ends. Readers never
+// wait: while the switch runs they only test the lower half counters of the
+// first k counters, which every inserted key has set in both encodings, and
+// they retry if the phase changed during the lookup.
+template <typename ItemType, uint64_t kBitsPerCounter,
+          typename HashFunction = hashutil::TwoIndependentMultiplyShift>
+class ConcurrentVECBF
+{
+  private:
+    // keep the lower half of every counter in a word
+    static constexpr uint64_t Phase2WordMask()
+    {
+        uint64_t mask{0};
+        for (uint64_t i = 0; i < kCountersPerWord; ++i)
+        {
+            mask |= LowMask(kBitsPerCounter / 2) << (i * kBitsPerCounter);
+        }
+        return mask;
+    }
+
+    constexpr static uint64_t kPhase1UpperCounterBase{1 << (kBitsPerCounter / 2)};
+    constexpr static uint64_t kCounterMask{LowMask(kBitsPerCounter)};
+    constexpr static uint64_t kCountersPerWord{64 / kBitsPerCounter};
+    constexpr static uint64_t kPhase2WordMask{Phase2WordMask()};
+    // words converted at a time by one thread during the phase switch
+    constexpr static uint64_t kConvertChunkWords{4096};
+    // stripes of the phase 1 writer counter
+    constexpr static size_t kWriterSlots{64};
+
+    enum Phase : uint32_t
+    {
+        kPhase1,
+        kDraining,   // waiting for phase 1 writers to finish
+        kConverting, // table is being converted to phase 2
+        kPhase2,
+    };
+
+    struct alignas(64) WriterSlot
+    {
+        std::atomic<uint64_t> count{0};
+    };
+
+    std::atomic<uint32_t> phase_{kPhase1};
+    std::atomic<uint64_t> num_items_{0};
+
+    const uint64_t max_num_keys_, counter_num_, hash_function_num_, table_size_,
+        num_chunks_;
+    HashFunction hasher_;
+    memutil::UniquePtr<std::atomic<uint64_t>> table_;
+
+    std::unique_ptr<WriterSlot[]> writers_;
+    std::atomic<uint64_t> next_chunk_{0}, done_chunks_{0};
+
+    // Writer counter stripe of the calling thread
+    static size_t ThreadWriterSlot()
+    {
+        static std::atomic<size_t> next_slot{0};
+        thread_local size_t slot{next_slot.fetch_add(1, std::memory_order_relaxed) %
+                                 kWriterSlots};
+        return slot;
+    }
+
+    uint64_t GetCounter(uint64_t idx) const
+    {
+        const uint64_t word{
+            table_[idx / kCountersPerWord].load(std::memory_order_acquire)};
+        return (word >> (idx % kCountersPerWord * kBitsPerCounter)) & kCounterMask;
+    }
+
+    // Add `delta` to the counter, wrapping inside it like VECBF::SetCounter.
+    // Return the counter value before the update.
+    uint64_t AddCounter(uint64_t idx, uint64_t delta)
+    {
+        std::atomic<uint64_t> &word{table_[idx / kCountersPerWord]};
+        const uint64_t shift{idx % kCountersPerWord * kBitsPerCounter};
+        uint64_t old_word{word.load(std::memory_order_relaxed)}, counter;
+        do
+        {
+            counter = (old_word >> shift) & kCounterMask;
+        } while (!word.compare_exchange_weak(
+            old_word,
+            (old_word & ~(kCounterMask << shift)) |
+                (((counter + delta) & kCounterMask) << shift),
+            std::memory_order_acq_rel, std::memory_order_relaxed));
+        return counter;
+    }
+
+    // Subtract `delta` from a nonzero counter. Return false if it is zero.
+    bool SubCounter(uint64_t idx, uint64_t delta)
+    {
+        std::atomic<uint64_t> &word{table_[idx / kCountersPerWord]};
+        const uint64_t shift{idx % kCountersPerWord * kBitsPerCounter};
+        uint64_t old_word{word.load(std::memory_order_relaxed)}, counter;
+        do
+        {
+            counter = (old_word >> shift) & kCounterMask;
+            if (counter == 0)
+            {
+                return false;
+            }
+        } while (!word.compare_exchange_weak(
+            old_word,
+            (old_word & ~(kCounterMask << shift)) |
+                (((counter - delta) & kCounterMask) << shift),
+            std::memory_order_acq_rel, std::memory_order_relaxed));
+        return true;
+    }
+
+    // The i-th counter of a key is (hash1 + hash2 * i) % counter_num_, walked
+    // incrementally as in VECBF
+    struct CounterIndexes
+    {
+        uint64_t idx, step;
+    };
+
+    inline CounterIndexes FirstCounterIndexes(uint64_t hash) const
+    {
+        const uint64_t hash1{hash & LowMask(32)}, hash2{hash >> 32};
+        return {hash1 % counter_num_, hash2 % counter_num_};
+    }
+
+    inline uint64_t NextCounterIndex(CounterIndexes *indexes) const
+    {
+        uint64_t ret{indexes->idx};
+        indexes->idx += indexes->step;
+        if (indexes->idx >= counter_num_)
+        {
+            indexes->idx -= counter_num_;
+        }
+        return ret;
+    }
+
+    // Register as a phase 1 writer. Return false, unregistered, if the switch to
+    // phase 2 has begun.
+    bool EnterPhase1(size_t slot)
+    {
+        writers_[slot].count.fetch_add(1);
+        if (phase_.load() == kPhase1)
+        {
+            return true;
+        }
+        writers_[slot].count.fetch_sub(1);
+        return false;
+    }
+
+    void LeavePhase1(size_t slot)
+    {
+        writers_[slot].count.fetch_sub(1, std::memory_order_release);
+    }
+
+    void ConvertChunks()
+    {
+        for (uint64_t chunk{next_chunk_.fetch_add(1)}; chunk < num_chunks_;
+             chunk = next_chunk_.fetch_add(1))
+        {
+            const uint64_t end{std::min(table_size_, (chunk + 1) * kConvertChunkWords)};
+            // no writer runs during the conversion, readers may
+            for (uint64_t w = chunk * kConvertChunkWords; w < end; ++w)
+            {
+                table_[w].store(table_[w].load(std::memory_order_relaxed) &
+                                    kPhase2WordMask,
+                                std::memory_order_relaxed);
+            }
+            if (done_chunks_.fetch_add(1, std::memory_order_acq_rel) + 1 ==
+                num_chunks_)
+            {
+                phase_.store(kPhase2, std::memory_order_release);
+            }
+        }
+    }
+
+    // Help the switch in progress, and return once the filter is in phase 2
+    void WaitForPhase2()
+    {
+        size_t spins{0};
+        for (uint32_t phase{phase_.load(std::memory_order_acquire)}; phase != kPhase2;
+             phase = phase_.load(std::memory_order_acquire))
+        {
+            if (phase == kConverting)
+            {
+                ConvertChunks();
+            }
+            syncutil::Backoff(&spins);
+        }
+    }
+
+    void SwitchToPhase2()
+    {
+        uint32_t expected{kPhase1};
+        if (!phase_.compare_exchange_strong(expected, kDraining))
+        {
+            return; // another thread is switching
+        }
+        size_t spins{0};
+        for (size_t slot = 0; slot < kWriterSlots; ++slot)
+        {
+            while (writers_[slot].count.load() != 0)
+            {
+                syncutil::Backoff(&spins);
+            }
+        }
+        phase_.store(kConverting, std::memory_order_release);
+        ConvertChunks();
+    }
+
+    // Test the first `count` counters of the key, of which only the lower half
+    // if `lower_half`
+    bool CountersNonZero(CounterIndexes indexes, uint64_t count,
+                         bool lower_half) const
+    {
+        const uint64_t mask{lower_half ? LowMask(kBitsPerCounter / 2) : kCounterMask};
+        for (uint64_t i = 0; i < count; ++i)
+        {
+            if ((GetCounter(NextCounterIndex(&indexes)) & mask) == 0)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    ConcurrentVECBF(const uint64_t max_num_keys, double false_positive,
+                    const HashFunction &hasher, const memutil::AllocOptions &options)
+        : max_num_keys_(max_num_keys),
+          counter_num_(OptimalBitNum(max_num_keys, false_positive)),
+          hash_function_num_(OptimalHashFunctionNum(max_num_keys, counter_num_)),
+          table_size_((counter_num_ + kCountersPerWord - 1) / kCountersPerWord),
+          num_chunks_((table_size_ + kConvertChunkWords - 1) / kConvertChunkWords),
+          hasher_(hasher),
+          table_(memutil::Allocate<std::atomic<uint64_t>>(table_size_, options)),
+          writers_(new WriterSlot[kWriterSlots])
+    {
+    }
+
+  public:
+    // Hash function is seeded randomly
+    ConcurrentVECBF(const uint64_t max_num_keys, double false_positive = 0.04,
+                    const memutil::AllocOptions &options = {})
+        : ConcurrentVECBF(max_num_keys, false_positive, HashFunction(), options)
+    {
+    }
+
+    // Filters built with the same seed hash keys identically
+    ConcurrentVECBF(const uint64_t max_num_keys, double false_positive, uint64_t seed,
+                    const memutil::AllocOptions &options = {})
+        : ConcurrentVECBF(max_num_keys, false_positive, HashFunction(seed), options)
+    {
+    }
+
+    bool Insert(const ItemType &item)
+    {
+        return InsertHash(hasher_(item));
+    }
+
+    // Pre-hashed keys, with the requirements of VECBF::InsertHash
+    bool InsertHash(uint64_t hash)
+    {
+        const CounterIndexes first{FirstCounterIndexes(hash)};
+        const size_t slot{ThreadWriterSlot()};
+
+        if (EnterPhase1(slot))
+        {
+            CounterIndexes indexes{first};
+            for (uint64_t i = 0; i < hash_function_num_ * 2; ++i)
+            {
+                AddCounter(NextCounterIndex(&indexes),
+                           (i >= hash_function_num_) ? kPhase1UpperCounterBase : 1);
+            }
+            LeavePhase1(slot);
+
+            if (num_items_.fetch_add(1, std::memory_order_relaxed) >=
+                uint64_t(max_num_keys_ * 0.5))
+            {
+                SwitchToPhase2();
+            }
+            return true;
+        }
+
+        WaitForPhase2();
+        CounterIndexes indexes{first};
+        for (uint64_t i = 0; i < hash_function_num_; ++i)
+        {
+            AddCounter(NextCounterIndex(&indexes), 1);
+        }
+        num_items_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    bool Lookup(const ItemType &key) const
+    {
+        return LookupHash(hasher_(key));
+    }
+
+    bool LookupHash(uint64_t hash) const
+    {
+        const CounterIndexes indexes{FirstCounterIndexes(hash)};
+        for (;;)
+        {
+            const uint32_t phase{phase_.load(std::memory_order_acquire)};
+            bool found;
+            switch (phase)
+            {
+            case kPhase1:
+                found = CountersNonZero(indexes, hash_function_num_ * 2, false);
+                break;
+            case kPhase2:
+                found = CountersNonZero(indexes, hash_function_num_, false);
+                break;
+            default:
+                found = CountersNonZero(indexes, hash_function_num_, true);
+                break;
+            }
+            if (phase_.load(std::memory_order_acquire) == phase)
+            {
+                return found;
+            }
+        }
+    }
+
+    bool Delete(const ItemType &key)
+    {
+        return DeleteHash(hasher_(key));
+    }
+
+    bool DeleteHash(uint64_t hash)
+    {
+        const CounterIndexes first{FirstCounterIndexes(hash)};
+        const size_t slot{ThreadWriterSlot()};
+
+        if (EnterPhase1(slot))
+        {
+            CounterIndexes indexes{first};
+            for (uint64_t i = 0; i < hash_function_num_ * 2; ++i)
+            {
+                if (!SubCounter(NextCounterIndex(&indexes),
+                                (i >= hash_function_num_) ? kPhase1UpperCounterBase
+                                                          : 1))
+                {
+                    LeavePhase1(slot);
+                    return false;
+                }
+            }
+            LeavePhase1(slot);
+            num_items_.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+
+        WaitForPhase2();
+        CounterIndexes indexes{first};
+        for (uint64_t i = 0; i < hash_function_num_; ++i)
+        {
+            if (!SubCounter(NextCounterIndex(&indexes), 1))
+            {
+                return false;
+            }
+        }
+        num_items_.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    bool Insert(std::string_view key)
+    {
+        return InsertHash(hasher_(hashutil::HashBytes(key)));
+    }
+
+    bool Lookup(std::string_view key) const
+    {
+        return LookupHash(hasher_(hashutil::HashBytes(key)));
+    }
+
+    bool Delete(std::string_view key)
+    {
+        return DeleteHash(hasher_(hashutil::HashBytes(key)));
+    }
+
+    size_t Size() const
+    {
+        return num_items_.load(std::memory_order_relaxed);
+    }
+    size_t SizeInBytes() const
+    {
+        return table_size_ * sizeof(uint64_t);
+    }
+    double LoadFactor() const
+    {
+        return 1.0 * Size() / max_num_keys_;
+    }
+    double BitsPerItem() const
+    {
+        return 8.0 * SizeInBytes() / Size();
+    }
+
+    bool CheckAllZero()
+    {
+        for (uint64_t i = 0; i < table_size_; i++)
+        {
+            if (table_[i].load(std::memory_order_relaxed) != 0)
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+};
+
+}
+
+#endif
@@ -1,82 +1,65 @@
 #ifndef VECBF_H_
 #define VECBF_H_
 
+#include <immintrin.h>
+
+#include <algorithm>
 #include <cmath>
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
 #include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
 
+#include "fieldutil.h"
 #include "hashutil.h"
+#include "memutil.h"
+#include "serialize.h"
+#include "vecbf/bitsutil.h"
 
 namespace vecbf
 {
 
+// `Storage` lays out the counters: fieldutil::PackedFields wastes no bits,
+// fieldutil::AlignedFields keeps every counter within one word for a few more
+// bits per counter.
 template <typename ItemType, uint64_t kBitsPerCounter,
-          typename HashFunction = hashutil::TwoIndependentMultiplyShift>
+          typename HashFunction = hashutil::TwoIndependentMultiplyShift,
+          template <uint64_t> class Storage = fieldutil::PackedFields>
 class VECBF
 {
   private:
-    static constexpr inline uint64_t LowMask(uint64_t n)
-    {
-        return (1ULL << n) - 1;
-    }
-
     constexpr static uint64_t kPhase1LowerCounterMaxValue{
         LowMask(kBitsPerCounter / 2)};
     constexpr static uint64_t kPhase1UpperCounterBase{1 << (kBitsPerCounter / 2)};
     constexpr static uint64_t kCounterMask{LowMask(kBitsPerCounter)};
+    // number of counter indexes computed and prefetched ahead of a batch
+    constexpr static size_t kBatchCounters{256};
+    // number of keys and counters per key probed together by LookupBatch
+    constexpr static size_t kBatchSize{32};
+    constexpr static uint64_t kCountersPerRound{4};
+    using Counters = Storage<kBitsPerCounter>;
+    constexpr static serialize::FilterKind kFilterKind{
+        Counters::kAligned ? serialize::FilterKind::kVECBFAligned
+                           : serialize::FilterKind::kVECBF};
 
     bool is_overflow{false};
     uint64_t num_items_{0};
 
     const uint64_t max_num_keys_, counter_num_, hash_function_num_, table_size_;
     HashFunction hasher_;
-    std::unique_ptr<uint64_t[]> table_;
-
-    static uint64_t OptimalBitNum(uint64_t max_num_keys, double false_positive)
-    {
-        return (uint64_t)(max_num_keys * (-1.0 * log(false_positive)) /
-                          (log(2) * log(2)));
-    }
-
-    static uint64_t OptimalHashFunctionNum(uint64_t max_num_keys,
-                                           uint64_t counter_num)
-    {
-        uint64_t hash_function_num{
-            (uint64_t)round(counter_num * log(2) / max_num_keys)};
-        return hash_function_num > 1 ? hash_function_num : 1;
-    }
+    memutil::UniquePtr<uint64_t> table_;
 
     uint64_t GetCounter(uint64_t idx) const
     {
-        uint64_t bit_idx{idx * kBitsPerCounter};
-        uint64_t table_idx{bit_idx / 64}, slot_idx{bit_idx % 64};
-        int64_t spillbits{static_cast<int64_t>(slot_idx + kBitsPerCounter) - 64};
-        uint64_t ret{(table_[table_idx] >> slot_idx) & kCounterMask};
-        if (spillbits > 0)
-        {
-            ++table_idx;
-            uint64_t x{table_[table_idx] & LowMask(spillbits)};
-            ret |= x << (kBitsPerCounter - spillbits);
-        }
-        return ret;
+        return Counters::Get(table_.get(), idx);
     }
 
     void SetCounter(uint64_t idx, uint64_t val)
     {
-        uint64_t bit_idx{idx * kBitsPerCounter};
-        uint64_t table_idx{bit_idx / 64}, slot_idx{bit_idx % 64};
-        int64_t spillbits{static_cast<int64_t>(slot_idx + kBitsPerCounter) - 64};
-        val &= kCounterMask;
-        table_[table_idx] &= ~(kCounterMask << slot_idx);
-        table_[table_idx] |= val << slot_idx;
-        if (spillbits > 0)
-        {
-            ++table_idx;
-            table_[table_idx] &= ~LowMask(spillbits);
-            table_[table_idx] |= val >> (kBitsPerCounter - spillbits);
-        }
+        Counters::Set(table_.get(), idx, val);
     }
 
     static inline uint64_t Phase1LowerCounter(uint64_t counter)
@@ -99,31 +82,187 @@ class VECBF
         is_overflow = true;
     }
 
-  public:
-    VECBF(const uint64_t max_num_keys, double false_positive = 0.04)
-        : max_num_keys_(max_num_keys),
-          counter_num_(OptimalBitNum(max_num_keys, false_positive)),
-          hash_function_num_(OptimalHashFunctionNum(max_num_keys, counter_num_)),
-          table_size_((counter_num_ * kBitsPerCounter + 63) / 64),
-          hasher_(),
-          table_(new uint64_t[table_size_])
+    inline uint64_t HashFunctionNum() const
     {
-        memset(table_.get(), 0, table_size_ * sizeof(uint64_t));
+        return is_overflow == true ? hash_function_num_ : hash_function_num_ * 2;
     }
 
-    bool Insert(const ItemType &item)
+    // The i-th counter of a key is (hash1 + hash2 * i) % counter_num_. It is
+    // walked incrementally, so a key costs two divisions instead of one per
+    // counter.
+    struct CounterIndexes
+    {
+        uint64_t idx, step;
+    };
+
+    inline CounterIndexes FirstCounterIndexes(uint64_t hash) const
     {
-        const uint64_t hash{hasher_(item)};
         const uint64_t hash1{hash & LowMask(32)}, hash2{hash >> 32};
-        const uint64_t hash_function_num{
-            is_overflow == true ? hash_function_num_ : hash_function_num_ * 2};
+        return {hash1 % counter_num_, hash2 % counter_num_};
+    }
+
+    inline uint64_t NextCounterIndex(CounterIndexes *indexes) const
+    {
+        uint64_t ret{indexes->idx};
+        indexes->idx += indexes->step;
+        if (indexes->idx >= counter_num_)
+        {
+            indexes->idx -= counter_num_;
+        }
+        return ret;
+    }
+
+    void PrefetchCounter(uint64_t idx) const
+    {
+        _mm_prefetch(reinterpret_cast<const char *>(&table_[Counters::WordOf(idx)]),
+                     _MM_HINT_T0);
+    }
+
+    // Fill `idx` with the counter indexes of as many of the `n` keys as fit in
+    // it, prefetching each counter. Return how many keys are covered.
+    size_t ComputeBatchIndexes(const ItemType *keys, size_t n, uint64_t *idx) const
+    {
+        const uint64_t hash_function_num{HashFunctionNum()};
+        const size_t count{std::min<size_t>(
+            n, std::max<size_t>(1, kBatchCounters / hash_function_num))};
+        for (size_t j = 0; j < count; ++j)
+        {
+            CounterIndexes indexes{FirstCounterIndexes(hasher_(keys[j]))};
+            for (uint64_t i = 0; i < hash_function_num; ++i)
+            {
+                idx[j * hash_function_num + i] = NextCounterIndex(&indexes);
+                PrefetchCounter(idx[j * hash_function_num + i]);
+            }
+        }
+        return count;
+    }
+
+    // Look up the keys whose hashes are hash_of(0), ..., hash_of(n - 1)
+    template <typename HashOf, typename Emit>
+    void LookupBatchImpl(size_t n, HashOf &&hash_of, Emit &&emit) const
+    {
+        const uint64_t hash_function_num{HashFunctionNum()};
+        CounterIndexes indexes[kBatchSize];
+        uint64_t idx[kBatchSize][kCountersPerRound];
+        size_t alive[kBatchSize]; // keys of the window with no zero counter yet
+
+        for (size_t base = 0; base < n; base += kBatchSize)
+        {
+            const size_t count{std::min<size_t>(kBatchSize, n - base)};
+            size_t alive_num{count};
+            for (size_t j = 0; j < count; ++j)
+            {
+                indexes[j] = FirstCounterIndexes(hash_of(base + j));
+                alive[j] = j;
+            }
+
+            for (uint64_t checked = 0; alive_num > 0; checked += kCountersPerRound)
+            {
+                const uint64_t round{
+                    std::min<uint64_t>(kCountersPerRound, hash_function_num - checked)};
+                for (size_t a = 0; a < alive_num; ++a)
+                {
+                    const size_t j{alive[a]};
+                    for (uint64_t i = 0; i < round; ++i)
+                    {
+                        idx[j][i] = NextCounterIndex(&indexes[j]);
+                        PrefetchCounter(idx[j][i]);
+                    }
+                }
+
+                size_t still_alive_num{0};
+                for (size_t a = 0; a < alive_num; ++a)
+                {
+                    const size_t j{alive[a]};
+                    if (!AllCountersNonZero(idx[j], round))
+                    {
+                        emit(base + j, false);
+                    }
+                    else if (checked + round == hash_function_num)
+                    {
+                        emit(base + j, true);
+                    }
+                    else
+                    {
+                        alive[still_alive_num++] = j;
+                    }
+                }
+                alive_num = still_alive_num;
+            }
+        }
+    }
+
+    bool AllCountersNonZero(const uint64_t *idx, uint64_t count) const
+    {
+        uint64_t i{0};
+#if defined(__AVX2__)
+        // Gather the words holding 4 counters at once. A counter spilling into
+        // the next word gets that word from a second, masked gather, so no lane
+        // reads past the table. Aligned counters are read one at a time, as
+        // their word index is a division AVX2 lacks.
+        if constexpr (!Counters::kAligned)
+        {
+            const __m256i counter_bits{_mm256_set1_epi64x(kBitsPerCounter)},
+                word_bits{_mm256_set1_epi64x(64)}, low6{_mm256_set1_epi64x(63)},
+                counter_mask{_mm256_set1_epi64x(kCounterMask)},
+                one{_mm256_set1_epi64x(1)};
+            const long long *table{reinterpret_cast<const long long *>(table_.get())};
+            for (; i + 4 <= count; i += 4)
+            {
+                // idx * kBitsPerCounter from 32-bit multiplies, idx may exceed 32 bits
+                const __m256i counter_idx{
+                    _mm256_loadu_si256(reinterpret_cast<const __m256i *>(idx + i))};
+                const __m256i bit_idx{_mm256_add_epi64(
+                    _mm256_mul_epu32(counter_idx, counter_bits),
+                    _mm256_slli_epi64(
+                        _mm256_mul_epu32(_mm256_srli_epi64(counter_idx, 32), counter_bits),
+                        32))};
+                const __m256i table_idx{_mm256_srli_epi64(bit_idx, 6)},
+                    slot_idx{_mm256_and_si256(bit_idx, low6)};
+                __m256i counters{_mm256_srlv_epi64(
+                    _mm256_i64gather_epi64(table, table_idx, 8), slot_idx)};
+                const __m256i spill{_mm256_cmpgt_epi64(
+                    _mm256_add_epi64(slot_idx, counter_bits), word_bits)};
+                if (!_mm256_testz_si256(spill, spill))
+                {
+                    const __m256i next{_mm256_mask_i64gather_epi64(
+                        _mm256_setzero_si256(), table, _mm256_add_epi64(table_idx, one),
+                        spill, 8)};
+                    counters = _mm256_or_si256(
+                        counters,
+                        _mm256_sllv_epi64(next, _mm256_sub_epi64(word_bits, slot_idx)));
+                }
+                counters = _mm256_and_si256(counters, counter_mask);
+                const __m256i zero{
+                    _mm256_cmpeq_epi64(counters, _mm256_setzero_si256())};
+                if (!_mm256_testz_si256(zero, zero))
+                {
+                    return false;
+                }
+            }
+        }
+#endif
+        for (; i < count; ++i)
+        {
+            if (GetCounter(idx[i]) == 0)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // `next_index()` yields the counter indexes of the key in order
+    template <typename NextIndex>
+    bool InsertImpl(NextIndex &&next_index)
+    {
+        const uint64_t hash_function_num{HashFunctionNum()};
 
         if (is_overflow == false)
         {
             for (uint64_t i = 0; i < hash_function_num; ++i)
             {
-                uint64_t combine_hash{hash1 + hash2 * i};
-                uint64_t idx{combine_hash % counter_num_};
+                uint64_t idx{next_index()};
                 uint64_t counter{GetCounter(idx)};
 
                 // if (Phase1LowerCounter(counter) == LowMask(kBitsPerCounter / 2) ||
@@ -148,8 +287,7 @@ class VECBF
         {
             for (uint64_t i = 0; i < hash_function_num; ++i)
             {
-                uint64_t combine_hash{hash1 + hash2 * i};
-                uint64_t idx{combine_hash % counter_num_};
+                uint64_t idx{next_index()};
                 uint64_t counter{GetCounter(idx)};
 
                 // if (counter == LowMask(kBitsPerCounter))
@@ -167,18 +305,14 @@ class VECBF
         return true;
     }
 
-    bool Lookup(const ItemType &key) const
+    template <typename NextIndex>
+    bool LookupImpl(NextIndex &&next_index) const
     {
-        const uint64_t hash{hasher_(key)};
-        const uint64_t hash1{hash & LowMask(32)}, hash2{hash >> 32};
-        const uint64_t hash_function_num{
-            is_overflow == true ? hash_function_num_ : hash_function_num_ * 2};
+        const uint64_t hash_function_num{HashFunctionNum()};
 
         for (uint64_t i = 0; i < hash_function_num; ++i)
         {
-            uint64_t combine_hash{hash1 + hash2 * i};
-            uint64_t idx{combine_hash % counter_num_};
-            if (GetCounter(idx) == 0)
+            if (GetCounter(next_index()) == 0)
             {
                 return false;
             }
@@ -186,17 +320,14 @@ class VECBF
         return true;
     }
 
-    bool Delete(const ItemType &key)
+    template <typename NextIndex>
+    bool DeleteImpl(NextIndex &&next_index)
     {
-        const uint64_t hash{hasher_(key)};
-        const uint64_t hash1{hash & LowMask(32)}, hash2{hash >> 32};
-        const uint64_t hash_function_num{
-            is_overflow == true ? hash_function_num_ : hash_function_num_ * 2};
+        const uint64_t hash_function_num{HashFunctionNum()};
 
         for (uint64_t i = 0; i < hash_function_num; ++i)
         {
-            uint64_t combine_hash{hash1 + hash2 * i};
-            uint64_t idx{combine_hash % counter_num_};
+            uint64_t idx{next_index()};
             uint64_t counter{GetCounter(idx)};
 
             if (counter == 0)
@@ -214,6 +345,178 @@ class VECBF
         return true;
     }
 
+    // state saved along with the table
+    struct Meta
+    {
+        uint64_t is_overflow;
+        uint64_t num_items;
+        uint64_t max_num_keys, counter_num, hash_function_num;
+        HashFunction hasher;
+    };
+
+    VECBF(const Meta &meta, memutil::UniquePtr<char> data)
+        : is_overflow(meta.is_overflow != 0),
+          num_items_(meta.num_items),
+          max_num_keys_(meta.max_num_keys),
+          counter_num_(meta.counter_num),
+          hash_function_num_(meta.hash_function_num),
+          table_size_(Counters::Words(counter_num_)),
+          hasher_(meta.hasher),
+          table_(reinterpret_cast<uint64_t *>(data.release()), data.get_deleter())
+    {
+    }
+
+    VECBF(const uint64_t max_num_keys, double false_positive, const HashFunction &hasher,
+          const memutil::AllocOptions &options)
+        : max_num_keys_(max_num_keys),
+          counter_num_(OptimalBitNum(max_num_keys, false_positive)),
+          hash_function_num_(OptimalHashFunctionNum(max_num_keys, counter_num_)),
+          table_size_(Counters::Words(counter_num_)),
+          hasher_(hasher),
+          table_(memutil::Allocate<uint64_t>(table_size_, options))
+    {
+    }
+
+  public:
+    // Hash function is seeded randomly
+    VECBF(const uint64_t max_num_keys, double false_positive = 0.04,
+          const memutil::AllocOptions &options = {})
+        : VECBF(max_num_keys, false_positive, HashFunction(), options)
+    {
+    }
+
+    // Filters built with the same seed hash keys identically
+    VECBF(const uint64_t max_num_keys, double false_positive, uint64_t seed,
+          const memutil::AllocOptions &options = {})
+        : VECBF(max_num_keys, false_positive, HashFunction(seed), options)
+    {
+    }
+
+    bool Insert(const ItemType &item)
+    {
+        return InsertHash(hasher_(item));
+    }
+
+    // Pre-hashed keys, see hashutil.h: the halves are start and step of the counter indexes
+    bool InsertHash(uint64_t hash)
+    {
+        CounterIndexes indexes{FirstCounterIndexes(hash)};
+        return InsertImpl([&] { return NextCounterIndex(&indexes); });
+    }
+
+    bool Lookup(const ItemType &key) const
+    {
+        return LookupHash(hasher_(key));
+    }
+
+    bool LookupHash(uint64_t hash) const
+    {
+        CounterIndexes indexes{FirstCounterIndexes(hash)};
+        return LookupImpl([&] { return NextCounterIndex(&indexes); });
+    }
+
+    bool Delete(const ItemType &key)
+    {
+        return DeleteHash(hasher_(key));
+    }
+
+    bool DeleteHash(uint64_t hash)
+    {
+        CounterIndexes indexes{FirstCounterIndexes(hash)};
+        return DeleteImpl([&] { return NextCounterIndex(&indexes); });
+    }
+
+    bool Insert(std::string_view key)
+    {
+        return InsertHash(hasher_(hashutil::HashBytes(key)));
+    }
+
+    bool Lookup(std::string_view key) const
+    {
+        return LookupHash(hasher_(hashutil::HashBytes(key)));
+    }
+
+    bool Delete(std::string_view key)
+    {
+        return DeleteHash(hasher_(hashutil::HashBytes(key)));
+    }
+
+    // Look up `n` byte string keys, folded 4 at a time by HashBytesBatch
+    void LookupBatch(const std::string_view *keys, size_t n, bool *out) const
+    {
+        hashutil::ForEachHashedChunk(
+            keys, n, [this, out](const uint64_t *hashes, size_t base, size_t m) {
+                LookupBatchImpl(
+                    m, [this, hashes](size_t i) { return hasher_(hashes[i]); },
+                    [out, base](size_t i, bool found) { out[base + i] = found; });
+            });
+    }
+
+    // Batch operations compute the counter indexes of a window of keys and
+    // prefetch them before any counter is read, so the k (2k in phase 1) cache
+    // misses of each key overlap with those of the other keys. Lookups do this
+    // in rounds of a few counters, dropping a key at its first zero counter.
+
+    // Return how many keys are inserted, which is always `n`.
+    size_t InsertBatch(const ItemType *keys, size_t n)
+    {
+        uint64_t idx[kBatchCounters];
+        size_t base{0};
+        while (base < n)
+        {
+            const bool is_overflow_before{is_overflow};
+            const size_t count{ComputeBatchIndexes(keys + base, n - base, idx)};
+            for (size_t j = 0; j < count; ++j)
+            {
+                if (is_overflow != is_overflow_before)
+                {
+                    // switched to phase 2 in this window, the indexes are stale
+                    Insert(keys[base + j]);
+                    continue;
+                }
+                const uint64_t *key_idx{idx + j * HashFunctionNum()};
+                InsertImpl([&key_idx] { return *key_idx++; });
+            }
+            base += count;
+        }
+        return n;
+    }
+
+    void LookupBatch(const ItemType *keys, size_t n, bool *out) const
+    {
+        LookupBatchImpl(
+            n, [this, keys](size_t i) { return hasher_(keys[i]); },
+            [out](size_t i, bool found) { out[i] = found; });
+    }
+
+    // Same as above, but the result of keys[i] is bit (i % 64) of out[i / 64].
+    // `out` must hold (n + 63) / 64 words.
+    void LookupBatch(const ItemType *keys, size_t n, uint64_t *out) const
+    {
+        std::fill(out, out + (n + 63) / 64, 0);
+        LookupBatchImpl(
+            n, [this, keys](size_t i) { return hasher_(keys[i]); },
+            [out](size_t i, bool found) {
+                out[i / 64] |= static_cast<uint64_t>(found) << (i % 64);
+            });
+    }
+
+    // `out[i]` is the return value of Delete(keys[i]).
+    void DeleteBatch(const ItemType *keys, size_t n, bool *out)
+    {
+        uint64_t idx[kBatchCounters];
+        for (size_t base = 0; base < n;)
+        {
+            const size_t count{ComputeBatchIndexes(keys + base, n - base, idx)};
+            for (size_t j = 0; j < count; ++j)
+            {
+                const uint64_t *key_idx{idx + j * HashFunctionNum()};
+                out[base + j] = DeleteImpl([&key_idx] { return *key_idx++; });
+            }
+            base += count;
+        }
+    }
+
     size_t Size() const
     {
         return num_items_;
@@ -244,6 +547,39 @@ class VECBF
 
         return true;
     }
+
+    // Save the filter to `path`, return false on I/O errors
+    bool Save(const std::string &path) const
+    {
+        Meta meta{};
+        meta.is_overflow = is_overflow;
+        meta.num_items = num_items_;
+        meta.max_num_keys = max_num_keys_;
+        meta.counter_num = counter_num_;
+        meta.hash_function_num = hash_function_num_;
+        meta.hasher = hasher_;
+        return serialize::Save(path, kFilterKind, kBitsPerCounter, meta,
+                               table_.get(), table_size_ * sizeof(uint64_t));
+    }
+
+    // Load a filter written by Save(). The table is mapped from the file
+    // instead of being read, so that loading takes constant time and lookups
+    // are served from the page cache. Return nullptr if the file cannot be
+    // loaded.
+    static std::unique_ptr<VECBF> Load(const std::string &path)
+    {
+        Meta meta;
+        memutil::UniquePtr<char> data;
+        uint64_t table_bytes;
+        if (!serialize::Load(path, kFilterKind, kBitsPerCounter, &meta, &data,
+                             &table_bytes) ||
+            meta.counter_num == 0 || meta.hash_function_num == 0 ||
+            table_bytes != Counters::Words(meta.counter_num) * sizeof(uint64_t))
+        {
+            return nullptr;
+        }
+        return std::unique_ptr<VECBF>(new VECBF(meta, std::move(data)));
+    }
 };
 
 }
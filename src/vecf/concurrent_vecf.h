@@ -0,0 +1,650 @@
+#ifndef CONCURRENT_VECF_H_
+#define CONCURRENT_VECF_H_
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string_view>
+
+#include "hashutil.h"
+#include "memutil.h"
+#include "syncutil.h"
+#include "vecf/singletable.h"
+
+namespace vecf
+{
+// maximum number of buckets visited by one cuckoo path search
+const size_t kMaxPathSearchBuckets = 500;
+// maximum number of path searches before an insertion gives up
+const size_t kMaxPathSearchRetries = 8;
+// upper bound of the number of lock stripes
+const size_t kMaxNumStripes = 1 << 12;
+
+// Thread-safe VECF.
+//
+// Buckets are guarded by striped version counters used as seqlocks: bucket i
+// belongs to stripe i % num_stripes. Lookups never write shared memory; they
+// probe both buckets and retry when either stripe changed meanwhile.
+// Insertions and deletions lock the stripes of both candidate buckets in
+// ascending order. When both buckets are full, insertion searches a cuckoo path
+// breadth first without holding any lock, then moves tags backwards along the
+// path, locking only the two buckets of each move and validating the move
+// under the locks. Since a bucket write also rewrites the bytes of
+// `OverlappedBuckets()` following buckets, the stripes of those buckets are
+// locked as well.
+//
+// The victim slot is one atomic word, so lookups read it without locking;
+// setting, clearing and moving it back into the table are serialized by
+// `victim_mutex_`, which is always taken before any stripe.
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType = SingleTable,
+          typename HashFamily = hashutil::TwoIndependentMultiplyShift>
+class ConcurrentVECF
+{
+  private:
+    using Table = TableType<bits_per_item>;
+
+    constexpr static uint64_t kTagsPerBucket = 4;
+    // up to two buckets, each with its overlapped buckets
+    constexpr static uint64_t kMaxLockedStripes =
+        2 * (1 + Table::OverlappedBuckets());
+
+    // victim word: used bit | bucket index | tag
+    constexpr static uint64_t kVictimTagBits = 16;
+    constexpr static uint64_t kVictimUsed = 1ULL << 63;
+
+    struct alignas(64) Stripe
+    {
+        std::atomic<uint64_t> version{0};
+    };
+
+    // a bucket of the cuckoo path search, and the tag of the parent bucket
+    // which moves into it
+    struct PathEntry
+    {
+        uint64_t bucket;
+        uint64_t tag;
+        int64_t parent;
+    };
+
+    // Lock the stripes of the given buckets on construction, and unlock them on
+    // destruction
+    class StripeGuard
+    {
+      public:
+        StripeGuard(const ConcurrentVECF *filter, uint64_t i1, uint64_t i2);
+        ~StripeGuard();
+
+      private:
+        const ConcurrentVECF *filter_;
+        uint64_t stripes_[kMaxLockedStripes];
+        size_t num_stripes_;
+    };
+
+    std::unique_ptr<Table> table_;
+    uint64_t stripe_mask_;
+    std::unique_ptr<Stripe[]> stripes_;
+
+    std::atomic<size_t> num_items_;
+
+    std::atomic<uint64_t> victim_;
+    std::mutex victim_mutex_;
+
+    HashFamily hasher_one_, hasher_two_;
+
+    inline uint64_t IndexHash(uint64_t hv) const
+    {
+        return hv & (table_->NumBuckets() - 1);
+    }
+
+    inline uint64_t TagHash(uint64_t hv) const
+    {
+        return hv;
+    }
+
+    inline uint64_t AltIndex(const uint64_t index,
+                             const uint64_t unmasked_tag) const
+    {
+        return IndexHash(index ^
+                         (MaskedTag<bits_per_item>(unmasked_tag) * 0x5bd1e995));
+    }
+
+    inline void GenerateIndexTagHash(const ItemType &item, uint64_t *index,
+                                     uint64_t *unmasked_tag) const
+    {
+        *index = IndexHash(hasher_one_(item));
+        *unmasked_tag = TagHash(hasher_two_(item));
+    }
+
+    // Same derivation as VECF::IndexTagFromHash
+    inline void IndexTagFromHash(uint64_t hash, uint64_t *index,
+                                 uint64_t *unmasked_tag) const
+    {
+        *index = IndexHash(hash);
+        *unmasked_tag = TagHash(hash >> __builtin_ctzll(table_->NumBuckets()));
+    }
+
+    bool InsertIndexTag(const uint64_t i, const uint64_t unmasked_tag);
+
+    bool LookupIndexTag(const uint64_t i1, const uint64_t unmasked_tag) const;
+
+    bool DeleteIndexTag(const uint64_t i1, const uint64_t unmasked_tag);
+
+    inline uint64_t StripeOf(const uint64_t i) const
+    {
+        return i & stripe_mask_;
+    }
+
+    void LockStripe(const uint64_t s) const;
+
+    void UnlockStripe(const uint64_t s) const
+    {
+        stripes_[s].version.fetch_add(1, std::memory_order_release);
+    }
+
+    // Wait until stripe `s` is unlocked and return its version
+    uint64_t ReadBegin(const uint64_t s) const
+    {
+        uint64_t v;
+        size_t spins{0};
+        while ((v = stripes_[s].version.load(std::memory_order_acquire)) & 1)
+        {
+            syncutil::Backoff(&spins);
+        }
+        return v;
+    }
+
+    // Check that stripe `s` was not written since ReadBegin returned `v`
+    bool ReadValidate(const uint64_t s, const uint64_t v) const
+    {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return stripes_[s].version.load(std::memory_order_relaxed) == v;
+    }
+
+    // Consistent snapshot of the four tags of bucket `i`, false if not full
+    bool ReadFullBucket(const uint64_t i, uint64_t *tags) const;
+
+    static uint64_t PackVictim(const uint64_t index, const uint64_t tag)
+    {
+        return kVictimUsed | (index << kVictimTagBits) | tag;
+    }
+
+    static bool VictimMatches(const uint64_t victim, const uint64_t i1,
+                              const uint64_t i2, const uint64_t masked_tag)
+    {
+        const uint64_t index{(victim & ~kVictimUsed) >> kVictimTagBits};
+        return (victim & kVictimUsed) && (index == i1 || index == i2) &&
+               (victim & ((1ULL << kVictimTagBits) - 1)) == masked_tag;
+    }
+
+    // Store the tag to bucket `i` or its alternate bucket, relocating tags along
+    // a cuckoo path when both are full. Does not touch `num_items_`.
+    bool InsertImpl(const uint64_t i, const uint64_t unmasked_tag);
+
+    // Breadth first search for a cuckoo path from `i1` or `i2` to a bucket with
+    // a free slot. On success, `path[*end]` is that bucket.
+    bool SearchPath(const uint64_t i1, const uint64_t i2, PathEntry *path,
+                    int64_t *end) const;
+
+    // Move the tags along the path, returns false if any move is stale
+    bool MovePath(const PathEntry *path, int64_t end);
+
+    bool DeleteFromTable(const uint64_t i1, const uint64_t i2,
+                         const uint64_t unmasked_tag);
+
+    // Try to move the victim back into the table, `victim_mutex_` must be held
+    void RelocateVictim();
+
+    ConcurrentVECF(const size_t max_num_keys, const HashFamily &hasher_one,
+                   const HashFamily &hasher_two, const memutil::AllocOptions &options)
+        : num_items_(0), victim_(0), hasher_one_(hasher_one), hasher_two_(hasher_two)
+    {
+        size_t assoc = 4;
+        size_t num_buckets =
+            upperpower2(std::max<uint64_t>(1, max_num_keys / assoc));
+        double frac = (double)max_num_keys / num_buckets / assoc;
+        if (frac > 0.96)
+        {
+            num_buckets <<= 1;
+        }
+        static_assert(bits_per_item <= kVictimTagBits, "victim tag overflow");
+        table_.reset(new Table(num_buckets, options));
+        const size_t num_stripes{std::min<size_t>(num_buckets, kMaxNumStripes)};
+        stripe_mask_ = num_stripes - 1;
+        stripes_.reset(new Stripe[num_stripes]);
+    }
+
+  public:
+    // Hash functions are seeded randomly
+    explicit ConcurrentVECF(const size_t max_num_keys,
+                            const memutil::AllocOptions &options = {})
+        : ConcurrentVECF(max_num_keys, HashFamily(), HashFamily(), options)
+    {
+    }
+
+    // Filters built with the same seed hash keys identically, as VECF
+    ConcurrentVECF(const size_t max_num_keys, uint64_t seed,
+                   const memutil::AllocOptions &options = {})
+        : ConcurrentVECF(max_num_keys, HashFamily(seed), HashFamily(~seed), options)
+    {
+    }
+
+    bool Insert(const ItemType &item);
+
+    bool Lookup(const ItemType &item) const;
+
+    bool Delete(const ItemType &item);
+
+    // Pre-hashed keys, with the requirements of VECF::InsertHash
+    bool InsertHash(uint64_t hash);
+
+    bool LookupHash(uint64_t hash) const;
+
+    bool DeleteHash(uint64_t hash);
+
+    bool Insert(std::string_view key)
+    {
+        return InsertHash(hasher_one_(hashutil::HashBytes(key)));
+    }
+
+    bool Lookup(std::string_view key) const
+    {
+        return LookupHash(hasher_one_(hashutil::HashBytes(key)));
+    }
+
+    bool Delete(std::string_view key)
+    {
+        return DeleteHash(hasher_one_(hashutil::HashBytes(key)));
+    }
+
+    size_t GetItemNum() const
+    {
+        return num_items_.load(std::memory_order_relaxed);
+    }
+
+    size_t SizeInBytes() const
+    {
+        return table_->SizeInBytes();
+    }
+
+    double LoadFactor() const
+    {
+        return 1.0 * GetItemNum() / table_->SizeInTags();
+    }
+
+    double BitsPerItem() const
+    {
+        return 8.0 * table_->SizeInBytes() / GetItemNum();
+    }
+};
+
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily>
+ConcurrentVECF<ItemType, bits_per_item, TableType, HashFamily>::StripeGuard::
+    StripeGuard(const ConcurrentVECF *filter, uint64_t i1, uint64_t i2)
+    : filter_(filter), num_stripes_(0)
+{
+    for (uint64_t i : {i1, i2})
+    {
+        for (uint64_t j = 0; j <= Table::OverlappedBuckets(); ++j)
+        {
+            stripes_[num_stripes_++] = filter_->StripeOf(i + j);
+        }
+    }
+    // a fixed locking order keeps concurrent writers deadlock free
+    std::sort(stripes_, stripes_ + num_stripes_);
+    num_stripes_ = std::unique(stripes_, stripes_ + num_stripes_) - stripes_;
+    for (size_t k = 0; k < num_stripes_; ++k)
+    {
+        filter_->LockStripe(stripes_[k]);
+    }
+}
+
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily>
+ConcurrentVECF<ItemType, bits_per_item, TableType,
+               HashFamily>::StripeGuard::~StripeGuard()
+{
+    for (size_t k = 0; k < num_stripes_; ++k)
+    {
+        filter_->UnlockStripe(stripes_[k]);
+    }
+}
+
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily>
+void ConcurrentVECF<ItemType, bits_per_item, TableType, HashFamily>::LockStripe(
+    const uint64_t s) const
+{
+    std::atomic<uint64_t> &version{stripes_[s].version};
+    uint64_t v{version.load(std::memory_order_relaxed)};
+    size_t spins{0};
+    while ((v & 1) || !version.compare_exchange_weak(v, v + 1,
+                                                     std::memory_order_acquire,
+                                                     std::memory_order_relaxed))
+    {
+        syncutil::Backoff(&spins);
+        v = version.load(std::memory_order_relaxed);
+    }
+    // the odd version must be visible before any bucket write
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily>
+bool ConcurrentVECF<ItemType, bits_per_item, TableType,
+                    HashFamily>::ReadFullBucket(const uint64_t i,
+                                                uint64_t *tags) const
+{
+    const uint64_t s{StripeOf(i)};
+    for (;;)
+    {
+        const uint64_t v{ReadBegin(s)};
+        const bool full{table_->ReadFourSlotTags(i, tags)};
+        if (ReadValidate(s, v))
+        {
+            return full;
+        }
+    }
+}
+
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily>
+bool ConcurrentVECF<ItemType, bits_per_item, TableType, HashFamily>::SearchPath(
+    const uint64_t i1, const uint64_t i2, PathEntry *path, int64_t *end) const
+{
+    int64_t head{0}, tail{0};
+    path[tail++] = {i1, 0, -1};
+    if (i2 != i1)
+    {
+        path[tail++] = {i2, 0, -1};
+    }
+
+    uint64_t tags[kTagsPerBucket];
+    for (; head < tail; ++head)
+    {
+        const uint64_t bucket{path[head].bucket};
+        if (!ReadFullBucket(bucket, tags))
+        {
+            // got a free slot meanwhile, the path can end here
+            *end = head;
+            return true;
+        }
+        for (uint64_t r = 0; r < kTagsPerBucket; ++r)
+        {
+            const uint64_t alt{AltIndex(bucket, tags[r])};
+            uint64_t alt_tags[kTagsPerBucket];
+            if (!ReadFullBucket(alt, alt_tags))
+            {
+                path[tail] = {alt, tags[r], head};
+                *end = tail;
+                return true;
+            }
+            if (tail + 1 < static_cast<int64_t>(kMaxPathSearchBuckets))
+            {
+                path[tail++] = {alt, tags[r], head};
+            }
+        }
+    }
+    return false;
+}
+
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily>
+bool ConcurrentVECF<ItemType, bits_per_item, TableType, HashFamily>::MovePath(
+    const PathEntry *path, int64_t end)
+{
+    // Walk from the free bucket back to the root, so that every move has a
+    // free destination slot
+    for (int64_t k = end; path[k].parent != -1; k = path[k].parent)
+    {
+        const uint64_t src{path[path[k].parent].bucket}, dst{path[k].bucket},
+            tag{path[k].tag};
+
+        StripeGuard guard(this, src, dst);
+        uint64_t tags[kTagsPerBucket];
+        if (!table_->ReadFourSlotTags(src, tags) ||
+            std::find(tags, tags + kTagsPerBucket, tag) == tags + kTagsPerBucket)
+        {
+            return false;
+        }
+        uint64_t oldtag{};
+        if (!table_->InsertTagToBucket(dst, tag, false, 0, oldtag))
+        {
+            return false;
+        }
+        table_->DeleteTagFromBucket(src, tag);
+    }
+    return true;
+}
+
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily>
+bool ConcurrentVECF<ItemType, bits_per_item, TableType, HashFamily>::InsertImpl(
+    const uint64_t i, const uint64_t unmasked_tag)
+{
+    const uint64_t i1{i}, i2{AltIndex(i, unmasked_tag)};
+    std::unique_ptr<PathEntry[]> path;
+
+    for (size_t retry = 0; retry <= kMaxPathSearchRetries; ++retry)
+    {
+        {
+            StripeGuard guard(this, i1, i2);
+            uint64_t oldtag{};
+            if (table_->InsertTagToBucket(i1, unmasked_tag, false, 0, oldtag) ||
+                table_->InsertTagToBucket(i2, unmasked_tag, false, 0, oldtag))
+            {
+                return true;
+            }
+        }
+
+        if (!path)
+        {
+            path.reset(new PathEntry[kMaxPathSearchBuckets]);
+        }
+        int64_t end;
+        if (!SearchPath(i1, i2, path.get(), &end))
+        {
+            return false;
+        }
+        // a stale path is retried with a new search
+        MovePath(path.get(), end);
+    }
+    return false;
+}
+
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily>
+bool ConcurrentVECF<ItemType, bits_per_item, TableType, HashFamily>::Insert(
+    const ItemType &item)
+{
+    uint64_t i, unmasked_tag;
+    GenerateIndexTagHash(item, &i, &unmasked_tag);
+    return InsertIndexTag(i, unmasked_tag);
+}
+
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily>
+bool ConcurrentVECF<ItemType, bits_per_item, TableType, HashFamily>::InsertHash(
+    uint64_t hash)
+{
+    uint64_t i, unmasked_tag;
+    IndexTagFromHash(hash, &i, &unmasked_tag);
+    return InsertIndexTag(i, unmasked_tag);
+}
+
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily>
+bool ConcurrentVECF<ItemType, bits_per_item, TableType, HashFamily>::InsertIndexTag(
+    const uint64_t i, const uint64_t tag)
+{
+    if (victim_.load(std::memory_order_acquire) != 0)
+    {
+        return false;
+    }
+
+    if (!InsertImpl(i, tag))
+    {
+        std::lock_guard<std::mutex> lock(victim_mutex_);
+        if (victim_.load(std::memory_order_relaxed) != 0)
+        {
+            return false;
+        }
+        victim_.store(PackVictim(i, MaskedTag<bits_per_item>(tag)),
+                      std::memory_order_release);
+    }
+    num_items_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily>
+bool ConcurrentVECF<ItemType, bits_per_item, TableType, HashFamily>::Lookup(
+    const ItemType &item) const
+{
+    uint64_t i1, unmasked_tag;
+    GenerateIndexTagHash(item, &i1, &unmasked_tag);
+    return LookupIndexTag(i1, unmasked_tag);
+}
+
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily>
+bool ConcurrentVECF<ItemType, bits_per_item, TableType, HashFamily>::LookupHash(
+    uint64_t hash) const
+{
+    uint64_t i1, unmasked_tag;
+    IndexTagFromHash(hash, &i1, &unmasked_tag);
+    return LookupIndexTag(i1, unmasked_tag);
+}
+
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily>
+bool ConcurrentVECF<ItemType, bits_per_item, TableType, HashFamily>::LookupIndexTag(
+    const uint64_t i1, const uint64_t unmasked_tag) const
+{
+    const uint64_t i2{AltIndex(i1, unmasked_tag)};
+
+    // The victim is checked first: it is cleared only after its tag is back in
+    // the table, so a cleared victim guarantees the table probe sees the tag.
+    if (VictimMatches(victim_.load(std::memory_order_acquire), i1, i2,
+                      MaskedTag<bits_per_item>(unmasked_tag)))
+    {
+        return true;
+    }
+
+    const uint64_t s1{StripeOf(i1)}, s2{StripeOf(i2)};
+    for (;;)
+    {
+        const uint64_t v1{ReadBegin(s1)}, v2{ReadBegin(s2)};
+        const bool found{table_->FindTagInBuckets(i1, i2, unmasked_tag)};
+        if (ReadValidate(s1, v1) && ReadValidate(s2, v2))
+        {
+            return found;
+        }
+    }
+}
+
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily>
+bool ConcurrentVECF<ItemType, bits_per_item, TableType,
+                    HashFamily>::DeleteFromTable(const uint64_t i1,
+                                                 const uint64_t i2,
+                                                 const uint64_t unmasked_tag)
+{
+    StripeGuard guard(this, i1, i2);
+
+    uint64_t max_bucket_idx{};
+    uint32_t max_tag_length{};
+    table_->FindMaxMatchingTag(i1, unmasked_tag, &max_bucket_idx,
+                               &max_tag_length);
+    table_->FindMaxMatchingTag(i2, unmasked_tag, &max_bucket_idx,
+                               &max_tag_length);
+
+    if (max_tag_length == 0)
+    {
+        return false;
+    }
+
+    table_->DeleteTagFromBucket(max_bucket_idx,
+                                MaskedTag(unmasked_tag, max_tag_length));
+    return true;
+}
+
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily>
+void ConcurrentVECF<ItemType, bits_per_item, TableType,
+                    HashFamily>::RelocateVictim()
+{
+    const uint64_t victim{victim_.load(std::memory_order_relaxed)};
+    if (victim == 0)
+    {
+        return;
+    }
+    const uint64_t index{(victim & ~kVictimUsed) >> kVictimTagBits};
+    const uint64_t tag{victim & ((1ULL << kVictimTagBits) - 1)};
+    if (InsertImpl(index, tag))
+    {
+        victim_.store(0, std::memory_order_release);
+    }
+}
+
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily>
+bool ConcurrentVECF<ItemType, bits_per_item, TableType, HashFamily>::Delete(
+    const ItemType &item)
+{
+    uint64_t i1, unmasked_tag;
+    GenerateIndexTagHash(item, &i1, &unmasked_tag);
+    return DeleteIndexTag(i1, unmasked_tag);
+}
+
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily>
+bool ConcurrentVECF<ItemType, bits_per_item, TableType, HashFamily>::DeleteHash(
+    uint64_t hash)
+{
+    uint64_t i1, unmasked_tag;
+    IndexTagFromHash(hash, &i1, &unmasked_tag);
+    return DeleteIndexTag(i1, unmasked_tag);
+}
+
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily>
+bool ConcurrentVECF<ItemType, bits_per_item, TableType, HashFamily>::DeleteIndexTag(
+    const uint64_t i1, const uint64_t unmasked_tag)
+{
+    const uint64_t i2{AltIndex(i1, unmasked_tag)};
+
+    if (DeleteFromTable(i1, i2, unmasked_tag))
+    {
+        num_items_.fetch_sub(1, std::memory_order_relaxed);
+        if (victim_.load(std::memory_order_relaxed) != 0)
+        {
+            std::lock_guard<std::mutex> lock(victim_mutex_);
+            RelocateVictim();
+        }
+        return true;
+    }
+
+    std::lock_guard<std::mutex> lock(victim_mutex_);
+    // the victim may have been moved into the table before the lock was taken
+    if (DeleteFromTable(i1, i2, unmasked_tag))
+    {
+        num_items_.fetch_sub(1, std::memory_order_relaxed);
+        RelocateVictim();
+        return true;
+    }
+    if (VictimMatches(victim_.load(std::memory_order_relaxed), i1, i2,
+                      MaskedTag<bits_per_item>(unmasked_tag)))
+    {
+        victim_.store(0, std::memory_order_release);
+        num_items_.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
+
+}
+
+#endif
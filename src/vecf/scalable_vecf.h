@@ -0,0 +1,219 @@
+#ifndef SCALABLE_VECF_H_
+#define SCALABLE_VECF_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include "hashutil.h"
+#include "memutil.h"
+#include "vecf/vecf.h"
+
+namespace vecf
+{
+
+// A VECF that grows without bound, as a chain of VECF stages in the manner of
+// scalable Bloom filters. Inserts go to the newest stage; once it holds the
+// number of keys it was sized for, or an insert fails because its victim slot
+// is taken, a stage of twice the capacity is appended. Lookups probe every
+// stage, newest first, so they cost at most log2(keys / initial capacity) + 1
+// VECF lookups, and the false positive rate is the sum of those of the stages.
+//
+// A cuckoo filter cannot be rehashed into a larger table in place: the bucket
+// of a tag is one of two candidates and the index bits that would pick among
+// the new buckets are not stored. Hence stages instead of a rebuild.
+//
+// Delete removes the key from the one stage that reports it. A key reported
+// by several stages matches the tag of another key in all but one of them,
+// with the probability of a false positive there, and removing the wrong tag
+// would make that other key look absent. So such a delete removes nothing:
+// the key's tag stays behind and may give false positives, at a rate of about
+// the sum of the false positive rates of the stages per delete, but a key that
+// is never deleted is always found.
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType = SingleTable,
+          typename HashFamily = hashutil::TwoIndependentMultiplyShift,
+          bool kSingleHash = false>
+class ScalableVECF
+{
+    using Stage = VECF<ItemType, bits_per_item, TableType, HashFamily, kSingleHash>;
+
+    // capacity of stage i + 1 over that of stage i
+    constexpr static uint64_t kGrowthFactor{2};
+
+    std::vector<std::unique_ptr<Stage>> stages_;
+    uint64_t stage_capacity_; // capacity of the newest stage
+    uint64_t total_capacity_; // of all stages
+    uint64_t seed_;           // stage i is seeded with seed_ + i
+    uint64_t kept_tags_{0};   // of keys deleted while in several stages
+    memutil::AllocOptions options_;
+
+    void Grow()
+    {
+        stage_capacity_ *= kGrowthFactor;
+        total_capacity_ += stage_capacity_;
+        stages_.emplace_back(new Stage(stage_capacity_, seed_ + stages_.size(), options_));
+    }
+
+    // Insert with insert(stage), growing first if the newest stage is full
+    template <typename Op>
+    bool InsertWith(Op &&insert)
+    {
+        if (stages_.back()->GetItemNum() >= stage_capacity_ || !insert(*stages_.back()))
+        {
+            Grow();
+            insert(*stages_.back());
+        }
+        return true;
+    }
+
+    template <typename Op>
+    bool LookupWith(Op &&lookup) const
+    {
+        for (auto stage = stages_.rbegin(); stage != stages_.rend(); ++stage)
+        {
+            if (lookup(**stage))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Delete with erase(stage) from the only stage where lookup(stage)
+    template <typename Lookup, typename Op>
+    bool DeleteWith(Lookup &&lookup, Op &&erase)
+    {
+        Stage *found{nullptr};
+        for (auto &stage : stages_)
+        {
+            if (lookup(*stage))
+            {
+                if (found != nullptr)
+                {
+                    ++kept_tags_;
+                    return true;
+                }
+                found = stage.get();
+            }
+        }
+        return found != nullptr && erase(*found);
+    }
+
+  public:
+    // Hash functions are seeded randomly
+    explicit ScalableVECF(uint64_t initial_num_keys,
+                          const memutil::AllocOptions &options = {})
+        : ScalableVECF(initial_num_keys, hashutil::RandomSeed(), options)
+    {
+    }
+
+    // Filters built with the same seed hash keys identically
+    ScalableVECF(uint64_t initial_num_keys, uint64_t seed,
+                 const memutil::AllocOptions &options = {})
+        : stage_capacity_(std::max<uint64_t>(initial_num_keys, 1)),
+          total_capacity_(stage_capacity_), seed_(seed), options_(options)
+    {
+        stages_.emplace_back(new Stage(stage_capacity_, seed_, options_));
+    }
+
+    // Never fails: a full stage makes room by growing the chain
+    bool Insert(const ItemType &item)
+    {
+        return InsertWith([&item](Stage &stage) { return stage.Insert(item); });
+    }
+
+    bool Lookup(const ItemType &item) const
+    {
+        return LookupWith([&item](const Stage &stage) { return stage.Lookup(item); });
+    }
+
+    bool Delete(const ItemType &item)
+    {
+        return DeleteWith([&item](const Stage &stage) { return stage.Lookup(item); },
+                          [&item](Stage &stage) { return stage.Delete(item); });
+    }
+
+    // Pre-hashed keys, with the requirements of VECF::InsertHash
+    bool InsertHash(uint64_t hash)
+    {
+        return InsertWith([hash](Stage &stage) { return stage.InsertHash(hash); });
+    }
+
+    bool LookupHash(uint64_t hash) const
+    {
+        return LookupWith([hash](const Stage &stage) { return stage.LookupHash(hash); });
+    }
+
+    bool DeleteHash(uint64_t hash)
+    {
+        return DeleteWith([hash](const Stage &stage) { return stage.LookupHash(hash); },
+                          [hash](Stage &stage) { return stage.DeleteHash(hash); });
+    }
+
+    // Each stage hashes the folded key with its own seed
+    bool Insert(std::string_view key)
+    {
+        return InsertWith([key](Stage &stage) { return stage.Insert(key); });
+    }
+
+    bool Lookup(std::string_view key) const
+    {
+        return LookupWith([key](const Stage &stage) { return stage.Lookup(key); });
+    }
+
+    bool Delete(std::string_view key)
+    {
+        return DeleteWith([key](const Stage &stage) { return stage.Lookup(key); },
+                          [key](Stage &stage) { return stage.Delete(key); });
+    }
+
+    size_t NumStages() const
+    {
+        return stages_.size();
+    }
+
+    // Inserted and not deleted keys
+    size_t GetItemNum() const
+    {
+        size_t num_items{0};
+        for (const auto &stage : stages_)
+        {
+            num_items += stage->GetItemNum();
+        }
+        return num_items - kept_tags_;
+    }
+
+    // Tags left in the stages by deletes of keys several stages reported
+    size_t NumKeptTags() const
+    {
+        return kept_tags_;
+    }
+
+    size_t SizeInBytes() const
+    {
+        size_t bytes{0};
+        for (const auto &stage : stages_)
+        {
+            bytes += stage->SizeInBytes();
+        }
+        return bytes;
+    }
+
+    // Keys over the capacity of all stages
+    double LoadFactor() const
+    {
+        return 1.0 * GetItemNum() / total_capacity_;
+    }
+
+    double BitsPerItem() const
+    {
+        return 8.0 * SizeInBytes() / GetItemNum();
+    }
+};
+
+}
+
+#endif
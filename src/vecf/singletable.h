@@ -7,7 +7,10 @@
 #include <cstring>
 #include <memory>
 #include <type_traits>
+#include <utility>
 
+#include "bmiutil.h"
+#include "memutil.h"
 #include "vecf/bitsutil.h"
 
 namespace vecf
@@ -34,11 +37,53 @@ class BaseSingleTable
         return kTagsPerBucket * num_buckets_;
     }
 
+    // Buckets are read and written with a 4/8-byte access, which also covers
+    // this many following buckets
+    constexpr static uint64_t OverlappedBuckets()
+    {
+        return ((kBytesPerBucket <= 4 ? 4 : 8) - 1) / kBytesPerBucket;
+    }
+
+    // Bytes allocated for a table of `num_buckets`, and the table as raw bytes,
+    // for saving and loading
+    static size_t AllocatedBytes(uint64_t num_buckets)
+    {
+        return (num_buckets + kPaddingBuckets) * sizeof(Bucket);
+    }
+
+    const char *Data() const
+    {
+        return reinterpret_cast<const char *>(buckets_.get());
+    }
+
+    void PrefetchBucket(const uint64_t i) const
+    {
+        const char *p{buckets_[i].bits_};
+        _mm_prefetch(p, _MM_HINT_T0);
+        // buckets are read with a 4/8-byte load, which may cross a cache line
+        _mm_prefetch(p + sizeof(uint64_t) - 1, _MM_HINT_T0);
+    }
+
   protected:
     // derived class is responsible to initialize `buckets_`
-    explicit BaseSingleTable(const uint64_t num_buckets)
+    explicit BaseSingleTable(const uint64_t num_buckets,
+                             const memutil::AllocOptions &options)
+        : BaseSingleTable(num_buckets, num_buckets + kPaddingBuckets, options)
+    {
+    }
+
+    // for derived classes laying out buckets in their own way
+    BaseSingleTable(const uint64_t num_buckets, const uint64_t num_allocated_buckets,
+                    const memutil::AllocOptions &options)
         : num_buckets_(num_buckets),
-          buckets_(new Bucket[num_buckets + kPaddingBuckets])
+          buckets_(memutil::Allocate<Bucket>(num_allocated_buckets, options))
+    {
+    }
+
+    // adopt the buckets of a saved table
+    BaseSingleTable(const uint64_t num_buckets, memutil::UniquePtr<char> data)
+        : num_buckets_(num_buckets),
+          buckets_(reinterpret_cast<Bucket *>(data.release()), data.get_deleter())
     {
     }
 
@@ -54,7 +99,7 @@ class BaseSingleTable
     } __attribute__((__packed__));
 
     uint64_t num_buckets_;
-    std::unique_ptr<Bucket[]> buckets_;
+    memutil::UniquePtr<Bucket> buckets_;
 
     template <uint64_t index, uint32_t tag_length, typename T>
     static inline T BucketTag(const T b)
@@ -73,6 +118,97 @@ class BaseSingleTable
         }
     }
 
+    // The hasvalue() checks of FindTagInBucket for a bucket of each number of
+    // slots n: its n tags, kTagLen[n] bits each, match the tag masked to
+    // kTagLen[m] for any m >= n. Check m of a bucket with n slots is
+    // haszero(fields ^ ones[n] * masked_tag[m]) restricted to high[n][m - 1],
+    // which is 0 for m < n and for empty buckets.
+    struct ProbeConstants
+    {
+        uint64_t ones[kTagsPerBucket + 1], high[kTagsPerBucket + 1][kTagsPerBucket],
+            tag_mask[kTagsPerBucket];
+    };
+
+    template <uint32_t kOneSlotTagLen, uint32_t kTwoSlotTagLen, uint32_t kThreeSlotTagLen>
+    constexpr static ProbeConstants MakeProbeConstants()
+    {
+        constexpr uint32_t kTagLen[]{0, kOneSlotTagLen, kTwoSlotTagLen, kThreeSlotTagLen,
+                                     kFourSlotTagLen};
+        ProbeConstants probe{};
+        for (uint64_t n = 1; n <= kTagsPerBucket; ++n)
+        {
+            for (uint64_t j = 0; j < n; ++j)
+            {
+                probe.ones[n] |= 1ull << (j * kTagLen[n]);
+            }
+            for (uint64_t m = n; m <= kTagsPerBucket; ++m)
+            {
+                probe.high[n][m - 1] = probe.ones[n] << (kTagLen[n] - 1);
+            }
+            probe.tag_mask[n - 1] = (1ull << kTagLen[n]) - 1;
+        }
+        return probe;
+    }
+
+    // Look `unmasked_tag` up in two buckets at once, with the checks of
+    // FindTagInBucket picked by table lookups instead of a switch on each
+    // bucket's flag, which mispredicts when buckets of different fill levels
+    // are probed. The flag bits of the zero, one, two and three slot flags
+    // are, from the lowest, 010, 100, 101 and 110 in every table; the other
+    // values mark four slot buckets, whose tags are not extracted. AVX-512
+    // runs the four checks of both buckets in the lanes of one vector; with
+    // AVX2, whose lack of a 64-bit multiply makes lanes dearer than the scalar
+    // checks, those run in a branch-free loop.
+    template <uint32_t kOneSlotTagLen, uint32_t kTwoSlotTagLen, uint32_t kThreeSlotTagLen,
+              uint64_t kFlagBitsMask, uint64_t kTagBitsMask>
+    static bool FindTagInBucketPair(const uint64_t bucket1, const uint64_t bucket2,
+                                    const uint64_t unmasked_tag)
+    {
+        constexpr static uint8_t kSlotsOfFlags[8]{4, 4, 0, 4, 1, 2, 3, 4};
+        constexpr static ProbeConstants kProbe{
+            MakeProbeConstants<kOneSlotTagLen, kTwoSlotTagLen, kThreeSlotTagLen>()};
+        const uint64_t n1{kSlotsOfFlags[bmiutil::Pext64(bucket1, kFlagBitsMask)]},
+            n2{kSlotsOfFlags[bmiutil::Pext64(bucket2, kFlagBitsMask)]},
+            fields1{n1 == kTagsPerBucket ? bucket1
+                                         : bmiutil::Pext64(bucket1, kTagBitsMask)},
+            fields2{n2 == kTagsPerBucket ? bucket2
+                                         : bmiutil::Pext64(bucket2, kTagBitsMask)};
+#if defined(__AVX512F__) && defined(__AVX512DQ__)
+        // Masked forms only: the plain forms and casts leave lanes undefined,
+        // which GCC reports as uninitialized. A pair is `low` broadcast to the
+        // low half and `high` to the high half.
+        constexpr __mmask8 kAllLanes{0xff}, kLowHalf{0x0f}, kHighHalf{0xf0};
+        const auto pair = [](__m256i low, __m256i high) {
+            return _mm512_mask_broadcast_i64x4(_mm512_maskz_broadcast_i64x4(kLowHalf, low),
+                                               kHighHalf, high);
+        };
+        const auto load = [](const uint64_t *p) {
+            return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+        };
+        const __m512i ones{pair(_mm256_set1_epi64x(kProbe.ones[n1]),
+                                _mm256_set1_epi64x(kProbe.ones[n2]))},
+            high{pair(load(kProbe.high[n1]), load(kProbe.high[n2]))},
+            tags{_mm512_and_si512(_mm512_set1_epi64(unmasked_tag),
+                                  _mm512_maskz_broadcast_i64x4(kAllLanes,
+                                                               load(kProbe.tag_mask)))},
+            x{_mm512_xor_si512(pair(_mm256_set1_epi64x(fields1), _mm256_set1_epi64x(fields2)),
+                               _mm512_mullo_epi64(tags, ones))},
+            zero{_mm512_and_si512(
+                _mm512_maskz_andnot_epi64(kAllLanes, x, _mm512_sub_epi64(x, ones)), high)};
+        return _mm512_test_epi64_mask(zero, zero) != 0;
+#else
+        uint64_t found{0};
+        for (uint64_t m = 0; m < kTagsPerBucket; ++m)
+        {
+            const uint64_t tag{unmasked_tag & kProbe.tag_mask[m]},
+                x1{fields1 ^ kProbe.ones[n1] * tag}, x2{fields2 ^ kProbe.ones[n2] * tag};
+            found |= ((x1 - kProbe.ones[n1]) & ~x1 & kProbe.high[n1][m]) |
+                     ((x2 - kProbe.ones[n2]) & ~x2 & kProbe.high[n2][m]);
+        }
+        return found != 0;
+#endif
+    }
+
     template <uint32_t tag_length, typename T>
     static inline T BucketTag(const T b, uint64_t index)
     {
@@ -107,8 +243,9 @@ template <>
 class SingleTable<8> : public BaseSingleTable<8>
 {
   public:
-    explicit SingleTable(uint64_t num_buckets)
-        : BaseSingleTable(num_buckets)
+    explicit SingleTable(uint64_t num_buckets,
+                         const memutil::AllocOptions &options = {})
+        : BaseSingleTable(num_buckets, options)
     {
         static_assert(kBytesPerBucket == 4, "ctor only work on this case");
 
@@ -119,6 +256,21 @@ class SingleTable<8> : public BaseSingleTable<8>
         }
     }
 
+    SingleTable(uint64_t num_buckets, memutil::UniquePtr<char> data)
+        : BaseSingleTable(num_buckets, std::move(data))
+    {
+    }
+
+    // FindTagInBucket on both buckets, see FindTagInBucketPair
+    bool FindTagInBuckets(const uint64_t i1, const uint64_t i2,
+                          const uint64_t unmasked_tag) const
+    {
+        return FindTagInBucketPair<kOneSlotTagLen, kTwoSlotTagLen, kThreeSlotTagLen,
+                                   kFlagBitsMask, kTagBitsMask>(
+            *reinterpret_cast<uint32_t *>(buckets_[i1].bits_),
+            *reinterpret_cast<uint32_t *>(buckets_[i2].bits_), unmasked_tag);
+    }
+
     bool FindTagInBucket(const uint64_t i, const uint32_t unmasked_tag) const
     {
         const uint32_t bucket{*reinterpret_cast<uint32_t *>(buckets_[i].bits_)};
@@ -130,20 +282,20 @@ class SingleTable<8> : public BaseSingleTable<8>
             return false;
         }
         case kOneSlotFlag: {
-            const uint32_t tags{_pext_u32(bucket, kTagBitsMask)};
+            const uint32_t tags{bmiutil::Pext32(bucket, kTagBitsMask)};
             return hasvalue29(tags, MaskedTag<kOneSlotTagLen>(unmasked_tag)) ||
                    hasvalue29(tags, MaskedTag<kTwoSlotTagLen>(unmasked_tag)) ||
                    hasvalue29(tags, MaskedTag<kThreeSlotTagLen>(unmasked_tag)) ||
                    hasvalue29(tags, MaskedTag<kFourSlotTagLen>(unmasked_tag));
         }
         case kTwoSlotFlag: {
-            const uint32_t tags{_pext_u32(bucket, kTagBitsMask)};
+            const uint32_t tags{bmiutil::Pext32(bucket, kTagBitsMask)};
             return hasvalue14(tags, MaskedTag<kTwoSlotTagLen>(unmasked_tag)) ||
                    hasvalue14(tags, MaskedTag<kThreeSlotTagLen>(unmasked_tag)) ||
                    hasvalue14(tags, MaskedTag<kFourSlotTagLen>(unmasked_tag));
         }
         case kThreeSlotFlag: {
-            const uint32_t tags{_pext_u32(bucket, kTagBitsMask)};
+            const uint32_t tags{bmiutil::Pext32(bucket, kTagBitsMask)};
             return hasvalue9(tags, MaskedTag<kThreeSlotTagLen>(unmasked_tag)) ||
                    hasvalue9(tags, MaskedTag<kFourSlotTagLen>(unmasked_tag));
         }
@@ -153,8 +305,11 @@ class SingleTable<8> : public BaseSingleTable<8>
         }
     }
 
+    // With `kickout`, a full bucket replaces the tag of slot `random` %
+    // kTagsPerBucket, which is returned in `oldtag`
     inline bool InsertTagToBucket(const uint64_t i, const uint64_t tag,
-                                  const bool kickout, uint64_t &oldtag)
+                                  const bool kickout, const uint64_t random,
+                                  uint64_t &oldtag)
     {
         uint32_t bucket{*reinterpret_cast<uint32_t *>(buckets_[i].bits_)};
         const uint32_t flag{bucket & kFlagBitsMask};
@@ -162,26 +317,26 @@ class SingleTable<8> : public BaseSingleTable<8>
         switch (flag)
         {
         case kZeroSlotFlag: {
-            bucket = _pdep_u32(tag, kTagBitsMask) | kOneSlotFlag;
+            bucket = bmiutil::Pdep32(tag, kTagBitsMask) | kOneSlotFlag;
             *reinterpret_cast<uint32_t *>(buckets_[i].bits_) = bucket;
             return true;
         }
         case kOneSlotFlag: {
-            uint32_t tags{_pext_u32(bucket, 0x00003fff)}; // get one 14bit tags
+            uint32_t tags{bmiutil::Pext32(bucket, 0x00003fff)}; // get one 14bit tags
             tags |= (MaskedTag<kTwoSlotTagLen>(tag) << kTwoSlotTagLen);
             *reinterpret_cast<uint32_t *>(buckets_[i].bits_) =
-                _pdep_u32(tags, kTagBitsMask) | kTwoSlotFlag;
+                bmiutil::Pdep32(tags, kTagBitsMask) | kTwoSlotFlag;
             return true;
         }
         case kTwoSlotFlag: {
-            uint32_t tags{_pext_u32(bucket, 0x017f41ff)}; // get two 9bit tags
+            uint32_t tags{bmiutil::Pext32(bucket, 0x017f41ff)}; // get two 9bit tags
             tags |= MaskedTag<kThreeSlotTagLen>(tag) << (2 * kThreeSlotTagLen);
             *reinterpret_cast<uint32_t *>(buckets_[i].bits_) =
-                _pdep_u32(tags, kTagBitsMask) | kThreeSlotFlag;
+                bmiutil::Pdep32(tags, kTagBitsMask) | kThreeSlotFlag;
             return true;
         }
         case kThreeSlotFlag: {
-            uint32_t tags{_pext_u32(bucket, 0x0f7b7eff)}; // get three 8bit tags
+            uint32_t tags{bmiutil::Pext32(bucket, 0x0f7b7eff)}; // get three 8bit tags
             tags |= (MaskedTag<kFourSlotTagLen>(tag) << (3 * kFourSlotTagLen));
             uint32_t tag3{BucketTag<3, kFourSlotTagLen>(tags)},
                 tag2{BucketTag<2, kFourSlotTagLen>(tags)},
@@ -217,7 +372,7 @@ class SingleTable<8> : public BaseSingleTable<8>
                 static_assert(kFourSlotTagLen == 8,
                               "can not access bucket as uint8_t array");
 
-                uint64_t r{rand() % kTagsPerBucket};
+                uint64_t r{random % kTagsPerBucket};
                 oldtag = BucketTag<kFourSlotTagLen>(bucket, r);
                 ((uint8_t *)(&bucket))[r] = MaskedTag<kFourSlotTagLen>(tag);
                 uint32_t tag3{BucketTag<3, kFourSlotTagLen>(bucket)},
@@ -265,7 +420,7 @@ class SingleTable<8> : public BaseSingleTable<8>
             return;
         }
         case kOneSlotFlag: {
-            const uint32_t tags{_pext_u32(bucket, kTagBitsMask)};
+            const uint32_t tags{bmiutil::Pext32(bucket, kTagBitsMask)};
 #define HELPER(tag_length)                                     \
     if (*max_tag_length >= tag_length)                         \
     {                                                          \
@@ -286,7 +441,7 @@ class SingleTable<8> : public BaseSingleTable<8>
             return;
         }
         case kTwoSlotFlag: {
-            const uint32_t tags{_pext_u32(bucket, kTagBitsMask)};
+            const uint32_t tags{bmiutil::Pext32(bucket, kTagBitsMask)};
 #define HELPER(tag_length)                                     \
     if (*max_tag_length >= tag_length)                         \
     {                                                          \
@@ -306,7 +461,7 @@ class SingleTable<8> : public BaseSingleTable<8>
             return;
         }
         case kThreeSlotFlag: {
-            const uint32_t tags{_pext_u32(bucket, kTagBitsMask)};
+            const uint32_t tags{bmiutil::Pext32(bucket, kTagBitsMask)};
 #define HELPER(tag_length)                                    \
     if (*max_tag_length >= tag_length)                        \
     {                                                         \
@@ -364,13 +519,14 @@ class SingleTable<8> : public BaseSingleTable<8>
         }
         case kTwoSlotFlag: {
             uint32_t masks[]{0x3f7f4000, 0x00003fff};
-            const uint32_t tags{_pext_u32(bucket, kTagBitsMask)};
+            const uint32_t tags{bmiutil::Pext32(bucket, kTagBitsMask)};
             for (uint32_t slot_idx = 0; slot_idx < 2; ++slot_idx)
             {
                 if (BucketTag<kTwoSlotTagLen>(tags, slot_idx) == masked_tag)
                 {
                     *reinterpret_cast<uint32_t *>(buckets_[bucket_idx].bits_) =
-                        _pdep_u32(_pext_u32(bucket, masks[slot_idx]), kTagBitsMask) |
+                        bmiutil::Pdep32(bmiutil::Pext32(bucket, masks[slot_idx]),
+                                        kTagBitsMask) |
                         kOneSlotFlag;
                     return;
                 }
@@ -380,13 +536,14 @@ class SingleTable<8> : public BaseSingleTable<8>
         }
         case kThreeSlotFlag: {
             uint32_t masks[]{0x1f7f7e00, 0x1f7801ff, 0x000077fff};
-            const uint32_t tags{_pext_u32(bucket, kTagBitsMask)};
+            const uint32_t tags{bmiutil::Pext32(bucket, kTagBitsMask)};
             for (uint32_t slot_idx = 0; slot_idx < 3; ++slot_idx)
             {
                 if (BucketTag<kThreeSlotTagLen>(tags, slot_idx) == masked_tag)
                 {
                     *reinterpret_cast<uint32_t *>(buckets_[bucket_idx].bits_) =
-                        _pdep_u32(_pext_u32(bucket, masks[slot_idx]), 0x017f41ff) |
+                        bmiutil::Pdep32(bmiutil::Pext32(bucket, masks[slot_idx]),
+                                        0x017f41ff) |
                         kTwoSlotFlag;
                     return;
                 }
@@ -401,7 +558,8 @@ class SingleTable<8> : public BaseSingleTable<8>
                 if (BucketTag<kFourSlotTagLen>(bucket, slot_idx) == masked_tag)
                 {
                     *reinterpret_cast<uint32_t *>(buckets_[bucket_idx].bits_) =
-                        _pdep_u32(_pext_u32(bucket, masks[slot_idx]), 0x0f7b7eff) |
+                        bmiutil::Pdep32(bmiutil::Pext32(bucket, masks[slot_idx]),
+                                        0x0f7b7eff) |
                         kThreeSlotFlag;
                     return;
                 }
@@ -444,6 +602,28 @@ class SingleTable<8> : public BaseSingleTable<8>
         }
     }
 
+    // Read the tags of bucket `i` if it holds four tags, for cuckoo path search
+    bool ReadFourSlotTags(const uint64_t i, uint64_t *tags) const
+    {
+        const uint32_t bucket{*reinterpret_cast<uint32_t *>(buckets_[i].bits_)};
+        switch (bucket & kFlagBitsMask)
+        {
+        case kZeroSlotFlag:
+        case kOneSlotFlag:
+        case kTwoSlotFlag:
+        case kThreeSlotFlag: {
+            return false;
+        }
+        default: {
+            for (uint64_t r = 0; r < kTagsPerBucket; ++r)
+            {
+                tags[r] = BucketTag<kFourSlotTagLen>(bucket, r);
+            }
+            return true;
+        }
+        }
+    }
+
   private:
     constexpr static uint32_t kFlagBitsMask = 0x80808000;
     constexpr static uint32_t kTagBitsMask = ~kFlagBitsMask;
@@ -473,27 +653,80 @@ class SingleTable<8> : public BaseSingleTable<8>
 #define haszero15(x) (((x)-0x000040008001ULL) & (~(x)) & 0x100020004000ULL)
 #define hasvalue15(x, n) (haszero15((x) ^ (0x000040008001ULL * (n))))
 
-template <>
-class SingleTable<12> : public BaseSingleTable<12>
+// 12-bit table. Buckets are packed back to back if kBucketsPerLine is 0, so
+// that some straddle two cache lines. Otherwise kBucketsPerLine buckets are
+// grouped in each 64-byte aligned line, and the spare bytes at the end of the
+// line absorb the 8-byte access to its last bucket.
+template <uint64_t kBucketsPerLine>
+class SingleTable12Impl : public BaseSingleTable<12>
 {
   public:
-    explicit SingleTable(uint64_t num_buckets)
-        : BaseSingleTable(num_buckets)
+    explicit SingleTable12Impl(uint64_t num_buckets,
+                               const memutil::AllocOptions &options)
+        : BaseSingleTable(num_buckets, NumAllocatedBuckets(num_buckets), options),
+          lines_(reinterpret_cast<char *>(buckets_.get()))
     {
         static_assert(kBytesPerBucket == 6, "ctor only work on this case");
-        char *p{reinterpret_cast<char *>(buckets_.get())};
+        static_assert(kBucketsPerLine * kBytesPerBucket + 2 <= kLineBytes,
+                      "last bucket of a line must be readable with 8 bytes");
         for (uint64_t i = 0; i < num_buckets_; ++i)
         {
+            char *p{BucketBits(i)};
             *reinterpret_cast<uint32_t *>(p) = (kZeroSlotFlag & 0xffffffff);
             *reinterpret_cast<uint16_t *>(p + 4) = (kZeroSlotFlag >> 32) & 0xffff;
-            p += kBytesPerBucket;
         }
     }
 
+    SingleTable12Impl(uint64_t num_buckets, memutil::UniquePtr<char> data)
+        : BaseSingleTable(num_buckets, std::move(data)),
+          lines_(reinterpret_cast<char *>(buckets_.get()))
+    {
+    }
+
+    static size_t AllocatedBytes(uint64_t num_buckets)
+    {
+        return NumAllocatedBuckets(num_buckets) * sizeof(Bucket);
+    }
+
+    size_t SizeInBytes() const
+    {
+        if constexpr (kBucketsPerLine == 0)
+        {
+            return kBytesPerBucket * num_buckets_;
+        }
+        else
+        {
+            return kLineBytes * NumLines(num_buckets_);
+        }
+    }
+
+    void PrefetchBucket(const uint64_t i) const
+    {
+        const char *p{BucketBits(i)};
+        _mm_prefetch(p, _MM_HINT_T0);
+        if constexpr (kBucketsPerLine == 0)
+        {
+            // buckets are read with a 8-byte load, which may cross a cache line
+            _mm_prefetch(p + sizeof(uint64_t) - 1, _MM_HINT_T0);
+        }
+    }
+
+    // FindTagInBucket on both buckets, see FindTagInBucketPair
+    bool FindTagInBuckets(const uint64_t i1, const uint64_t i2,
+                          const uint64_t unmasked_tag) const
+    {
+        uint64_t bucket1, bucket2;
+        std::memcpy(&bucket1, BucketBits(i1), sizeof(uint64_t));
+        std::memcpy(&bucket2, BucketBits(i2), sizeof(uint64_t));
+        return FindTagInBucketPair<kOneSlotTagLen, kTwoSlotTagLen, kThreeSlotTagLen,
+                                   kFlagBitsMask, kTagBitsMask>(bucket1, bucket2,
+                                                                unmasked_tag);
+    }
+
     bool FindTagInBucket(const uint64_t i, const uint64_t unmasked_tag) const
     {
         uint64_t bucket;
-        std::memcpy(&bucket, buckets_[i].bits_, sizeof(uint64_t));
+        std::memcpy(&bucket, BucketBits(i), sizeof(uint64_t));
         const uint64_t flag{bucket & kFlagBitsMask};
 
         switch (flag)
@@ -502,20 +735,20 @@ class SingleTable<12> : public BaseSingleTable<12>
             return false;
         }
         case kOneSlotFlag: {
-            const uint64_t tags{_pext_u64(bucket, kTagBitsMask)};
+            const uint64_t tags{bmiutil::Pext64(bucket, kTagBitsMask)};
             return hasvalue45(tags, MaskedTag<kOneSlotTagLen>(unmasked_tag)) ||
                    hasvalue45(tags, MaskedTag<kTwoSlotTagLen>(unmasked_tag)) ||
                    hasvalue45(tags, MaskedTag<kThreeSlotTagLen>(unmasked_tag)) ||
                    hasvalue45(tags, MaskedTag<kFourSlotTagLen>(unmasked_tag));
         }
         case kTwoSlotFlag: {
-            const uint64_t tags{_pext_u64(bucket, kTagBitsMask)};
+            const uint64_t tags{bmiutil::Pext64(bucket, kTagBitsMask)};
             return hasvalue22(tags, MaskedTag<kTwoSlotTagLen>(unmasked_tag)) ||
                    hasvalue22(tags, MaskedTag<kThreeSlotTagLen>(unmasked_tag)) ||
                    hasvalue22(tags, MaskedTag<kFourSlotTagLen>(unmasked_tag));
         }
         case kThreeSlotFlag: {
-            const uint64_t tags{_pext_u64(bucket, kTagBitsMask)};
+            const uint64_t tags{bmiutil::Pext64(bucket, kTagBitsMask)};
             return hasvalue15(tags, MaskedTag<kThreeSlotTagLen>(unmasked_tag)) ||
                    hasvalue15(tags, MaskedTag<kFourSlotTagLen>(unmasked_tag));
         }
@@ -525,51 +758,54 @@ class SingleTable<12> : public BaseSingleTable<12>
         }
     }
 
+    // With `kickout`, a full bucket replaces the tag of slot `random` %
+    // kTagsPerBucket, which is returned in `oldtag`
     inline bool InsertTagToBucket(const uint64_t i, const uint64_t tag,
-                                  const bool kickout, uint64_t &oldtag)
+                                  const bool kickout, const uint64_t random,
+                                  uint64_t &oldtag)
     {
         uint64_t bucket;
-        std::memcpy(&bucket, buckets_[i].bits_, sizeof(uint64_t));
+        std::memcpy(&bucket, BucketBits(i), sizeof(uint64_t));
         const uint64_t flag{bucket & kFlagBitsMask};
 
         switch (flag)
         {
         case kZeroSlotFlag: {
             uint64_t tags_and_next_bucket{
-                _pext_u64(bucket, 0xffff000000000000)}; // get 16bit next bucket
+                bmiutil::Pext64(bucket, 0xffff000000000000)}; // get 16bit next bucket
             tags_and_next_bucket = (tags_and_next_bucket << kOneSlotTagLen) |
                                    MaskedTag<kOneSlotTagLen>(tag);
             tags_and_next_bucket =
-                _pdep_u64(tags_and_next_bucket, 0xffff000000000000 | kTagBitsMask) |
+                bmiutil::Pdep64(tags_and_next_bucket, 0xffff000000000000 | kTagBitsMask) |
                 kOneSlotFlag;
-            std::memcpy(buckets_[i].bits_, &tags_and_next_bucket, sizeof(uint64_t));
+            std::memcpy(BucketBits(i), &tags_and_next_bucket, sizeof(uint64_t));
             return true;
         }
         case kOneSlotFlag: {
-            uint64_t tags_and_next_bucket{_pext_u64(
+            uint64_t tags_and_next_bucket{bmiutil::Pext64(
                 bucket,
                 0xffff0000003fffff)}; // get one 22bit tag + 16bit next bucket
             tags_and_next_bucket = (tags_and_next_bucket << kTwoSlotTagLen) |
                                    MaskedTag<kTwoSlotTagLen>(tag);
             tags_and_next_bucket =
-                _pdep_u64(tags_and_next_bucket, 0xffff3ff7ff7fffff) | kTwoSlotFlag;
-            std::memcpy(buckets_[i].bits_, &tags_and_next_bucket, sizeof(uint64_t));
+                bmiutil::Pdep64(tags_and_next_bucket, 0xffff3ff7ff7fffff) | kTwoSlotFlag;
+            std::memcpy(BucketBits(i), &tags_and_next_bucket, sizeof(uint64_t));
             return true;
         }
         case kTwoSlotFlag: {
-            uint64_t tags_and_next_bucket{_pext_u64(
+            uint64_t tags_and_next_bucket{bmiutil::Pext64(
                 bucket,
                 0xffff0077ff407fff)}; // get two 15bit tags + 16bit next bucket
             tags_and_next_bucket = (tags_and_next_bucket << kThreeSlotTagLen) |
                                    MaskedTag<kThreeSlotTagLen>(tag);
             tags_and_next_bucket =
-                _pdep_u64(tags_and_next_bucket, 0xffff000000000000 | kTagBitsMask) |
+                bmiutil::Pdep64(tags_and_next_bucket, 0xffff000000000000 | kTagBitsMask) |
                 kThreeSlotFlag;
-            std::memcpy(buckets_[i].bits_, &tags_and_next_bucket, sizeof(uint64_t));
+            std::memcpy(BucketBits(i), &tags_and_next_bucket, sizeof(uint64_t));
             return true;
         }
         case kThreeSlotFlag: {
-            uint64_t tags_and_next_bucket{_pext_u64(
+            uint64_t tags_and_next_bucket{bmiutil::Pext64(
                 bucket,
                 0xffff0ff78f7f8fff)}; // get three 12bit tags + 16bit next bucket
             tags_and_next_bucket = (tags_and_next_bucket << kFourSlotTagLen) |
@@ -596,7 +832,7 @@ class SingleTable<12> : public BaseSingleTable<12>
                                         (tag2 << 2 * kFourSlotTagLen) |
                                         (tag1 << kFourSlotTagLen);
             }
-            std::memcpy(buckets_[i].bits_, &tags_and_next_bucket, sizeof(uint64_t));
+            std::memcpy(BucketBits(i), &tags_and_next_bucket, sizeof(uint64_t));
             assert((BucketTag<3, kFourSlotTagLen>(tags_and_next_bucket) <=
                         BucketTag<2, kFourSlotTagLen>(tags_and_next_bucket) &&
                     BucketTag<2, kFourSlotTagLen>(tags_and_next_bucket) <=
@@ -606,7 +842,7 @@ class SingleTable<12> : public BaseSingleTable<12>
         default: {
             if (kickout)
             {
-                uint64_t r{rand() % kTagsPerBucket};
+                uint64_t r{random % kTagsPerBucket};
                 oldtag = BucketTag<kFourSlotTagLen>(bucket, r);
                 char *p = reinterpret_cast<char *>(&bucket) + (r + (r >> 1));
 
@@ -645,7 +881,7 @@ class SingleTable<12> : public BaseSingleTable<12>
                     bucket |= (tag3 << 3 * kFourSlotTagLen) |
                               (tag2 << 2 * kFourSlotTagLen) | (tag1 << kFourSlotTagLen);
                 }
-                std::memcpy(buckets_[i].bits_, &bucket, sizeof(uint64_t));
+                std::memcpy(BucketBits(i), &bucket, sizeof(uint64_t));
             }
             return false;
         }
@@ -657,7 +893,7 @@ class SingleTable<12> : public BaseSingleTable<12>
                             uint32_t *max_tag_length) const
     {
         uint64_t bucket;
-        std::memcpy(&bucket, buckets_[i].bits_, sizeof(uint64_t));
+        std::memcpy(&bucket, BucketBits(i), sizeof(uint64_t));
         const uint64_t flag{bucket & kFlagBitsMask};
 
         switch (flag)
@@ -666,7 +902,7 @@ class SingleTable<12> : public BaseSingleTable<12>
             return;
         }
         case kOneSlotFlag: {
-            const uint64_t tags{_pext_u64(bucket, kTagBitsMask)};
+            const uint64_t tags{bmiutil::Pext64(bucket, kTagBitsMask)};
 #define HELPER(tag_length)                                     \
     if (*max_tag_length >= tag_length)                         \
     {                                                          \
@@ -687,7 +923,7 @@ class SingleTable<12> : public BaseSingleTable<12>
             return;
         }
         case kTwoSlotFlag: {
-            const uint64_t tags{_pext_u64(bucket, kTagBitsMask)};
+            const uint64_t tags{bmiutil::Pext64(bucket, kTagBitsMask)};
 #define HELPER(tag_length)                                     \
     if (*max_tag_length >= tag_length)                         \
     {                                                          \
@@ -707,7 +943,7 @@ class SingleTable<12> : public BaseSingleTable<12>
             return;
         }
         case kThreeSlotFlag: {
-            const uint64_t tags{_pext_u64(bucket, kTagBitsMask)};
+            const uint64_t tags{bmiutil::Pext64(bucket, kTagBitsMask)};
 #define HELPER(tag_length)                                     \
     if (*max_tag_length >= tag_length)                         \
     {                                                          \
@@ -749,7 +985,7 @@ class SingleTable<12> : public BaseSingleTable<12>
     void DeleteTagFromBucket(uint64_t bucket_idx, const uint64_t masked_tag)
     {
         uint64_t bucket;
-        std::memcpy(&bucket, buckets_[bucket_idx].bits_, sizeof(uint64_t));
+        std::memcpy(&bucket, BucketBits(bucket_idx), sizeof(uint64_t));
         const uint64_t flag{bucket & kFlagBitsMask};
 
         switch (flag)
@@ -763,20 +999,20 @@ class SingleTable<12> : public BaseSingleTable<12>
         case kOneSlotFlag: {
             bucket &= 0xffff000000000000;
             bucket |= kZeroSlotFlag;
-            std::memcpy(buckets_[bucket_idx].bits_, &bucket, sizeof(uint64_t));
+            std::memcpy(BucketBits(bucket_idx), &bucket, sizeof(uint64_t));
             return;
         }
         case kTwoSlotFlag: {
             uint64_t masks[]{0xffff3ff7ff400000, 0xffff0000003fffff};
-            const uint64_t tags{_pext_u64(bucket, kTagBitsMask)};
+            const uint64_t tags{bmiutil::Pext64(bucket, kTagBitsMask)};
             for (uint32_t slot_idx = 0; slot_idx < 2; ++slot_idx)
             {
                 if (BucketTag<kTwoSlotTagLen>(tags, slot_idx) == masked_tag)
                 {
-                    bucket = _pdep_u64(_pext_u64(bucket, masks[slot_idx]),
+                    bucket = bmiutil::Pdep64(bmiutil::Pext64(bucket, masks[slot_idx]),
                                        0xffff0000003fffff) |
                              kOneSlotFlag;
-                    std::memcpy(buckets_[bucket_idx].bits_, &bucket, sizeof(uint64_t));
+                    std::memcpy(BucketBits(bucket_idx), &bucket, sizeof(uint64_t));
                     return;
                 }
             }
@@ -786,15 +1022,15 @@ class SingleTable<12> : public BaseSingleTable<12>
         case kThreeSlotFlag: {
             uint64_t masks[]{0xffff7ff7ff7f8000, 0xffff7ff780007fff,
                              0xffff00007f7fffff};
-            const uint64_t tags{_pext_u64(bucket, kTagBitsMask)};
+            const uint64_t tags{bmiutil::Pext64(bucket, kTagBitsMask)};
             for (uint32_t slot_idx = 0; slot_idx < 3; ++slot_idx)
             {
                 if (BucketTag<kThreeSlotTagLen>(tags, slot_idx) == masked_tag)
                 {
-                    bucket = _pdep_u64(_pext_u64(bucket, masks[slot_idx]),
+                    bucket = bmiutil::Pdep64(bmiutil::Pext64(bucket, masks[slot_idx]),
                                        0xffff0077ff407fff) |
                              kTwoSlotFlag;
-                    std::memcpy(buckets_[bucket_idx].bits_, &bucket, sizeof(uint64_t));
+                    std::memcpy(BucketBits(bucket_idx), &bucket, sizeof(uint64_t));
                     return;
                 }
             }
@@ -808,10 +1044,10 @@ class SingleTable<12> : public BaseSingleTable<12>
             {
                 if (BucketTag<kFourSlotTagLen>(bucket, slot_idx) == masked_tag)
                 {
-                    bucket = _pdep_u64(_pext_u64(bucket, masks[slot_idx]),
+                    bucket = bmiutil::Pdep64(bmiutil::Pext64(bucket, masks[slot_idx]),
                                        0xffff0ff78f7f8fff) |
                              kThreeSlotFlag;
-                    std::memcpy(buckets_[bucket_idx].bits_, &bucket, sizeof(uint64_t));
+                    std::memcpy(BucketBits(bucket_idx), &bucket, sizeof(uint64_t));
                     return;
                 }
             }
@@ -826,7 +1062,7 @@ class SingleTable<12> : public BaseSingleTable<12>
         for (uint64_t i = 0; i < num_buckets_; ++i)
         {
             uint64_t bucket;
-            std::memcpy(&bucket, buckets_[i].bits_, sizeof(uint64_t));
+            std::memcpy(&bucket, BucketBits(i), sizeof(uint64_t));
             const uint64_t flag{bucket & kFlagBitsMask};
             switch (flag)
             {
@@ -854,7 +1090,65 @@ class SingleTable<12> : public BaseSingleTable<12>
         }
     }
 
+    // Read the tags of bucket `i` if it holds four tags, for cuckoo path search
+    bool ReadFourSlotTags(const uint64_t i, uint64_t *tags) const
+    {
+        uint64_t bucket;
+        std::memcpy(&bucket, BucketBits(i), sizeof(uint64_t));
+        switch (bucket & kFlagBitsMask)
+        {
+        case kZeroSlotFlag:
+        case kOneSlotFlag:
+        case kTwoSlotFlag:
+        case kThreeSlotFlag: {
+            return false;
+        }
+        default: {
+            for (uint64_t r = 0; r < kTagsPerBucket; ++r)
+            {
+                tags[r] = BucketTag<kFourSlotTagLen>(bucket, r);
+            }
+            return true;
+        }
+        }
+    }
+
   private:
+    constexpr static uint64_t kLineBytes = 64;
+
+    static uint64_t NumLines(uint64_t num_buckets)
+    {
+        return (num_buckets + kBucketsPerLine - 1) / kBucketsPerLine;
+    }
+
+    static uint64_t NumAllocatedBuckets(uint64_t num_buckets)
+    {
+        if constexpr (kBucketsPerLine == 0)
+        {
+            return num_buckets + kPaddingBuckets;
+        }
+        else
+        {
+            return (NumLines(num_buckets) * kLineBytes + kBytesPerBucket - 1) /
+                   kBytesPerBucket;
+        }
+    }
+
+    inline char *BucketBits(uint64_t i) const
+    {
+        if constexpr (kBucketsPerLine == 0)
+        {
+            return buckets_[i].bits_;
+        }
+        else
+        {
+            return lines_ + (i / kBucketsPerLine) * kLineBytes +
+                   (i % kBucketsPerLine) * kBytesPerBucket;
+        }
+    }
+
+    char *lines_;
+
     constexpr static uint64_t kFlagBitsMask = 0x0000800800800000;
     constexpr static uint64_t kTagBitsMask = 0x00007ff7ff7fffff;
 
@@ -869,6 +1163,22 @@ class SingleTable<12> : public BaseSingleTable<12>
     constexpr static uint32_t kThreeSlotTagLen = 15;
 };
 
+template <>
+class SingleTable<12> : public SingleTable12Impl<0>
+{
+  public:
+    explicit SingleTable(uint64_t num_buckets,
+                         const memutil::AllocOptions &options = {})
+        : SingleTable12Impl(num_buckets, options)
+    {
+    }
+
+    SingleTable(uint64_t num_buckets, memutil::UniquePtr<char> data)
+        : SingleTable12Impl(num_buckets, std::move(data))
+    {
+    }
+};
+
 #undef haszero45
 #undef hasvalue45
 #undef haszero22
@@ -890,8 +1200,9 @@ template <>
 class SingleTable<16> : public BaseSingleTable<16>
 {
   public:
-    explicit SingleTable(uint64_t num_buckets)
-        : BaseSingleTable(num_buckets)
+    explicit SingleTable(uint64_t num_buckets,
+                         const memutil::AllocOptions &options = {})
+        : BaseSingleTable(num_buckets, options)
     {
         static_assert(kBytesPerBucket == 8, "ctor only work on this case");
         char *p{reinterpret_cast<char *>(buckets_.get())};
@@ -903,6 +1214,23 @@ class SingleTable<16> : public BaseSingleTable<16>
         }
     }
 
+    SingleTable(uint64_t num_buckets, memutil::UniquePtr<char> data)
+        : BaseSingleTable(num_buckets, std::move(data))
+    {
+    }
+
+    // FindTagInBucket on both buckets, see FindTagInBucketPair
+    bool FindTagInBuckets(const uint64_t i1, const uint64_t i2,
+                          const uint64_t unmasked_tag) const
+    {
+        uint64_t bucket1, bucket2;
+        std::memcpy(&bucket1, buckets_[i1].bits_, sizeof(uint64_t));
+        std::memcpy(&bucket2, buckets_[i2].bits_, sizeof(uint64_t));
+        return FindTagInBucketPair<kOneSlotTagLen, kTwoSlotTagLen, kThreeSlotTagLen,
+                                   kFlagBitsMask, kTagBitsMask>(bucket1, bucket2,
+                                                                unmasked_tag);
+    }
+
     bool FindTagInBucket(const uint64_t i, const uint64_t unmasked_tag) const
     {
         uint64_t bucket;
@@ -915,20 +1243,20 @@ class SingleTable<16> : public BaseSingleTable<16>
             return false;
         }
         case kOneSlotFlag: {
-            const uint64_t tags{_pext_u64(bucket, kTagBitsMask)};
+            const uint64_t tags{bmiutil::Pext64(bucket, kTagBitsMask)};
             return hasvalue61(tags, MaskedTag<kOneSlotTagLen>(unmasked_tag)) ||
                    hasvalue61(tags, MaskedTag<kTwoSlotTagLen>(unmasked_tag)) ||
                    hasvalue61(tags, MaskedTag<kThreeSlotTagLen>(unmasked_tag)) ||
                    hasvalue61(tags, MaskedTag<kFourSlotTagLen>(unmasked_tag));
         }
         case kTwoSlotFlag: {
-            const uint64_t tags{_pext_u64(bucket, kTagBitsMask)};
+            const uint64_t tags{bmiutil::Pext64(bucket, kTagBitsMask)};
             return hasvalue30(tags, MaskedTag<kTwoSlotTagLen>(unmasked_tag)) ||
                    hasvalue30(tags, MaskedTag<kThreeSlotTagLen>(unmasked_tag)) ||
                    hasvalue30(tags, MaskedTag<kFourSlotTagLen>(unmasked_tag));
         }
         case kThreeSlotFlag: {
-            const uint64_t tags{_pext_u64(bucket, kTagBitsMask)};
+            const uint64_t tags{bmiutil::Pext64(bucket, kTagBitsMask)};
             return hasvalue20(tags, MaskedTag<kThreeSlotTagLen>(unmasked_tag)) ||
                    hasvalue20(tags, MaskedTag<kFourSlotTagLen>(unmasked_tag));
         }
@@ -945,8 +1273,11 @@ class SingleTable<16> : public BaseSingleTable<16>
         }
     }
 
+    // With `kickout`, a full bucket replaces the tag of slot `random` %
+    // kTagsPerBucket, which is returned in `oldtag`
     inline bool InsertTagToBucket(const uint64_t i, const uint64_t tag,
-                                  const bool kickout, uint64_t &oldtag)
+                                  const bool kickout, const uint64_t random,
+                                  uint64_t &oldtag)
     {
         uint64_t bucket;
         std::memcpy(&bucket, buckets_[i].bits_, sizeof(uint64_t));
@@ -955,29 +1286,29 @@ class SingleTable<16> : public BaseSingleTable<16>
         switch (flag)
         {
         case kZeroSlotFlag: {
-            bucket = _pdep_u64(tag, kTagBitsMask) | kOneSlotFlag;
+            bucket = bmiutil::Pdep64(tag, kTagBitsMask) | kOneSlotFlag;
             std::memcpy(buckets_[i].bits_, &bucket, sizeof(uint64_t));
             return true;
         }
         case kOneSlotFlag: {
             uint64_t tags{
-                _pext_u64(bucket, 0x000000003fffffff)}; // get one 30bit tags
+                bmiutil::Pext64(bucket, 0x000000003fffffff)}; // get one 30bit tags
             tags |= MaskedTag<kTwoSlotTagLen>(tag) << kTwoSlotTagLen;
-            tags = _pdep_u64(tags, kTagBitsMask) | kTwoSlotFlag;
+            tags = bmiutil::Pdep64(tags, kTagBitsMask) | kTwoSlotFlag;
             std::memcpy(buckets_[i].bits_, &tags, sizeof(uint64_t));
             return true;
         }
         case kTwoSlotFlag: {
             uint64_t tags{
-                _pext_u64(bucket, 0x000f7fff400fffff)}; // get two 20bit tags
+                bmiutil::Pext64(bucket, 0x000f7fff400fffff)}; // get two 20bit tags
             tags |= MaskedTag<kThreeSlotTagLen>(tag) << (2 * kThreeSlotTagLen);
-            tags = _pdep_u64(tags, kTagBitsMask) | kThreeSlotFlag;
+            tags = bmiutil::Pdep64(tags, kTagBitsMask) | kThreeSlotFlag;
             std::memcpy(buckets_[i].bits_, &tags, sizeof(uint64_t));
             return true;
         }
         case kThreeSlotFlag: {
             uint64_t tags{
-                _pext_u64(bucket, 0x03ff7e1f7ff0ffff)}; // get three 16bit tags
+                bmiutil::Pext64(bucket, 0x03ff7e1f7ff0ffff)}; // get three 16bit tags
             tags |= MaskedTag<kFourSlotTagLen>(tag) << (3 * kFourSlotTagLen);
             uint64_t tag3{BucketTag<3, kFourSlotTagLen>(tags)},
                 tag2{BucketTag<2, kFourSlotTagLen>(tags)},
@@ -1012,7 +1343,7 @@ class SingleTable<16> : public BaseSingleTable<16>
             {
                 static_assert(kFourSlotTagLen == 16,
                               "can not access bucket as uint16_t array");
-                uint64_t r{rand() % kTagsPerBucket};
+                uint64_t r{random % kTagsPerBucket};
                 oldtag = BucketTag<kFourSlotTagLen>(bucket, r);
                 char *p = reinterpret_cast<char *>(&bucket) + r * 2;
 
@@ -1065,7 +1396,7 @@ class SingleTable<16> : public BaseSingleTable<16>
             return;
         }
         case kOneSlotFlag: {
-            const uint64_t tags{_pext_u64(bucket, kTagBitsMask)};
+            const uint64_t tags{bmiutil::Pext64(bucket, kTagBitsMask)};
 #define HELPER(tag_length)                                     \
     if (*max_tag_length >= tag_length)                         \
     {                                                          \
@@ -1086,7 +1417,7 @@ class SingleTable<16> : public BaseSingleTable<16>
             return;
         }
         case kTwoSlotFlag: {
-            const uint64_t tags{_pext_u64(bucket, kTagBitsMask)};
+            const uint64_t tags{bmiutil::Pext64(bucket, kTagBitsMask)};
 #define HELPER(tag_length)                                     \
     if (*max_tag_length >= tag_length)                         \
     {                                                          \
@@ -1106,7 +1437,7 @@ class SingleTable<16> : public BaseSingleTable<16>
             return;
         }
         case kThreeSlotFlag: {
-            const uint64_t tags{_pext_u64(bucket, kTagBitsMask)};
+            const uint64_t tags{bmiutil::Pext64(bucket, kTagBitsMask)};
 #define HELPER(tag_length)                                     \
     if (*max_tag_length >= tag_length)                         \
     {                                                          \
@@ -1166,14 +1497,14 @@ class SingleTable<16> : public BaseSingleTable<16>
         }
         case kTwoSlotFlag: {
             uint64_t masks[]{0x3fff7fff40000000, 0x000000003fffffff};
-            const uint64_t tags{_pext_u64(bucket, kTagBitsMask)};
+            const uint64_t tags{bmiutil::Pext64(bucket, kTagBitsMask)};
             for (uint32_t slot_idx = 0; slot_idx < 2; ++slot_idx)
             {
                 if (BucketTag<kTwoSlotTagLen>(tags, slot_idx) == masked_tag)
                 {
-                    bucket =
-                        _pdep_u64(_pext_u64(bucket, masks[slot_idx]), kTagBitsMask) |
-                        kOneSlotFlag;
+                    bucket = bmiutil::Pdep64(bmiutil::Pext64(bucket, masks[slot_idx]),
+                                             kTagBitsMask) |
+                             kOneSlotFlag;
                     std::memcpy(buckets_[bucket_idx].bits_, &bucket, sizeof(uint64_t));
                     return;
                 }
@@ -1184,12 +1515,12 @@ class SingleTable<16> : public BaseSingleTable<16>
         case kThreeSlotFlag: {
             uint64_t masks[]{0x3fff7fff7ff00000, 0x3fff7e00000fffff,
                              0x000001ff7fffffff};
-            const uint64_t tags{_pext_u64(bucket, kTagBitsMask)};
+            const uint64_t tags{bmiutil::Pext64(bucket, kTagBitsMask)};
             for (uint32_t slot_idx = 0; slot_idx < 3; ++slot_idx)
             {
                 if (BucketTag<kThreeSlotTagLen>(tags, slot_idx) == masked_tag)
                 {
-                    bucket = _pdep_u64(_pext_u64(bucket, masks[slot_idx]),
+                    bucket = bmiutil::Pdep64(bmiutil::Pext64(bucket, masks[slot_idx]),
                                        0x000f7fff400fffff) |
                              kTwoSlotFlag;
                     std::memcpy(buckets_[bucket_idx].bits_, &bucket, sizeof(uint64_t));
@@ -1206,7 +1537,7 @@ class SingleTable<16> : public BaseSingleTable<16>
             {
                 if (BucketTag<kFourSlotTagLen>(bucket, slot_idx) == masked_tag)
                 {
-                    bucket = _pdep_u64(_pext_u64(bucket, masks[slot_idx]),
+                    bucket = bmiutil::Pdep64(bmiutil::Pext64(bucket, masks[slot_idx]),
                                        0x03ff7e1f7ff0ffff) |
                              kThreeSlotFlag;
                     std::memcpy(buckets_[bucket_idx].bits_, &bucket, sizeof(uint64_t));
@@ -1232,6 +1563,29 @@ class SingleTable<16> : public BaseSingleTable<16>
         return true;
     }
 
+    // Read the tags of bucket `i` if it holds four tags, for cuckoo path search
+    bool ReadFourSlotTags(const uint64_t i, uint64_t *tags) const
+    {
+        uint64_t bucket;
+        std::memcpy(&bucket, buckets_[i].bits_, sizeof(uint64_t));
+        switch (bucket & kFlagBitsMask)
+        {
+        case kZeroSlotFlag:
+        case kOneSlotFlag:
+        case kTwoSlotFlag:
+        case kThreeSlotFlag: {
+            return false;
+        }
+        default: {
+            for (uint64_t r = 0; r < kTagsPerBucket; ++r)
+            {
+                tags[r] = BucketTag<kFourSlotTagLen>(bucket, r);
+            }
+            return true;
+        }
+        }
+    }
+
   private:
     constexpr static uint64_t kFlagBitsMask = 0x8000800080000000;
     constexpr static uint64_t kTagBitsMask = ~kFlagBitsMask;
@@ -1254,6 +1608,42 @@ class SingleTable<16> : public BaseSingleTable<16>
 #undef haszero20
 #undef hasvalue20
 
+// SingleTable whose buckets never straddle two cache lines, so that a probe
+// takes one miss. 8- and 16-bit buckets already tile a line; 12-bit buckets are
+// grouped 10 per line with 4 spare bytes, which costs 1/15 more space (64 bytes
+// for 60).
+template <size_t bits_per_tag>
+class AlignedSingleTable : public SingleTable<bits_per_tag>
+{
+  public:
+    explicit AlignedSingleTable(uint64_t num_buckets,
+                                const memutil::AllocOptions &options = {})
+        : SingleTable<bits_per_tag>(num_buckets, options)
+    {
+    }
+
+    AlignedSingleTable(uint64_t num_buckets, memutil::UniquePtr<char> data)
+        : SingleTable<bits_per_tag>(num_buckets, std::move(data))
+    {
+    }
+};
+
+template <>
+class AlignedSingleTable<12> : public SingleTable12Impl<10>
+{
+  public:
+    explicit AlignedSingleTable(uint64_t num_buckets,
+                                const memutil::AllocOptions &options = {})
+        : SingleTable12Impl(num_buckets, options)
+    {
+    }
+
+    AlignedSingleTable(uint64_t num_buckets, memutil::UniquePtr<char> data)
+        : SingleTable12Impl(num_buckets, std::move(data))
+    {
+    }
+};
+
 }
 
 #endif
@@ -1,17 +1,31 @@
 #ifndef VECF_H_
 #define VECF_H_
 
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <string_view>
+
 #include "hashutil.h"
+#include "memutil.h"
+#include "serialize.h"
 #include "vecf/singletable.h"
 
 namespace vecf
 {
 // maximum number of cuckoo kicks before claiming failure
 const size_t kMaxCuckooCount = 500;
+// number of keys hashed and prefetched ahead of probing in LookupBatch
+const size_t kLookupBatchSize = 32;
 
+// With kSingleHash, the index and the tag of a key both come from one
+// evaluation of the hash family instead of two, as for pre-hashed keys (see
+// IndexTagFromHash). This halves the hashing cost for the same false positive
+// rate as long as the family returns 64 well mixed bits.
 template <typename ItemType, size_t bits_per_item,
           template <size_t> class TableType = SingleTable,
-          typename HashFamily = hashutil::TwoIndependentMultiplyShift>
+          typename HashFamily = hashutil::TwoIndependentMultiplyShift,
+          bool kSingleHash = false>
 class VECF
 {
   private:
@@ -30,6 +44,35 @@ class VECF
 
     HashFamily hasher_one_, hasher_two_;
 
+    // SplitMix64 state drawing the slots of cuckoo kickouts, per filter so
+    // that inserts share no lock and the same seed replays the same kickouts
+    uint64_t kick_state_;
+
+    // state saved along with the table
+    struct Meta
+    {
+        uint64_t num_buckets;
+        uint64_t num_items;
+        VictimCache victim;
+        HashFamily hasher_one, hasher_two;
+        uint64_t kick_state;
+    };
+
+    // keys map to other buckets and tags in single-hash mode, so its files
+    // cannot be loaded by a two-hash filter and vice versa
+    constexpr static serialize::FilterKind kFilterKind{
+        kSingleHash ? serialize::FilterKind::kVECFSingleHash : serialize::FilterKind::kVECF};
+
+    VECF(const Meta &meta, memutil::UniquePtr<char> data)
+        : table_(new TableType<bits_per_item>(meta.num_buckets, std::move(data))),
+          num_items_(meta.num_items),
+          victim_(meta.victim),
+          hasher_one_(meta.hasher_one),
+          hasher_two_(meta.hasher_two),
+          kick_state_(meta.kick_state)
+    {
+    }
+
     inline uint64_t IndexHash(uint64_t hv) const
     {
         return hv & (table_->NumBuckets() - 1);
@@ -50,15 +93,48 @@ class VECF
     inline void GenerateIndexTagHash(const ItemType &item, uint64_t *index,
                                      uint64_t *unmasked_tag) const
     {
-        *index = IndexHash(hasher_one_(item));
-        *unmasked_tag = TagHash(hasher_two_(item));
+        if constexpr (kSingleHash)
+        {
+            IndexTagFromHash(hasher_one_(item), index, unmasked_tag);
+        }
+        else
+        {
+            *index = IndexHash(hasher_one_(item));
+            *unmasked_tag = TagHash(hasher_two_(item));
+        }
+    }
+
+    // Index from the low bits of a pre-hashed key, tag from the bits above
+    // them, so that no tag bit repeats an index bit. Keys sharing a bucket then
+    // differ in all bits of their one-slot tags that the hash can supply.
+    inline void IndexTagFromHash(uint64_t hash, uint64_t *index,
+                                 uint64_t *unmasked_tag) const
+    {
+        *index = IndexHash(hash);
+        *unmasked_tag = TagHash(hash >> __builtin_ctzll(table_->NumBuckets()));
     }
 
+    bool InsertIndexTag(const uint64_t i, const uint64_t unmasked_tag);
+
+    bool LookupIndexTag(const uint64_t i1, const uint64_t unmasked_tag) const;
+
+    bool DeleteIndexTag(const uint64_t i1, const uint64_t unmasked_tag);
+
     bool InsertImpl(const uint64_t i, const uint64_t unmasked_tag);
 
-  public:
-    explicit VECF(const size_t max_num_keys)
-        : num_items_(0), victim_(), hasher_one_(), hasher_two_()
+    bool LookupImpl(const uint64_t i1, const uint64_t i2,
+                    const uint64_t unmasked_tag) const;
+
+    // Look up n keys, index_tag_of(j, &index, &unmasked_tag) gives those of
+    // key j
+    template <typename IndexTagOf, typename Emit>
+    void LookupBatchImpl(size_t n, IndexTagOf &&index_tag_of, Emit &&emit) const;
+
+    VECF(const size_t max_num_keys, const HashFamily &hasher_one,
+         const HashFamily &hasher_two, uint64_t kick_seed,
+         const memutil::AllocOptions &options)
+        : num_items_(0), victim_(), hasher_one_(hasher_one), hasher_two_(hasher_two),
+          kick_state_(kick_seed)
     {
         size_t assoc = 4;
         size_t num_buckets =
@@ -69,7 +145,23 @@ class VECF
             num_buckets <<= 1;
         }
         victim_.used = false;
-        table_ = new TableType<bits_per_item>(num_buckets);
+        table_ = new TableType<bits_per_item>(num_buckets, options);
+    }
+
+  public:
+    // Hash functions and kickouts are seeded randomly
+    explicit VECF(const size_t max_num_keys,
+                  const memutil::AllocOptions &options = {})
+        : VECF(max_num_keys, HashFamily(), HashFamily(), hashutil::RandomSeed(), options)
+    {
+    }
+
+    // Filters built with the same seed hash keys identically, and end up with
+    // the same table after the same sequence of operations
+    VECF(const size_t max_num_keys, uint64_t seed,
+         const memutil::AllocOptions &options = {})
+        : VECF(max_num_keys, HashFamily(seed), HashFamily(~seed), seed, options)
+    {
     }
 
     ~VECF()
@@ -81,8 +173,53 @@ class VECF
 
     bool Lookup(const ItemType &item) const;
 
+    // Look up `n` keys. Keys are hashed and both candidate buckets of each key
+    // are prefetched a window at a time before any bucket is probed, so the
+    // cache misses of the window overlap instead of forming a serial chain.
+    void LookupBatch(const ItemType *keys, size_t n, bool *out) const;
+
+    // Same as above, but the result of keys[i] is bit (i % 64) of out[i / 64].
+    // `out` must hold (n + 63) / 64 words.
+    void LookupBatch(const ItemType *keys, size_t n, uint64_t *out) const;
+
     bool Delete(const ItemType &item);
 
+    // Pre-hashed keys, see hashutil.h: low bits pick the bucket, the bits above the tag
+    bool InsertHash(uint64_t hash);
+
+    bool LookupHash(uint64_t hash) const;
+
+    bool DeleteHash(uint64_t hash);
+
+    bool Insert(std::string_view key)
+    {
+        return InsertHash(hasher_one_(hashutil::HashBytes(key)));
+    }
+
+    bool Lookup(std::string_view key) const
+    {
+        return LookupHash(hasher_one_(hashutil::HashBytes(key)));
+    }
+
+    bool Delete(std::string_view key)
+    {
+        return DeleteHash(hasher_one_(hashutil::HashBytes(key)));
+    }
+
+    // Look up `n` byte string keys, folded 4 at a time by HashBytesBatch
+    void LookupBatch(const std::string_view *keys, size_t n, bool *out) const
+    {
+        hashutil::ForEachHashedChunk(
+            keys, n, [this, out](const uint64_t *hashes, size_t base, size_t m) {
+                LookupBatchImpl(
+                    m,
+                    [this, hashes](size_t i, uint64_t *index, uint64_t *unmasked_tag) {
+                        IndexTagFromHash(hasher_one_(hashes[i]), index, unmasked_tag);
+                    },
+                    [out, base](size_t i, bool found) { out[base + i] = found; });
+            });
+    }
+
     size_t GetItemNum() const
     {
         return num_items_;
@@ -107,11 +244,58 @@ class VECF
     {
         table_->BucketCountStat(counter);
     }
+
+    // Save the filter to `path`, return false on I/O errors
+    bool Save(const std::string &path) const;
+
+    // Load a filter written by Save(). The table is mapped from the file
+    // instead of being read, so that loading takes constant time and lookups
+    // are served from the page cache. Return nullptr if the file cannot be
+    // loaded.
+    static std::unique_ptr<VECF> Load(const std::string &path);
 };
 
 template <typename ItemType, size_t bits_per_item,
-          template <size_t> class TableType, typename HashFamily>
-bool VECF<ItemType, bits_per_item, TableType, HashFamily>::InsertImpl(
+          template <size_t> class TableType, typename HashFamily,
+          bool kSingleHash>
+bool VECF<ItemType, bits_per_item, TableType, HashFamily, kSingleHash>::Save(
+    const std::string &path) const
+{
+    Meta meta{};
+    meta.num_buckets = table_->NumBuckets();
+    meta.num_items = num_items_;
+    meta.victim = victim_;
+    meta.hasher_one = hasher_one_;
+    meta.hasher_two = hasher_two_;
+    meta.kick_state = kick_state_;
+    return serialize::Save(
+        path, kFilterKind, bits_per_item, meta, table_->Data(),
+        TableType<bits_per_item>::AllocatedBytes(table_->NumBuckets()));
+}
+
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily,
+          bool kSingleHash>
+std::unique_ptr<VECF<ItemType, bits_per_item, TableType, HashFamily, kSingleHash>>
+VECF<ItemType, bits_per_item, TableType, HashFamily, kSingleHash>::Load(const std::string &path)
+{
+    Meta meta;
+    memutil::UniquePtr<char> data;
+    uint64_t table_bytes;
+    if (!serialize::Load(path, kFilterKind, bits_per_item, &meta,
+                         &data, &table_bytes) ||
+        meta.num_buckets == 0 || (meta.num_buckets & (meta.num_buckets - 1)) != 0 ||
+        table_bytes != TableType<bits_per_item>::AllocatedBytes(meta.num_buckets))
+    {
+        return nullptr;
+    }
+    return std::unique_ptr<VECF>(new VECF(meta, std::move(data)));
+}
+
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily,
+          bool kSingleHash>
+bool VECF<ItemType, bits_per_item, TableType, HashFamily, kSingleHash>::InsertImpl(
     const uint64_t i, const uint64_t unmasked_tag)
 {
     uint64_t curindex{i};
@@ -122,7 +306,9 @@ bool VECF<ItemType, bits_per_item, TableType, HashFamily>::InsertImpl(
         bool kickout{count > 0}; // if count == 0 and insert failed, try another
                                  // bucket instead of kickout
         oldtag = 0;
-        if (table_->InsertTagToBucket(curindex, curtag, kickout, oldtag))
+        if (table_->InsertTagToBucket(curindex, curtag, kickout,
+                                      kickout ? hashutil::SplitMix64(&kick_state_) : 0,
+                                      oldtag))
         {
             ++num_items_;
             return true;
@@ -142,51 +328,174 @@ bool VECF<ItemType, bits_per_item, TableType, HashFamily>::InsertImpl(
 }
 
 template <typename ItemType, size_t bits_per_item,
-          template <size_t> class TableType, typename HashFamily>
-bool VECF<ItemType, bits_per_item, TableType, HashFamily>::Insert(
-    const ItemType &item)
+          template <size_t> class TableType, typename HashFamily,
+          bool kSingleHash>
+bool VECF<ItemType, bits_per_item, TableType, HashFamily, kSingleHash>::InsertIndexTag(
+    const uint64_t i, const uint64_t unmasked_tag)
 {
-    size_t i;
-    uint64_t tag;
-
     if (victim_.used)
     {
         return false;
     }
 
+    return InsertImpl(i, unmasked_tag);
+}
+
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily,
+          bool kSingleHash>
+bool VECF<ItemType, bits_per_item, TableType, HashFamily, kSingleHash>::Insert(
+    const ItemType &item)
+{
+    uint64_t i, tag;
     GenerateIndexTagHash(item, &i, &tag);
+    return InsertIndexTag(i, tag);
+}
+
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily,
+          bool kSingleHash>
+bool VECF<ItemType, bits_per_item, TableType, HashFamily, kSingleHash>::InsertHash(
+    uint64_t hash)
+{
+    uint64_t i, tag;
+    IndexTagFromHash(hash, &i, &tag);
+    return InsertIndexTag(i, tag);
+}
 
-    return InsertImpl(i, tag);
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily,
+          bool kSingleHash>
+bool VECF<ItemType, bits_per_item, TableType, HashFamily, kSingleHash>::LookupIndexTag(
+    const uint64_t i1, const uint64_t unmasked_tag) const
+{
+    return LookupImpl(i1, AltIndex(i1, unmasked_tag), unmasked_tag);
 }
 
 template <typename ItemType, size_t bits_per_item,
-          template <size_t> class TableType, typename HashFamily>
-bool VECF<ItemType, bits_per_item, TableType, HashFamily>::Lookup(
+          template <size_t> class TableType, typename HashFamily,
+          bool kSingleHash>
+bool VECF<ItemType, bits_per_item, TableType, HashFamily, kSingleHash>::Lookup(
     const ItemType &item) const
 {
-    uint64_t i1, i2, unmasked_tag;
-
+    uint64_t i1, unmasked_tag;
     GenerateIndexTagHash(item, &i1, &unmasked_tag);
-    i2 = AltIndex(i1, unmasked_tag);
+    return LookupIndexTag(i1, unmasked_tag);
+}
 
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily,
+          bool kSingleHash>
+bool VECF<ItemType, bits_per_item, TableType, HashFamily, kSingleHash>::LookupHash(
+    uint64_t hash) const
+{
+    uint64_t i1, unmasked_tag;
+    IndexTagFromHash(hash, &i1, &unmasked_tag);
+    return LookupIndexTag(i1, unmasked_tag);
+}
+
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily,
+          bool kSingleHash>
+bool VECF<ItemType, bits_per_item, TableType, HashFamily, kSingleHash>::LookupImpl(
+    const uint64_t i1, const uint64_t i2, const uint64_t unmasked_tag) const
+{
     if (victim_.used && (victim_.index == i1 || victim_.index == i2) &&
         victim_.tag == MaskedTag<bits_per_item>(unmasked_tag))
     {
         return true;
     }
 
-    return table_->FindTagInBucket(i1, unmasked_tag) ||
-           table_->FindTagInBucket(i2, unmasked_tag);
+    return table_->FindTagInBuckets(i1, i2, unmasked_tag);
+}
+
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily,
+          bool kSingleHash>
+template <typename IndexTagOf, typename Emit>
+void VECF<ItemType, bits_per_item, TableType, HashFamily, kSingleHash>::LookupBatchImpl(
+    size_t n, IndexTagOf &&index_tag_of, Emit &&emit) const
+{
+    uint64_t i1[kLookupBatchSize], i2[kLookupBatchSize],
+        unmasked_tag[kLookupBatchSize];
+
+    for (size_t base = 0; base < n; base += kLookupBatchSize)
+    {
+        const size_t count{std::min(kLookupBatchSize, n - base)};
+        for (size_t j = 0; j < count; ++j)
+        {
+            index_tag_of(base + j, &i1[j], &unmasked_tag[j]);
+            i2[j] = AltIndex(i1[j], unmasked_tag[j]);
+            table_->PrefetchBucket(i1[j]);
+            table_->PrefetchBucket(i2[j]);
+        }
+        for (size_t j = 0; j < count; ++j)
+        {
+            emit(base + j, LookupImpl(i1[j], i2[j], unmasked_tag[j]));
+        }
+    }
+}
+
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily,
+          bool kSingleHash>
+void VECF<ItemType, bits_per_item, TableType, HashFamily, kSingleHash>::LookupBatch(
+    const ItemType *keys, size_t n, bool *out) const
+{
+    LookupBatchImpl(
+        n,
+        [this, keys](size_t i, uint64_t *index, uint64_t *unmasked_tag) {
+            GenerateIndexTagHash(keys[i], index, unmasked_tag);
+        },
+        [out](size_t i, bool found) { out[i] = found; });
+}
+
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily,
+          bool kSingleHash>
+void VECF<ItemType, bits_per_item, TableType, HashFamily, kSingleHash>::LookupBatch(
+    const ItemType *keys, size_t n, uint64_t *out) const
+{
+    std::fill(out, out + (n + 63) / 64, 0);
+    LookupBatchImpl(
+        n,
+        [this, keys](size_t i, uint64_t *index, uint64_t *unmasked_tag) {
+            GenerateIndexTagHash(keys[i], index, unmasked_tag);
+        },
+        [out](size_t i, bool found) {
+            out[i / 64] |= static_cast<uint64_t>(found) << (i % 64);
+        });
 }
 
 template <typename ItemType, size_t bits_per_item,
-          template <size_t> class TableType, typename HashFamily>
-bool VECF<ItemType, bits_per_item, TableType, HashFamily>::Delete(
+          template <size_t> class TableType, typename HashFamily,
+          bool kSingleHash>
+bool VECF<ItemType, bits_per_item, TableType, HashFamily, kSingleHash>::Delete(
     const ItemType &item)
 {
-    uint64_t i1, i2, unmasked_tag;
+    uint64_t i1, unmasked_tag;
     GenerateIndexTagHash(item, &i1, &unmasked_tag);
-    i2 = AltIndex(i1, unmasked_tag);
+    return DeleteIndexTag(i1, unmasked_tag);
+}
+
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily,
+          bool kSingleHash>
+bool VECF<ItemType, bits_per_item, TableType, HashFamily, kSingleHash>::DeleteHash(
+    uint64_t hash)
+{
+    uint64_t i1, unmasked_tag;
+    IndexTagFromHash(hash, &i1, &unmasked_tag);
+    return DeleteIndexTag(i1, unmasked_tag);
+}
+
+template <typename ItemType, size_t bits_per_item,
+          template <size_t> class TableType, typename HashFamily,
+          bool kSingleHash>
+bool VECF<ItemType, bits_per_item, TableType, HashFamily, kSingleHash>::DeleteIndexTag(
+    const uint64_t i1, const uint64_t unmasked_tag)
+{
+    const uint64_t i2{AltIndex(i1, unmasked_tag)};
 
     uint64_t max_bucket_idx{};
     uint32_t max_tag_length{};
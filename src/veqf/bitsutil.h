@@ -1,8 +1,12 @@
 #ifndef VEQF_FILTER_BITSUTIL_H_
 #define VEQF_FILTER_BITSUTIL_H_
 
+#include <immintrin.h>
+
 #include <cstdint>
 
+#include "bmiutil.h"
+
 namespace veqf
 {
 inline uint64_t upperpower2(uint64_t x)
@@ -17,6 +21,18 @@ inline uint64_t upperpower2(uint64_t x)
     x++;
     return x;
 }
+
+// Bits [0, n) set, n <= 64
+inline uint64_t bitmask(uint64_t n)
+{
+    return n >= 64 ? ~0ull : (1ull << n) - 1;
+}
+
+// Position of set bit number `rank` (from 0) of x, which has more set bits
+inline uint64_t select64(uint64_t x, uint64_t rank)
+{
+    return __builtin_ctzll(bmiutil::Pdep64(1ull << rank, x));
+}
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,514 @@
+#ifndef CONCURRENT_VEQF_H_
+#define CONCURRENT_VEQF_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+
+#include "hashutil.h"
+#include "memutil.h"
+#include "syncutil.h"
+#include "veqf/veqf.h"
+
+namespace veqf
+{
+
+// Thread-safe VEQF.
+//
+// The table is split into regions of kRegionSlots slots, each guarded by a
+// version counter used as a seqlock. Region boundaries are word aligned, so a
+// slot write never touches another region. Insert and Delete lock every region
+// from the cluster start of the quotient to the second empty slot after it,
+// which bounds the slots shifted by one operation; the range is computed
+// optimistically and checked again once its regions are locked, and extended
+// if it grew meanwhile. Operations whose range is too long, and insertions
+// close to a full table, lock all regions.
+//
+// Lookups take no lock: they remember the version of every region they read
+// and retry if any of them changed. The optimistic scan is bounded and falls
+// back to a locked lookup, so a torn read can never loop or assert.
+template <typename ItemType, uint64_t kBitsPerItem,
+          typename HashFunction = hashutil::TwoIndependentMultiplyShift>
+class ConcurrentVEQF
+{
+  public:
+    // Hash function is seeded randomly
+    ConcurrentVEQF(uint64_t max_num_keys, const memutil::AllocOptions &options = {})
+        : ConcurrentVEQF(max_num_keys, HashFunction(), options)
+    {
+    }
+
+    // Filters built with the same seed hash keys identically
+    ConcurrentVEQF(uint64_t max_num_keys, uint64_t seed,
+                   const memutil::AllocOptions &options = {})
+        : ConcurrentVEQF(max_num_keys, HashFunction(seed), options)
+    {
+    }
+
+    bool Lookup(const ItemType &key) const
+    {
+        return LookupHash(filter_.hasher_(key));
+    }
+
+    // Pre-hashed keys, with the requirements of VEQF::InsertHash
+    bool LookupHash(uint64_t hash) const
+    {
+        uint64_t quotient, remainder;
+        filter_.QuotientRemainderFromHash(hash, &quotient, &remainder);
+
+        bool found;
+        for (size_t retry = 0; retry < kMaxOptimisticRetries; ++retry)
+        {
+            if (TryLookup(quotient, remainder, &found))
+            {
+                return found;
+            }
+        }
+
+        RegionSet locked;
+        LockRangeOrAll(quotient, &locked);
+        found = filter_.LookupImpl(quotient, remainder);
+        Unlock(locked);
+        return found;
+    }
+
+    bool Insert(const ItemType &key)
+    {
+        return InsertHash(filter_.hasher_(key));
+    }
+
+    bool InsertHash(uint64_t hash)
+    {
+        uint64_t quotient, remainder;
+        filter_.QuotientRemainderFromHash(hash, &quotient, &remainder);
+
+        // Reserve the slots this insertion may use. While the occupied and
+        // reserved slots fit the table, no region can fill up and the filter
+        // never takes its full table path under a partial lock.
+        inflight_slots_.fetch_add(kMaxOccupiedSlot);
+        RegionSet locked;
+        if (LockRange(quotient, &locked))
+        {
+            if (filter_.entries_ + inflight_slots_ <= filter_.max_entries_)
+            {
+                bool ret{filter_.InsertImpl(quotient, remainder)};
+                Unlock(locked);
+                inflight_slots_.fetch_sub(kMaxOccupiedSlot);
+                return ret;
+            }
+            Unlock(locked);
+        }
+        inflight_slots_.fetch_sub(kMaxOccupiedSlot);
+
+        LockAll(&locked);
+        bool ret{filter_.InsertImpl(quotient, remainder)};
+        Unlock(locked);
+        return ret;
+    }
+
+    bool Delete(const ItemType &key)
+    {
+        return DeleteHash(filter_.hasher_(key));
+    }
+
+    bool DeleteHash(uint64_t hash)
+    {
+        uint64_t quotient, remainder;
+        filter_.QuotientRemainderFromHash(hash, &quotient, &remainder);
+
+        RegionSet locked;
+        LockRangeOrAll(quotient, &locked);
+        bool ret{filter_.DeleteImpl(quotient, remainder)};
+        Unlock(locked);
+        return ret;
+    }
+
+    bool Insert(std::string_view key)
+    {
+        return InsertHash(filter_.hasher_(hashutil::HashBytes(key)));
+    }
+
+    bool Lookup(std::string_view key) const
+    {
+        return LookupHash(filter_.hasher_(hashutil::HashBytes(key)));
+    }
+
+    bool Delete(std::string_view key)
+    {
+        return DeleteHash(filter_.hasher_(hashutil::HashBytes(key)));
+    }
+
+    // Not thread-safe, set it before concurrent operations
+    void SetInsertLargeRemainderThreshold(double threshold)
+    {
+        filter_.SetInsertLargeRemainderThreshold(threshold);
+    }
+
+    size_t Size() const
+    {
+        return filter_.Size();
+    }
+    size_t SizeInBytes() const
+    {
+        return filter_.SizeInBytes();
+    }
+    double LoadFactor() const
+    {
+        return filter_.LoadFactor();
+    }
+    double BitsPerItem() const
+    {
+        return filter_.BitsPerItem();
+    }
+
+  private:
+    using Filter = VEQF<ItemType, kBitsPerItem, HashFunction, fieldutil::PackedFields,
+                        std::atomic<uint64_t>>;
+
+    // slots per region, a multiple of 64 keeps region boundaries word aligned
+    constexpr static uint64_t kRegionSlots{4096};
+    // more regions than this in one range lock the whole table
+    constexpr static size_t kMaxRangeRegions{8};
+    // slots scanned by one range computation or optimistic lookup, which
+    // is at most half of a small table, so that a scan never wraps around
+    constexpr static uint64_t kMaxScanSlots{(kMaxRangeRegions - 1) * kRegionSlots};
+    constexpr static size_t kMaxOptimisticRetries{4};
+    constexpr static uint64_t kMaxOccupiedSlot{Filter::kMaxOccupiedSlot};
+
+    static_assert(kRegionSlots % 64 == 0, "regions must be word aligned");
+
+    struct alignas(64) Region
+    {
+        std::atomic<uint64_t> version{0};
+    };
+
+    // Regions locked by one operation, in ascending order
+    struct RegionSet
+    {
+        uint64_t ids[kMaxRangeRegions];
+        size_t num{0};
+        bool all{false};
+    };
+
+    // Regions read by an optimistic lookup, with their versions
+    class ReadSet
+    {
+      public:
+        explicit ReadSet(const ConcurrentVEQF *filter)
+            : filter_(filter)
+        {
+        }
+
+        uint64_t GetSlot(uint64_t idx)
+        {
+            const uint64_t region{idx / kRegionSlots};
+            if (std::find(ids_, ids_ + num_, region) == ids_ + num_)
+            {
+                if (num_ == kMaxRangeRegions)
+                {
+                    overflow_ = true;
+                    return 0;
+                }
+                ids_[num_] = region;
+                versions_[num_++] = filter_->ReadBegin(region);
+            }
+            return filter_->filter_.GetSlot(idx);
+        }
+
+        bool Validate() const
+        {
+            if (overflow_)
+            {
+                return false;
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            for (size_t i = 0; i < num_; ++i)
+            {
+                if (filter_->regions_[ids_[i]].version.load(
+                        std::memory_order_relaxed) != versions_[i])
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+      private:
+        const ConcurrentVEQF *filter_;
+        uint64_t ids_[kMaxRangeRegions], versions_[kMaxRangeRegions];
+        size_t num_{0};
+        bool overflow_{false};
+    };
+
+    ConcurrentVEQF(uint64_t max_num_keys, const HashFunction &hasher,
+                   const memutil::AllocOptions &options)
+        : filter_(max_num_keys, hasher, options),
+          num_regions_((filter_.max_entries_ + kRegionSlots - 1) / kRegionSlots),
+          regions_(new Region[num_regions_]),
+          max_scan_slots_(std::min(kMaxScanSlots, filter_.max_entries_ / 2)),
+          inflight_slots_(0)
+    {
+    }
+
+    void LockRegion(uint64_t region) const
+    {
+        std::atomic<uint64_t> &version{regions_[region].version};
+        uint64_t v{version.load(std::memory_order_relaxed)};
+        size_t spins{0};
+        while ((v & 1) ||
+               !version.compare_exchange_weak(v, v + 1, std::memory_order_acquire,
+                                              std::memory_order_relaxed))
+        {
+            syncutil::Backoff(&spins);
+            v = version.load(std::memory_order_relaxed);
+        }
+        // the odd version must be visible before any slot write
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    void UnlockRegion(uint64_t region) const
+    {
+        regions_[region].version.fetch_add(1, std::memory_order_release);
+    }
+
+    // Wait until `region` is unlocked and return its version
+    uint64_t ReadBegin(uint64_t region) const
+    {
+        uint64_t v;
+        size_t spins{0};
+        while ((v = regions_[region].version.load(std::memory_order_acquire)) & 1)
+        {
+            syncutil::Backoff(&spins);
+        }
+        return v;
+    }
+
+    void LockAll(RegionSet *locked) const
+    {
+        for (uint64_t r = 0; r < num_regions_; ++r)
+        {
+            LockRegion(r);
+        }
+        locked->all = true;
+    }
+
+    void Unlock(RegionSet &locked) const
+    {
+        if (locked.all)
+        {
+            for (uint64_t r = 0; r < num_regions_; ++r)
+            {
+                UnlockRegion(r);
+            }
+        }
+        else
+        {
+            for (size_t i = 0; i < locked.num; ++i)
+            {
+                UnlockRegion(locked.ids[i]);
+            }
+        }
+        locked.num = 0;
+        locked.all = false;
+    }
+
+    // The slots an insertion or deletion at `quotient` may read or write: from
+    // the cluster start to the slot after the second empty slot, as shifting
+    // a two slot remainder consumes at most two empty slots. Return false if
+    // the range is longer than `max_scan_slots_`.
+    bool ComputeRange(uint64_t quotient, uint64_t *start, uint64_t *len) const
+    {
+        uint64_t steps{0}, begin{quotient};
+        for (uint64_t slot{filter_.GetSlot(begin)};
+             filter_.IsShifted(slot) || filter_.IsContinuation(slot);
+             slot = filter_.GetSlot(begin))
+        {
+            begin = filter_.DecrIdx(begin);
+            if (++steps > max_scan_slots_)
+            {
+                return false;
+            }
+        }
+
+        uint64_t end{quotient}, empties{0};
+        while (!(filter_.IsEmpty(filter_.GetSlot(end)) &&
+                 ++empties == kMaxOccupiedSlot))
+        {
+            end = filter_.IncrIdx(end, 1);
+            if (++steps > max_scan_slots_)
+            {
+                return false;
+            }
+        }
+
+        *start = begin;
+        *len = ((filter_.IncrIdx(end, 1) - begin) & filter_.index_mask_) + 1;
+        return true;
+    }
+
+    // Sorted, unique regions of `len` slots from `start`, false if too many
+    bool CollectRegions(uint64_t start, uint64_t len, RegionSet *regions) const
+    {
+        regions->num = 0;
+        uint64_t idx{start};
+        while (len > 0)
+        {
+            if (regions->num == kMaxRangeRegions)
+            {
+                return false;
+            }
+            regions->ids[regions->num++] = idx / kRegionSlots;
+            const uint64_t step{std::min(len, kRegionSlots - idx % kRegionSlots)};
+            idx = filter_.IncrIdx(idx, step);
+            len -= step;
+        }
+        std::sort(regions->ids, regions->ids + regions->num);
+        regions->num =
+            std::unique(regions->ids, regions->ids + regions->num) - regions->ids;
+        return true;
+    }
+
+    // Lock the regions an operation on `quotient` may touch. Return false,
+    // holding no lock, if the range is too long for a partial lock.
+    bool LockRange(uint64_t quotient, RegionSet *locked) const
+    {
+        uint64_t start, len;
+        RegionSet wanted;
+        // the range is read without locks, so it may be inconsistent
+        if (!ComputeRange(quotient, &start, &len) ||
+            !CollectRegions(start, len, &wanted))
+        {
+            return false;
+        }
+        for (;;)
+        {
+            for (size_t i = 0; i < wanted.num; ++i)
+            {
+                LockRegion(wanted.ids[i]);
+            }
+            *locked = wanted;
+
+            if (!ComputeRange(quotient, &start, &len) ||
+                !CollectRegions(start, len, &wanted))
+            {
+                Unlock(*locked);
+                return false;
+            }
+            if (std::includes(locked->ids, locked->ids + locked->num, wanted.ids,
+                              wanted.ids + wanted.num))
+            {
+                return true;
+            }
+            // the range grew before it was locked, lock the new one instead
+            Unlock(*locked);
+        }
+    }
+
+    void LockRangeOrAll(uint64_t quotient, RegionSet *locked) const
+    {
+        if (!LockRange(quotient, locked))
+        {
+            LockAll(locked);
+        }
+    }
+
+    // Lookup without locks. Return false if the scan saw a concurrent write or
+    // ran too long, otherwise the result is in `found`.
+    bool TryLookup(uint64_t quotient, uint64_t remainder, bool *found) const
+    {
+        ReadSet reads(this);
+        uint64_t steps{0};
+        *found = false;
+
+        if (!filter_.IsOccupied(reads.GetSlot(quotient)))
+        {
+            return reads.Validate();
+        }
+
+        // same as VEQF::FindRunStart, but bounded
+        uint64_t cluster_start{quotient};
+        for (uint64_t slot{reads.GetSlot(cluster_start)};
+             filter_.IsShifted(slot) || filter_.IsContinuation(slot);
+             slot = reads.GetSlot(cluster_start))
+        {
+            cluster_start = filter_.DecrIdx(cluster_start);
+            if (++steps > max_scan_slots_)
+            {
+                return false;
+            }
+        }
+        uint64_t run_idx{cluster_start};
+        while (cluster_start != quotient)
+        {
+            do
+            {
+                run_idx = filter_.IncrIdx(run_idx, 1);
+                if (++steps > max_scan_slots_)
+                {
+                    return false;
+                }
+            } while (filter_.IsContinuation(reads.GetSlot(run_idx)));
+
+            do
+            {
+                cluster_start = filter_.IncrIdx(cluster_start, 1);
+                if (++steps > max_scan_slots_)
+                {
+                    return false;
+                }
+            } while (!filter_.IsOccupied(reads.GetSlot(cluster_start)));
+        }
+
+        // same as VEQF::LookupImpl, without the assertions of GetRemainder
+        uint64_t cur_slot{reads.GetSlot(run_idx)},
+            one_slot_remainder{remainder & filter_.one_slot_mask_},
+            two_slots_first_remainder{(remainder & Filter::LowMask(kBitsPerItem - 1)) |
+                                      Filter::kRemainderHighestBit},
+            max_remainder{std::max(one_slot_remainder, two_slots_first_remainder)};
+        do
+        {
+            uint64_t partial_remainder{filter_.GetPartialRemainder(cur_slot)},
+                full_remainder{partial_remainder}, step{1};
+            uint64_t next_slot{reads.GetSlot(filter_.IncrIdx(run_idx, 1))};
+            if (!filter_.IsEmpty(next_slot) && !filter_.IsRunStart(next_slot) &&
+                filter_.GetPartialRemainder(next_slot) < partial_remainder)
+            {
+                full_remainder &= Filter::LowMask(kBitsPerItem - 1);
+                full_remainder |= filter_.GetPartialRemainder(next_slot)
+                                  << (kBitsPerItem - 1);
+                step = 2;
+            }
+            if ((step == 1 && partial_remainder == one_slot_remainder) ||
+                (step == 2 && full_remainder == remainder))
+            {
+                *found = true;
+                break;
+            }
+            else if (partial_remainder > max_remainder)
+            {
+                break;
+            }
+            run_idx = filter_.IncrIdx(run_idx, step);
+            cur_slot = reads.GetSlot(run_idx);
+            if (++steps > max_scan_slots_)
+            {
+                return false;
+            }
+        } while (filter_.IsContinuation(cur_slot));
+
+        return reads.Validate();
+    }
+
+    Filter filter_;
+    const uint64_t num_regions_;
+    std::unique_ptr<Region[]> regions_;
+    const uint64_t max_scan_slots_;
+    // slots reserved by insertions holding a partial lock
+    std::atomic<uint64_t> inflight_slots_;
+};
+
+}
+
+#endif
@@ -1,52 +1,397 @@
 #ifndef VEQF_H_
 #define VEQF_H_
 
+#include <immintrin.h>
+
+#include <algorithm>
 #include <cassert>
 #include <cstdint>
 #include <cstring>
 #include <memory>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
 
+#include "fieldutil.h"
 #include "hashutil.h"
+#include "memutil.h"
+#include "serialize.h"
 #include "veqf/bitsutil.h"
 
 namespace veqf
 {
 
-// A remainder may use 1 or 2 slots.
+// A remainder may use 1 or 2 slots. The table can be doubled in place of a
+// rebuild, see Expand().
+// `Storage` lays out the remainders of a block of slots: fieldutil::PackedFields
+// wastes no bits, fieldutil::AlignedFields keeps every remainder within one word
+// for a few more bits per slot.
+// `CounterType` holds the slot and item counters, ConcurrentVEQF uses an atomic
+// type so that operations on different regions can update them concurrently.
 template <typename ItemType, uint64_t kBitsPerItem,
-          typename HashFunction = hashutil::TwoIndependentMultiplyShift>
+          typename HashFunction = hashutil::TwoIndependentMultiplyShift,
+          template <uint64_t> class Storage = fieldutil::PackedFields,
+          typename CounterType = uint64_t>
 class VEQF
 {
+    template <typename, uint64_t, typename> friend class ConcurrentVEQF;
+    // checks LookupImpl and FindRunStart against their slot at a time
+    // counterparts in the tests
+    friend struct TestAccess;
+
   public:
-    VEQF(uint64_t max_num_keys)
-        : qbits_(__builtin_ctzl(upperpower2(max_num_keys))),
+    // Hash function is seeded randomly
+    VEQF(uint64_t max_num_keys, const memutil::AllocOptions &options = {})
+        : VEQF(max_num_keys, HashFunction(), options)
+    {
+    }
+
+    // Filters built with the same seed hash keys identically
+    VEQF(uint64_t max_num_keys, uint64_t seed, const memutil::AllocOptions &options = {})
+        : VEQF(max_num_keys, HashFunction(seed), options)
+    {
+    }
+
+    bool Lookup(const ItemType &key) const
+    {
+        uint64_t quotient, remainder;
+        GenerateQuotientRemainder(key, &quotient, &remainder);
+        return LookupImpl(quotient, remainder);
+    }
+
+    // Look up `n` keys. Quotients of a window of keys are computed and their
+    // home slots prefetched before any run is scanned, so the cache misses of
+    // the window overlap.
+    void LookupBatch(const ItemType *keys, size_t n, bool *out) const
+    {
+        LookupBatchImpl(
+            n, [this, keys](size_t i) { return hasher_(keys[i]); },
+            [out](size_t i, bool found) { out[i] = found; });
+    }
+
+    // Same as above, but the result of keys[i] is bit (i % 64) of out[i / 64].
+    // `out` must hold (n + 63) / 64 words.
+    void LookupBatch(const ItemType *keys, size_t n, uint64_t *out) const
+    {
+        std::fill(out, out + (n + 63) / 64, 0);
+        LookupBatchImpl(
+            n, [this, keys](size_t i) { return hasher_(keys[i]); },
+            [out](size_t i, bool found) {
+                out[i / 64] |= static_cast<uint64_t>(found) << (i % 64);
+            });
+    }
+
+    // Insert `n` keys. Each window is prefetched and sorted by quotient, so
+    // keys landing in the same or neighbouring clusters are inserted back to
+    // back. `out[i]` is the return value of Insert(keys[i]), whatever order
+    // the keys are inserted in. Return how many keys are inserted.
+    size_t InsertBatch(const ItemType *keys, size_t n, bool *out)
+    {
+        struct Entry
+        {
+            uint64_t quotient, remainder;
+            size_t key;
+        } entries[kBatchSize];
+        size_t inserted{0};
+        for (size_t base = 0; base < n; base += kBatchSize)
+        {
+            const size_t count{std::min<size_t>(kBatchSize, n - base)};
+            // quotients change on expansion, so the window must fit first
+            ExpandIfNeeded(count * kMaxOccupiedSlot);
+            for (size_t j = 0; j < count; ++j)
+            {
+                GenerateQuotientRemainder(keys[base + j], &entries[j].quotient,
+                                          &entries[j].remainder);
+                entries[j].key = base + j;
+                PrefetchSlot(entries[j].quotient);
+            }
+            std::sort(entries, entries + count, [](const Entry &a, const Entry &b) {
+                return std::tie(a.quotient, a.remainder) < std::tie(b.quotient, b.remainder);
+            });
+            for (size_t j = 0; j < count; ++j)
+            {
+                out[entries[j].key] = InsertImpl(entries[j].quotient, entries[j].remainder);
+                inserted += out[entries[j].key];
+            }
+        }
+        return inserted;
+    }
+
+    bool Insert(const ItemType &key)
+    {
+        ExpandIfNeeded(kMaxOccupiedSlot);
+        uint64_t quotient, remainder;
+        GenerateQuotientRemainder(key, &quotient, &remainder);
+        return InsertImpl(quotient, remainder);
+    }
+
+    bool Delete(const ItemType &key)
+    {
+        uint64_t quotient, remainder;
+        GenerateQuotientRemainder(key, &quotient, &remainder);
+        return DeleteImpl(quotient, remainder);
+    }
+
+    // Pre-hashed keys, see hashutil.h: remainder from the low bits, quotient from the rest
+    bool InsertHash(uint64_t hash)
+    {
+        ExpandIfNeeded(kMaxOccupiedSlot);
+        uint64_t quotient, remainder;
+        QuotientRemainderFromHash(hash, &quotient, &remainder);
+        return InsertImpl(quotient, remainder);
+    }
+
+    bool LookupHash(uint64_t hash) const
+    {
+        uint64_t quotient, remainder;
+        QuotientRemainderFromHash(hash, &quotient, &remainder);
+        return LookupImpl(quotient, remainder);
+    }
+
+    bool DeleteHash(uint64_t hash)
+    {
+        uint64_t quotient, remainder;
+        QuotientRemainderFromHash(hash, &quotient, &remainder);
+        return DeleteImpl(quotient, remainder);
+    }
+
+    bool Insert(std::string_view key)
+    {
+        return InsertHash(hasher_(hashutil::HashBytes(key)));
+    }
+
+    bool Lookup(std::string_view key) const
+    {
+        return LookupHash(hasher_(hashutil::HashBytes(key)));
+    }
+
+    bool Delete(std::string_view key)
+    {
+        return DeleteHash(hasher_(hashutil::HashBytes(key)));
+    }
+
+    // Look up `n` byte string keys, folded 4 at a time by HashBytesBatch
+    void LookupBatch(const std::string_view *keys, size_t n, bool *out) const
+    {
+        hashutil::ForEachHashedChunk(
+            keys, n, [this, out](const uint64_t *hashes, size_t base, size_t m) {
+                LookupBatchImpl(
+                    m, [this, hashes](size_t i) { return hasher_(hashes[i]); },
+                    [out, base](size_t i, bool found) { out[base + i] = found; });
+            });
+    }
+
+    void SetInsertLargeRemainderThreshold(double threshold)
+    {
+        insert_large_remainder_threshold_ = threshold;
+    }
+
+    // Expand() before an insert would take the load factor above `threshold`,
+    // so that inserts keep succeeding while expansions remain. 0, the
+    // default, disables it.
+    void SetAutoExpandThreshold(double threshold)
+    {
+        auto_expand_threshold_ = threshold;
+    }
+
+    // Double the table without the keys, by moving one remainder bit into the
+    // quotient: entries are streamed out of the table in run order and
+    // inserted into one of twice the size, two slot remainders as two slot
+    // remainders. A one slot remainder only holds the low bits of the
+    // remainder, so the bit is taken from those, and one slot remainders, old
+    // and new, are compared on one bit less after each expansion. Return false
+    // once kMaxExpansions are done.
+    bool Expand()
+    {
+        if (expansions_ == kMaxExpansions)
+        {
+            return false;
+        }
+        VEQF expanded(qbits_ + 1, expansions_ + 1, hasher_, options_);
+        expanded.insert_large_remainder_threshold_ = insert_large_remainder_threshold_;
+        expanded.auto_expand_threshold_ = auto_expand_threshold_;
+        // the bit of the remainder which becomes the low bit of the quotient
+        const uint64_t stolen_bit{kBitsPerItem - expansions_ - 1};
+        ForEachEntry([&expanded, stolen_bit](uint64_t quotient, uint64_t remainder,
+                                            uint64_t slot_count) {
+            expanded.InsertImpl(
+                quotient << 1 | ((remainder >> stolen_bit) & 1),
+                (remainder & LowMask(stolen_bit)) | (remainder >> (stolen_bit + 1)) << stolen_bit,
+                slot_count);
+        });
+        std::swap(qbits_, expanded.qbits_);
+        std::swap(index_mask_, expanded.index_mask_);
+        std::swap(max_entries_, expanded.max_entries_);
+        std::swap(table_size_, expanded.table_size_);
+        std::swap(table_, expanded.table_);
+        std::swap(expansions_, expanded.expansions_);
+        std::swap(one_slot_mask_, expanded.one_slot_mask_);
+        entries_ = static_cast<uint64_t>(expanded.entries_);
+        items_ = static_cast<uint64_t>(expanded.items_);
+        return true;
+    }
+
+    size_t NumExpansions() const
+    {
+        return expansions_;
+    }
+
+    size_t Size() const
+    {
+        return items_;
+    }
+    size_t SizeInBytes() const
+    {
+        return table_size_ * sizeof(uint64_t);
+    }
+    double LoadFactor() const
+    {
+        return 1.0 * entries_ / max_entries_;
+    }
+    double BitsPerItem() const
+    {
+        return 8.0 * SizeInBytes() / Size();
+    }
+
+    // Save the filter to `path`, return false on I/O errors
+    bool Save(const std::string &path) const
+    {
+        Meta meta{};
+        meta.qbits = qbits_;
+        meta.expansions = expansions_;
+        meta.entries = entries_;
+        meta.items = items_;
+        meta.insert_large_remainder_threshold = insert_large_remainder_threshold_;
+        meta.auto_expand_threshold = auto_expand_threshold_;
+        meta.hasher = hasher_;
+        return serialize::Save(path, kFilterKind, kBitsPerItem, meta,
+                               table_.get(), table_size_ * sizeof(uint64_t));
+    }
+
+    // Load a filter written by Save(). The table is mapped from the file
+    // instead of being read, so that loading takes constant time and lookups
+    // are served from the page cache. Return nullptr if the file cannot be
+    // loaded.
+    static std::unique_ptr<VEQF> Load(const std::string &path)
+    {
+        Meta meta;
+        memutil::UniquePtr<char> data;
+        uint64_t table_bytes;
+        if (!serialize::Load(path, kFilterKind, kBitsPerItem, &meta,
+                             &data, &table_bytes) ||
+            meta.qbits >= 64 || meta.expansions > kMaxExpansions ||
+            table_bytes != CalcTableSize(meta.qbits) * sizeof(uint64_t))
+        {
+            return nullptr;
+        }
+        return std::unique_ptr<VEQF>(new VEQF(meta, std::move(data)));
+    }
+
+  private:
+    // state saved along with the table
+    struct Meta
+    {
+        uint64_t qbits;
+        uint64_t expansions;
+        uint64_t entries;
+        uint64_t items;
+        double insert_large_remainder_threshold;
+        double auto_expand_threshold;
+        HashFunction hasher;
+    };
+
+    VEQF(uint64_t max_num_keys, const HashFunction &hasher,
+         const memutil::AllocOptions &options)
+        : VEQF(__builtin_ctzl(upperpower2(max_num_keys)), 0, hasher, options)
+    {
+    }
+
+    VEQF(uint8_t qbits, uint8_t expansions, const HashFunction &hasher,
+         const memutil::AllocOptions &options)
+        : qbits_(qbits),
+          expansions_(expansions),
           index_mask_(LowMask(qbits_)),
+          one_slot_mask_(LowMask(kBitsPerItem - expansions_)),
           entries_(0),
           max_entries_(1ull << qbits_),
           items_(0),
           table_size_(CalcTableSize(qbits_)),
-          table_(new uint64_t[table_size_])
+          hasher_(hasher),
+          table_(memutil::Allocate<uint64_t>(table_size_, options)),
+          options_(options)
     {
-        memset(table_.get(), 0, sizeof(uint64_t) * table_size_);
     }
 
-    bool Lookup(const ItemType &key) const
+    VEQF(const Meta &meta, memutil::UniquePtr<char> data)
+        : qbits_(meta.qbits),
+          expansions_(meta.expansions),
+          index_mask_(LowMask(qbits_)),
+          one_slot_mask_(LowMask(kBitsPerItem - expansions_)),
+          entries_(meta.entries),
+          max_entries_(1ull << qbits_),
+          items_(meta.items),
+          table_size_(CalcTableSize(qbits_)),
+          hasher_(meta.hasher),
+          table_(reinterpret_cast<uint64_t *>(data.release()), data.get_deleter()),
+          insert_large_remainder_threshold_(meta.insert_large_remainder_threshold),
+          auto_expand_threshold_(meta.auto_expand_threshold)
     {
-        uint64_t quotient, remainder;
-        GenerateQuotientRemainder(key, &quotient, &remainder);
+    }
 
+    // Look up the keys whose hashes are hash_of(0), ..., hash_of(n - 1)
+    template <typename HashOf, typename Emit>
+    void LookupBatchImpl(size_t n, HashOf &&hash_of, Emit &&emit) const
+    {
+        uint64_t quotient[kBatchSize], remainder[kBatchSize];
+        for (size_t base = 0; base < n; base += kBatchSize)
+        {
+            const size_t count{std::min<size_t>(kBatchSize, n - base)};
+            for (size_t j = 0; j < count; ++j)
+            {
+                QuotientRemainderFromHash(hash_of(base + j), &quotient[j], &remainder[j]);
+                PrefetchSlot(quotient[j]);
+            }
+            for (size_t j = 0; j < count; ++j)
+            {
+                emit(base + j, LookupImpl(quotient[j], remainder[j]));
+            }
+        }
+    }
+
+    // Without `kUseWindows`, the slots of the run are scanned one at a time
+    template <bool kUseWindows = true>
+    bool LookupImpl(uint64_t quotient, uint64_t remainder) const
+    {
         if (!IsOccupied(GetSlot(quotient)))
         {
             return false;
         }
 
         uint64_t run_idx{FindRunStart(quotient)}, cur_slot{GetSlot(run_idx)},
-            one_slot_remainder{remainder & LowMask(kBitsPerItem)},
+            one_slot_remainder{remainder & one_slot_mask_},
             two_slots_first_remainder{(remainder & LowMask(kBitsPerItem - 1)) |
                                       kRemainderHighestBit},
             max_remainder{std::max(one_slot_remainder, two_slots_first_remainder)};
         do
         {
+#if defined(__AVX2__)
+            // a window must not leave the block, the last slots of one are
+            // scanned one at a time
+            if (kUseWindows && kScanWindows && run_idx % kBlockSlots + kScanSlots <= kBlockSlots &&
+                run_idx + kScanSlots <= max_entries_)
+            {
+                const int found{
+                    ScanWindow(&run_idx, remainder, one_slot_remainder, max_remainder)};
+                if (found >= 0)
+                {
+                    return found;
+                }
+                cur_slot = GetSlot(run_idx);
+                continue;
+            }
+#endif
             uint64_t partial_remainder{GetPartialRemainder(cur_slot)}, full_remainder;
             uint64_t step(GetRemainder(run_idx, cur_slot, &full_remainder));
             if ((step == 1 && partial_remainder == one_slot_remainder) ||
@@ -65,16 +410,126 @@ class VEQF
         return false;
     }
 
-    bool Insert(const ItemType &key)
+#if defined(__AVX2__)
+    // Bitmaps over the lanes of a window, of the slots whose partial remainder
+    // equals the one slot remainder (one), whose low kBitsPerItem - 1 bits
+    // equal those of the remainder (low), which equals the bits of the
+    // remainder above those (high), which exceeds the largest partial
+    // remainder the key could have (above), and which is less than that of the
+    // slot before it (descending)
+    struct WindowMasks
+    {
+        uint64_t one, low, high, above, descending;
+    };
+
+#if defined(__AVX512F__)
+    // The gather, shift and permute take their masked forms over all lanes,
+    // as the plain ones pass an undefined vector for the masked off lanes,
+    // which GCC reports as uninitialized
+    WindowMasks DecodeWindow(const uint64_t *block, uint64_t offset, uint64_t remainder,
+                             uint64_t one_slot_remainder, uint64_t max_remainder) const
+    {
+        constexpr __mmask16 kAllLanes{0xffff};
+        const __m512i bytes{_mm512_loadu_si512(&kLaneOffsets.byte[offset])},
+            shifts{_mm512_loadu_si512(&kLaneOffsets.shift[offset])};
+        const __m512i partial{_mm512_and_si512(
+            _mm512_maskz_srlv_epi32(kAllLanes,
+                                    _mm512_mask_i32gather_epi32(_mm512_setzero_si512(),
+                                                                kAllLanes, bytes,
+                                                                block + kMetadataBits, 1),
+                                    shifts),
+            _mm512_set1_epi32(LowMask(kBitsPerItem)))};
+        const __m512i prev{_mm512_maskz_permutexvar_epi32(
+            kAllLanes,
+            _mm512_setr_epi32(0, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14), partial)};
+        return {_mm512_cmpeq_epi32_mask(partial, _mm512_set1_epi32(one_slot_remainder)),
+                _mm512_cmpeq_epi32_mask(
+                    _mm512_and_si512(partial, _mm512_set1_epi32(LowMask(kBitsPerItem - 1))),
+                    _mm512_set1_epi32(remainder & LowMask(kBitsPerItem - 1))),
+                _mm512_cmpeq_epi32_mask(partial,
+                                        _mm512_set1_epi32(remainder >> (kBitsPerItem - 1))),
+                _mm512_cmpgt_epi32_mask(partial, _mm512_set1_epi32(max_remainder)),
+                _mm512_cmpgt_epi32_mask(prev, partial)};
+    }
+#else
+    WindowMasks DecodeWindow(const uint64_t *block, uint64_t offset, uint64_t remainder,
+                             uint64_t one_slot_remainder, uint64_t max_remainder) const
+    {
+        const __m256i bytes{_mm256_loadu_si256(
+            reinterpret_cast<const __m256i *>(&kLaneOffsets.byte[offset]))},
+            shifts{_mm256_loadu_si256(
+                reinterpret_cast<const __m256i *>(&kLaneOffsets.shift[offset]))};
+        const __m256i partial{_mm256_and_si256(
+            _mm256_srlv_epi32(
+                _mm256_i32gather_epi32(reinterpret_cast<const int *>(block + kMetadataBits),
+                                       bytes, 1),
+                shifts),
+            _mm256_set1_epi32(LowMask(kBitsPerItem)))};
+        const __m256i prev{_mm256_permutevar8x32_epi32(
+            partial, _mm256_setr_epi32(0, 0, 1, 2, 3, 4, 5, 6))};
+        const auto lanes = [](__m256i m) -> uint64_t {
+            return _mm256_movemask_ps(_mm256_castsi256_ps(m));
+        };
+        return {lanes(_mm256_cmpeq_epi32(partial, _mm256_set1_epi32(one_slot_remainder))),
+                lanes(_mm256_cmpeq_epi32(
+                    _mm256_and_si256(partial, _mm256_set1_epi32(LowMask(kBitsPerItem - 1))),
+                    _mm256_set1_epi32(remainder & LowMask(kBitsPerItem - 1)))),
+                lanes(_mm256_cmpeq_epi32(partial,
+                                         _mm256_set1_epi32(remainder >> (kBitsPerItem - 1)))),
+                lanes(_mm256_cmpgt_epi32(partial, _mm256_set1_epi32(max_remainder))),
+                lanes(_mm256_cmpgt_epi32(prev, partial))};
+    }
+#endif
+
+    // The steps of LookupImpl over the kScanSlots slots from `*idx`, the first
+    // slot of an entry of the run, which lie in one block. The entries of a run
+    // are in ascending order of their first partial remainder, and the second
+    // slot of a remainder is a continuation below its first, so the second
+    // slots are the descending continuations. An entry is decided by the
+    // window if the slot after it is in it too. Return 1 if the remainder is
+    // found, 0 if the run ends or passes it, or -1 with `*idx` moved to the
+    // first undecided entry.
+    int ScanWindow(uint64_t *idx, uint64_t remainder, uint64_t one_slot_remainder,
+                   uint64_t max_remainder) const
+    {
+        const uint64_t block{*idx / kBlockSlots}, offset{*idx % kBlockSlots};
+        const WindowMasks masks{DecodeWindow(&table_[block * kBlockWords], offset, remainder,
+                                             one_slot_remainder, max_remainder)};
+        const uint64_t continuation{Bitmap(block, kIsContinuationMask) >> offset},
+            run_ends{~continuation & bitmask(kScanSlots) & ~1ull},
+            run_slots{run_ends == 0 ? kScanSlots : __builtin_ctzll(run_ends)},
+            second{masks.descending & continuation & ~1ull},
+            entries{~second & bitmask(std::min(run_slots, kScanSlots - 1))},
+            two_slots{second >> 1},
+            found{entries & ((masks.one & ~two_slots) |
+                             (masks.low & two_slots & (masks.high >> 1)))},
+            done{found | (entries & masks.above)};
+        if (done != 0)
+        {
+            return (found & done & -done) != 0;
+        }
+        if (run_slots < kScanSlots)
+        {
+            return 0;
+        }
+        *idx = IncrIdx(*idx, kScanSlots - 1 + ((second >> (kScanSlots - 1)) & 1));
+        return -1;
+    }
+#endif
+
+    bool InsertImpl(uint64_t quotient, uint64_t remainder)
+    {
+        return InsertImpl(quotient, remainder,
+                          IsInsertMultipleRemainder() ? kMaxOccupiedSlot : 1ul);
+    }
+
+    bool InsertImpl(uint64_t quotient, uint64_t remainder, uint64_t slot_count)
     {
         if (items_ >= max_entries_)
         {
             return false;
         }
 
-        uint64_t quotient, remainder,
-            slot_count{IsInsertMultipleRemainder() ? kMaxOccupiedSlot : 1ul};
-        GenerateQuotientRemainder(key, &quotient, &remainder);
         uint64_t quotient_entry{GetSlot(quotient)},
             to_insert_entry[]{
                 (remainder & LowMask(kBitsPerItem)) << kMetadataBits,
@@ -84,7 +539,7 @@ class VEQF
 
         if (slot_count == 1)
         {
-            to_insert_entry[0] = (remainder & LowMask(kBitsPerItem)) << kMetadataBits;
+            to_insert_entry[0] = (remainder & one_slot_mask_) << kMetadataBits;
         }
         else
         {
@@ -232,10 +687,8 @@ class VEQF
         return true;
     }
 
-    bool Delete(const ItemType &key)
+    bool DeleteImpl(uint64_t quotient, uint64_t remainder)
     {
-        uint64_t quotient, remainder;
-        GenerateQuotientRemainder(key, &quotient, &remainder);
         uint64_t quotient_entry{GetSlot(quotient)};
 
         if (!IsOccupied(quotient_entry) || entries_ == 0)
@@ -244,7 +697,7 @@ class VEQF
         }
 
         uint64_t run_idx{FindRunStart(quotient)}, cur_slot{GetSlot(run_idx)},
-            one_slot_remainder{remainder & LowMask(kBitsPerItem)},
+            one_slot_remainder{remainder & one_slot_mask_},
             two_slots_first_remainder{(remainder & LowMask(kBitsPerItem - 1)) |
                                       kRemainderHighestBit},
             max_remainder{std::max(one_slot_remainder, two_slots_first_remainder)};
@@ -318,29 +771,6 @@ class VEQF
         return true;
     }
 
-    void SetInsertLargeRemainderThreshold(double threshold)
-    {
-        insert_large_remainder_threshold_ = threshold;
-    }
-
-    size_t Size() const
-    {
-        return items_;
-    }
-    size_t SizeInBytes() const
-    {
-        return table_size_ * sizeof(uint64_t);
-    }
-    double LoadFactor() const
-    {
-        return 1.0 * entries_ / max_entries_;
-    }
-    double BitsPerItem() const
-    {
-        return 8.0 * SizeInBytes() / Size();
-    }
-
-  private:
     static constexpr inline uint64_t LowMask(uint64_t n)
     {
         return (1ull << n) - 1;
@@ -352,58 +782,131 @@ class VEQF
     constexpr static uint8_t kMetadataMask =
         kIsOccupiedMask | kIsContinuationMask | kIsShiftedMask;
     constexpr static uint8_t kMetadataBits{3};
-    constexpr static uint64_t kSlotBits{kBitsPerItem + kMetadataBits};
-    constexpr static uint64_t kSlotMask{LowMask(kSlotBits)};
     constexpr static uint64_t kMaxOccupiedSlot{2};
     constexpr static uint64_t kRemainderHighestBit{1ull << (kBitsPerItem - 1)};
+    constexpr static uint64_t kRemainderBits{kMaxOccupiedSlot * kBitsPerItem - 2};
+    // one slot remainders keep at least half of their bits
+    constexpr static uint64_t kMaxExpansions{kBitsPerItem / 2};
+    // number of keys hashed and prefetched ahead of the run scans
+    constexpr static size_t kBatchSize{32};
+    // The table is an array of blocks of kBlockSlots slots. A block starts
+    // with one bitmap word per metadata bit, in the order of the masks above,
+    // followed by the remainders of its slots, kBitsPerItem bits each laid out
+    // by Storage. GetSlot and SetSlot assemble and split slots, so that only
+    // FindRunStart depends on the layout, which it scans a bitmap word at a
+    // time.
+    constexpr static uint64_t kBlockSlots{64};
+    using Remainders = Storage<kBitsPerItem>;
+    constexpr static uint64_t kBlockWords{kMetadataBits + Remainders::Words(kBlockSlots)};
+    constexpr static serialize::FilterKind kFilterKind{
+        Remainders::kAligned ? serialize::FilterKind::kVEQFAligned
+                             : serialize::FilterKind::kVEQF};
+
+#if defined(__AVX2__)
+    // LookupImpl decodes the slots of a run kScanSlots at a time, one per
+    // 32-bit lane, see ScanWindow
+#if defined(__AVX512F__)
+    constexpr static uint64_t kScanSlots{16};
+#else
+    constexpr static uint64_t kScanSlots{8};
+#endif
+    // a remainder and the bits before it within its byte fit in a lane
+    constexpr static bool kScanWindows{kBitsPerItem + 7 <= 32};
+
+    // Lane j of a window loads the 4 bytes ending with the last byte of the
+    // remainder of slot j, at `byte` from the remainders of the block, and
+    // shifts it right by `shift`. The first bytes of a block hold its bitmaps,
+    // so these loads never leave the block.
+    struct LaneOffsets
+    {
+        int32_t byte[kBlockSlots], shift[kBlockSlots];
+    };
+
+    constexpr static LaneOffsets MakeLaneOffsets()
+    {
+        LaneOffsets lanes{};
+        for (uint64_t i = 0; i < kBlockSlots; ++i)
+        {
+            const int64_t bit{static_cast<int64_t>(Remainders::BitOf(i))},
+                byte{static_cast<int64_t>((Remainders::BitOf(i) + kBitsPerItem + 7) / 8) - 4};
+            lanes.byte[i] = static_cast<int32_t>(byte);
+            lanes.shift[i] = static_cast<int32_t>(bit - byte * 8);
+        }
+        return lanes;
+    }
+
+    constexpr static LaneOffsets kLaneOffsets{MakeLaneOffsets()};
+#endif
 
     // is_continuation, is_shifted = 1, 0 => remainder in multiple slots
 
     static inline uint64_t CalcTableSize(uint64_t qbits)
     {
-        uint64_t total_bits{(1ull << qbits) * kSlotBits};
-        return (total_bits + 63) / 64;
+        return ((1ull << qbits) + kBlockSlots - 1) / kBlockSlots * kBlockWords;
+    }
+
+    // The remainder is the low kRemainderBits bits of the hash and the
+    // quotient the bits above it. Each expansion moves the highest bit a one
+    // slot remainder holds, below bit kBitsPerItem, into the low end of the
+    // quotient.
+    inline void QuotientRemainderFromHash(uint64_t hash, uint64_t *quotient,
+                                          uint64_t *remainder) const
+    {
+        static_assert(kMaxOccupiedSlot * kBitsPerItem < 64, "no bits for quotient");
+        const uint64_t low_bits{kBitsPerItem - expansions_};
+        *quotient = ((hash >> kRemainderBits) << expansions_ |
+                     ((hash >> low_bits) & LowMask(expansions_))) &
+                    index_mask_;
+        *remainder = (hash & LowMask(low_bits)) |
+                     ((hash >> kBitsPerItem) & LowMask(kRemainderBits - kBitsPerItem))
+                         << low_bits;
     }
 
     inline void GenerateQuotientRemainder(const ItemType &item,
                                           uint64_t *quotient,
                                           uint64_t *remainder) const
     {
-        static_assert(kMaxOccupiedSlot * kBitsPerItem < 64, "no bits for quotient");
-        const uint64_t hash = hasher_(item);
-        *quotient = (hash >> (kMaxOccupiedSlot * kBitsPerItem - 2)) & index_mask_;
-        *remainder = hash & LowMask(kMaxOccupiedSlot * kBitsPerItem - 2);
+        QuotientRemainderFromHash(hasher_(item), quotient, remainder);
     }
 
     uint64_t GetSlot(uint64_t idx) const
     {
-        uint64_t bitpos{idx * kSlotBits};
-        uint64_t tabpos{bitpos / 64}, slotpos{bitpos % 64};
-        int64_t spillbits{static_cast<int64_t>(slotpos + kSlotBits) - 64};
-        uint64_t ret{(table_[tabpos] >> slotpos) & kSlotMask};
-        if (spillbits > 0)
+        const uint64_t *block{&table_[idx / kBlockSlots * kBlockWords]};
+        const uint64_t offset{idx % kBlockSlots};
+        uint64_t ret{0};
+        for (uint64_t i = 0; i < kMetadataBits; ++i)
         {
-            ++tabpos; // Move to next 64bit, won't overflow
-            uint64_t x{table_[tabpos] & LowMask(spillbits)};
-            ret |= x << (kSlotBits - spillbits);
+            ret |= ((block[i] >> offset) & 1) << i;
         }
-        return ret;
+        // a remainder never spills out of its block
+        return ret | Remainders::Get(block + kMetadataBits, offset) << kMetadataBits;
+    }
+
+    void PrefetchSlot(uint64_t idx) const
+    {
+        const uint64_t *block{&table_[idx / kBlockSlots * kBlockWords]};
+        _mm_prefetch(reinterpret_cast<const char *>(block), _MM_HINT_T0);
+        // the remainder, and the run usually continues into the next line
+        _mm_prefetch(reinterpret_cast<const char *>(
+                         block + kMetadataBits + Remainders::WordOf(idx % kBlockSlots)),
+                     _MM_HINT_T0);
     }
 
     void SetSlot(uint64_t idx, uint64_t slot)
     {
-        uint64_t bitpos{idx * kSlotBits};
-        uint64_t tabpos{bitpos / 64}, slotpos{bitpos % 64};
-        int64_t spillbits{static_cast<int64_t>(slotpos + kSlotBits) - 64};
-        slot &= kSlotMask;
-        table_[tabpos] &= ~(kSlotMask << slotpos);
-        table_[tabpos] |= slot << slotpos;
-        if (spillbits > 0)
+        uint64_t *block{&table_[idx / kBlockSlots * kBlockWords]};
+        const uint64_t offset{idx % kBlockSlots};
+        for (uint64_t i = 0; i < kMetadataBits; ++i)
         {
-            ++tabpos; // Move to next 64bit, won't overflow
-            table_[tabpos] &= ~LowMask(spillbits);
-            table_[tabpos] |= slot >> (kSlotBits - spillbits);
+            block[i] = (block[i] & ~(1ull << offset)) | ((slot >> i) & 1) << offset;
         }
+        Remainders::Set(block + kMetadataBits, offset, slot >> kMetadataBits);
+    }
+
+    // The bitmap of metadata bit `mask` over the slots of `block`
+    uint64_t Bitmap(uint64_t block, uint8_t mask) const
+    {
+        return table_[block * kBlockWords + __builtin_ctz(mask)];
     }
 
     inline uint64_t IncrIdx(uint64_t idx, uint64_t step) const
@@ -503,32 +1006,55 @@ class VEQF
         return counter;
     }
 
+    // The runs of quotients before the cluster start, the nearest slot at or
+    // before `quotient` which is neither shifted nor a continuation, end
+    // before it, and the runs of the occupied quotients from there on start at
+    // the next slots which are not continuations, in order. So the run of
+    // `quotient` starts at the n-th such slot after the cluster start, n the
+    // number of occupied quotients after it up to `quotient`: a reverse scan,
+    // a popcount and a select, each a block at a time.
     uint64_t FindRunStart(uint64_t quotient) const
     {
-        uint64_t cluster_start{quotient};
-        // Encounter cluster start before empty
-        for (uint64_t cluster_content{GetSlot(cluster_start)};
-             IsShifted(cluster_content) || IsContinuation(cluster_content);
-             cluster_content = GetSlot(cluster_start))
+        // IsOccupied(quotient) must be true, otherwise it will be infinite loop
+        uint64_t block{quotient / kBlockSlots},
+            unshifted{~(Bitmap(block, kIsShiftedMask) | Bitmap(block, kIsContinuationMask)) &
+                      bitmask(quotient % kBlockSlots + 1)};
+        while (unshifted == 0)
         {
-            cluster_start = DecrIdx(cluster_start);
+            block = (block == 0 ? CalcTableSize(qbits_) / kBlockWords : block) - 1;
+            unshifted =
+                ~(Bitmap(block, kIsShiftedMask) | Bitmap(block, kIsContinuationMask)) &
+                bitmask(max_entries_ - block * kBlockSlots);
         }
+        const uint64_t cluster_start{block * kBlockSlots + 63 - __builtin_clzll(unshifted)};
 
-        uint64_t run_start{cluster_start};
-        // IsOccupied(quotient) must be true, otherwise it will be infinite loop
-        while (cluster_start != quotient)
+        uint64_t runs{0}, idx{IncrIdx(cluster_start, 1)},
+            left{(quotient - cluster_start) & index_mask_};
+        while (left != 0)
         {
-            do
-            {
-                run_start = IncrIdx(run_start, 1);
-            } while (IsContinuation(GetSlot(run_start)));
+            const uint64_t offset{idx % kBlockSlots},
+                count{std::min({kBlockSlots - offset, max_entries_ - idx, left})};
+            runs += _mm_popcnt_u64((Bitmap(idx / kBlockSlots, kIsOccupiedMask) >> offset) &
+                                   bitmask(count));
+            idx = IncrIdx(idx, count);
+            left -= count;
+        }
 
-            do
+        for (idx = IncrIdx(cluster_start, 1); runs != 0;)
+        {
+            const uint64_t offset{idx % kBlockSlots},
+                count{std::min(kBlockSlots - offset, max_entries_ - idx)},
+                run_starts{(~Bitmap(idx / kBlockSlots, kIsContinuationMask) >> offset) &
+                           bitmask(count)},
+                num_run_starts{static_cast<uint64_t>(_mm_popcnt_u64(run_starts))};
+            if (num_run_starts >= runs)
             {
-                cluster_start = IncrIdx(cluster_start, 1);
-            } while (!IsOccupied(GetSlot(cluster_start)));
+                return idx + select64(run_starts, runs - 1);
+            }
+            runs -= num_run_starts;
+            idx = IncrIdx(idx, count);
         }
-        return run_start;
+        return cluster_start;
     }
 
     // For entry insert
@@ -598,9 +1124,12 @@ class VEQF
                     prev = ClearOccupied(prev);
                     curr = SetOccupied(curr);
                 }
+                // curr is the first slot of prev's remainder only if nothing
+                // else is queued, which is not the case while Expand()
+                // inserts a two slot remainder
                 bool reuse_multiple_remainder{!force_disable_compaction &&
                                               !IsInsertMultipleRemainder() &&
-                                              is_multiple_remainder};
+                                              is_multiple_remainder && q.IsEmpty()};
                 if (!reuse_multiple_remainder)
                 {
                     // otherwise reuse the remainder countinuation space
@@ -608,9 +1137,10 @@ class VEQF
                 }
                 else
                 {
-                    if (GetPartialRemainder(prev) % 2 == 0)
+                    uint64_t compacted{CompactSlots(curr, prev)};
+                    if (compacted != curr)
                     {
-                        curr &= ~(1 << (kSlotBits - 1));
+                        curr = compacted;
                         need_move_backwards = true;
                     }
                     --ret;
@@ -710,13 +1240,77 @@ class VEQF
         uint64_t multiple_remainder_first_idx{
             DecrIdx(multiple_remainder_second_idx)};
         uint64_t first_slot{GetSlot(multiple_remainder_first_idx)},
-            second_slot{GetSlot(multiple_remainder_second_idx)};
-        if (GetPartialRemainder(second_slot) % 2 == 0)
+            compacted{CompactSlots(first_slot, GetSlot(multiple_remainder_second_idx))};
+        if (compacted != first_slot)
         {
             // two slots compacted to one slot, and value changed.
             // since slot value gets smaller, find new position backward.
-            first_slot &= ~(1 << (kSlotBits - 1));
-            MoveCompactedSlot(multiple_remainder_first_idx, first_slot);
+            MoveCompactedSlot(multiple_remainder_first_idx, compacted);
+        }
+    }
+
+    // The first slot of a two slot remainder, turned into the one slot
+    // remainder of the same key
+    uint64_t CompactSlots(uint64_t first_slot, uint64_t second_slot) const
+    {
+        uint64_t remainder{(GetPartialRemainder(first_slot) & LowMask(kBitsPerItem - 1)) |
+                           (GetPartialRemainder(second_slot) & 1) << (kBitsPerItem - 1)};
+        return (first_slot & kMetadataMask) | (remainder & one_slot_mask_) << kMetadataBits;
+    }
+
+    // Call op(quotient, remainder, slot count) on every entry, in run order.
+    // The walk starts at a cluster start and tracks the quotients of the runs
+    // as FindRunStart does: the n-th occupied slot of a cluster is the
+    // quotient of its n-th run.
+    template <typename Op>
+    void ForEachEntry(Op &&op) const
+    {
+        uint64_t start{0};
+        while (start < max_entries_ && !IsEmpty(GetSlot(start)) &&
+               !IsClusterStart(GetSlot(start)))
+        {
+            ++start;
+        }
+        std::vector<uint64_t> quotients; // occupied slots whose run is not reached
+        size_t next_quotient{0};
+        uint64_t quotient{0}, skip{0}, idx{start};
+        for (uint64_t i = 0; i < max_entries_; ++i, idx = IncrIdx(idx, 1))
+        {
+            uint64_t slot{GetSlot(idx)}, remainder;
+            if (IsOccupied(slot))
+            {
+                quotients.push_back(idx);
+            }
+            if (skip != 0)
+            {
+                --skip; // second slot of a two slot remainder
+                continue;
+            }
+            if (IsEmpty(slot))
+            {
+                continue;
+            }
+            if (!IsContinuation(slot))
+            {
+                quotient = quotients[next_quotient++];
+                if (next_quotient == quotients.size())
+                {
+                    quotients.clear();
+                    next_quotient = 0;
+                }
+            }
+            uint64_t step{GetRemainder(idx, slot, &remainder)};
+            op(quotient, remainder, step);
+            skip = step - 1;
+        }
+    }
+
+    // Expand until `slots` more slots fit under the auto expand threshold
+    void ExpandIfNeeded(uint64_t slots)
+    {
+        while (auto_expand_threshold_ > 0 &&
+               entries_ + slots > max_entries_ * auto_expand_threshold_ && Expand())
+        {
         }
     }
 
@@ -804,12 +1398,18 @@ class VEQF
     }
 
     uint8_t qbits_;
-    uint64_t index_mask_, entries_, // count of occupied slots
-        max_entries_, items_,       // count of inserted items
-        table_size_;
+    uint8_t expansions_; // number of Expand()
+    uint64_t index_mask_;
+    uint64_t one_slot_mask_; // remainder bits held by a one slot remainder
+    CounterType entries_; // count of occupied slots
+    uint64_t max_entries_;
+    CounterType items_; // count of inserted items
+    uint64_t table_size_;
     HashFunction hasher_;
-    std::unique_ptr<uint64_t[]> table_;
+    memutil::UniquePtr<uint64_t> table_;
+    memutil::AllocOptions options_; // of tables allocated by Expand()
     double insert_large_remainder_threshold_{0.2};
+    double auto_expand_threshold_{0};
 };
 
 }
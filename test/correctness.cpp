@@ -1,32 +1,65 @@
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <typeinfo>
+#include <vector>
 
+#include "bmiutil.h"
+#include "fieldutil.h"
+#include "hashutil.h"
+#include "memutil.h"
+#include "vecbf/blocked_vecbf.h"
+#include "vecbf/concurrent_vecbf.h"
 #include "vecbf/vecbf.h"
+#include "vecf/concurrent_vecf.h"
+#include "vecf/scalable_vecf.h"
 #include "vecf/vecf.h"
+#include "veqf/concurrent_veqf.h"
 #include "veqf/veqf.h"
 
-template <typename T>
-class VEFrameworkTest : public testing::Test
+// Fixture of the typed tests: a filter built for `initial_items` keys, into
+// which a test inserts up to `total_items` keys
+template <typename T, uint64_t kTotalItems = 1024 * 1024,
+          uint64_t kInitialItems = kTotalItems>
+class FilterTest : public testing::Test
 {
   protected:
-    VEFrameworkTest()
-        : filter_(total_items)
+    FilterTest()
+        : filter_(initial_items)
     {
     }
-    ~VEFrameworkTest() = default;
+    ~FilterTest() = default;
 
-    constexpr static uint64_t total_items = 1024 * 1024 * 7;
+    constexpr static uint64_t total_items = kTotalItems;
+    constexpr static uint64_t initial_items = kInitialItems;
+    // threads of the concurrent filter tests
+    constexpr static uint64_t num_threads = 4;
 
     T filter_;
 };
 
+template <typename T>
+using VEFrameworkTest = FilterTest<T, 1024 * 1024 * 7>;
+
 using Implementations =
     testing::Types<vecf::VECF<uint64_t, 8>, vecf::VECF<uint64_t, 12>,
-                   vecf::VECF<uint64_t, 16>, veqf::VEQF<uint64_t, 8>,
+                   vecf::VECF<uint64_t, 16>,
+                   vecf::VECF<uint64_t, 12, vecf::AlignedSingleTable>,
+                   veqf::VEQF<uint64_t, 8>,
                    veqf::VEQF<uint64_t, 10>, veqf::VEQF<uint64_t, 12>,
                    veqf::VEQF<uint64_t, 14>, veqf::VEQF<uint64_t, 16>,
-                   vecbf::VECBF<uint64_t, 8>>;
+                   veqf::VEQF<uint64_t, 10, hashutil::TwoIndependentMultiplyShift,
+                              fieldutil::AlignedFields>,
+                   vecbf::VECBF<uint64_t, 8>, vecbf::BlockedVECBF<uint64_t, 8>>;
 TYPED_TEST_SUITE(VEFrameworkTest, Implementations);
 
 TYPED_TEST(VEFrameworkTest, Correctness)
@@ -71,4 +104,1288 @@ TYPED_TEST(VEFrameworkTest, Correctness)
     {
         ASSERT_TRUE(this->filter_.Delete(i));
     }
-}
\ No newline at end of file
+}
+
+template <typename T>
+using VECFTest = FilterTest<T>;
+
+using VECFImplementations =
+    testing::Types<vecf::VECF<uint64_t, 8>, vecf::VECF<uint64_t, 12>,
+                   vecf::VECF<uint64_t, 16>,
+                   vecf::VECF<uint64_t, 12, vecf::AlignedSingleTable>>;
+TYPED_TEST_SUITE(VECFTest, VECFImplementations);
+
+TYPED_TEST(VECFTest, LookupBatch)
+{
+    uint64_t num_inserted = 0;
+    for (uint64_t i = 0; i < this->total_items; i++, num_inserted++)
+    {
+        if (!this->filter_.Insert(i))
+        {
+            break;
+        }
+    }
+
+    // Query inserted and non-existing items in one batch, the batch result must
+    // match the single key lookup for every key
+    std::vector<uint64_t> keys(2 * this->total_items);
+    std::iota(keys.begin(), keys.end(), 0);
+    std::unique_ptr<bool[]> found(new bool[keys.size()]);
+    std::vector<uint64_t> bitmap((keys.size() + 63) / 64);
+    this->filter_.LookupBatch(keys.data(), keys.size(), found.get());
+    this->filter_.LookupBatch(keys.data(), keys.size(), bitmap.data());
+
+    for (uint64_t i = 0; i < keys.size(); i++)
+    {
+        bool expected = this->filter_.Lookup(keys[i]);
+        ASSERT_EQ(found[i], expected);
+        ASSERT_EQ((bitmap[i / 64] >> (i % 64)) & 1, expected);
+        if (i < num_inserted)
+        {
+            ASSERT_TRUE(found[i]);
+        }
+    }
+}
+
+// FindTagInBuckets, which probes two buckets at once without branching on
+// their flags, must answer as FindTagInBucket on each of them does. Bucket i
+// holds i % 5 tags, and a pair is two random buckets or two neighbours, which
+// share the bytes of one load. Probes are stored tags, stored tags with one bit
+// flipped, stored tags with the bits above one of the lengths `tag_len[n]` of
+// a bucket with n tags redrawn, and random tags.
+template <typename Table>
+void CheckBucketPair(const uint32_t (&tag_len)[5])
+{
+    SCOPED_TRACE(typeid(Table).name());
+    constexpr uint64_t num_buckets = 1 << 12, probes = 1 << 20;
+    Table table(num_buckets);
+    uint64_t state = 1;
+    std::vector<std::vector<uint64_t>> tags(num_buckets);
+    for (uint64_t i = 0; i < num_buckets; i++)
+    {
+        for (uint64_t n = 0; n < i % 5; n++)
+        {
+            uint64_t old_tag;
+            tags[i].push_back(hashutil::SplitMix64(&state));
+            ASSERT_TRUE(table.InsertTagToBucket(i, tags[i].back(), false, 0, old_tag));
+        }
+    }
+
+    for (uint64_t p = 0; p < probes; p++)
+    {
+        const uint64_t i1{hashutil::SplitMix64(&state) % num_buckets},
+            i2{p % 2 == 0 ? hashutil::SplitMix64(&state) % num_buckets
+                          : (i1 + 1) % num_buckets},
+            random{hashutil::SplitMix64(&state)};
+        const auto &stored = tags[p % 4 < 2 ? i1 : i2];
+        uint64_t tag{random};
+        if (!stored.empty() && p % 5 != 0)
+        {
+            tag = stored[random % stored.size()];
+            const uint32_t len{tag_len[1 + (random >> 8) % 4]};
+            switch (p % 5)
+            {
+            case 1:
+                ASSERT_TRUE(table.FindTagInBuckets(i1, i2, tag));
+                break;
+            case 2:
+                tag ^= 1ull << ((random >> 16) % tag_len[1]);
+                break;
+            case 3:
+                tag = (tag & ((1ull << len) - 1)) | hashutil::SplitMix64(&state) << len;
+                break;
+            }
+        }
+        ASSERT_EQ(table.FindTagInBuckets(i1, i2, tag),
+                  table.FindTagInBucket(i1, tag) || table.FindTagInBucket(i2, tag))
+            << i1 << " " << i2 << " " << tag;
+    }
+}
+
+TEST(SingleTableTest, FindTagInBuckets)
+{
+    CheckBucketPair<vecf::SingleTable<8>>({0, 29, 14, 9, 8});
+    CheckBucketPair<vecf::SingleTable<12>>({0, 45, 22, 15, 12});
+    CheckBucketPair<vecf::SingleTable<16>>({0, 61, 30, 20, 16});
+    CheckBucketPair<vecf::AlignedSingleTable<12>>({0, 45, 22, 15, 12});
+}
+
+template <typename T>
+using ConcurrentVECFTest = FilterTest<T>;
+
+using ConcurrentVECFImplementations =
+    testing::Types<vecf::ConcurrentVECF<uint64_t, 8>,
+                   vecf::ConcurrentVECF<uint64_t, 12>,
+                   vecf::ConcurrentVECF<uint64_t, 16>>;
+TYPED_TEST_SUITE(ConcurrentVECFTest, ConcurrentVECFImplementations);
+
+TYPED_TEST(ConcurrentVECFTest, Correctness)
+{
+    // The table is rounded up to 2 * total_items slots. Fill up to 90% of
+    // them, so that insertions have to move tags along cuckoo paths while other
+    // threads look up their keys. Like VECF, an insertion may be refused once
+    // the victim slot is used, then the thread stops inserting.
+    const uint64_t items_per_thread =
+        2 * this->total_items * 0.9 / this->num_threads;
+    std::vector<uint64_t> num_inserted(this->num_threads);
+    std::atomic<bool> ok{true};
+    std::vector<std::thread> threads;
+    for (uint64_t t = 0; t < this->num_threads; t++)
+    {
+        threads.emplace_back([this, t, items_per_thread, &num_inserted, &ok] {
+            const uint64_t begin = t * items_per_thread;
+            for (uint64_t i = begin; i < begin + items_per_thread; i++)
+            {
+                if (!this->filter_.Insert(i))
+                {
+                    break;
+                }
+                num_inserted[t]++;
+                if (!this->filter_.Lookup(i) ||
+                    !this->filter_.Lookup(begin + (i - begin) / 2))
+                {
+                    ok = false;
+                    return;
+                }
+            }
+        });
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+    ASSERT_TRUE(ok);
+    ASSERT_EQ(this->filter_.GetItemNum(),
+              std::accumulate(num_inserted.begin(), num_inserted.end(), 0ul));
+    for (uint64_t t = 0; t < this->num_threads; t++)
+    {
+        for (uint64_t i = 0; i < num_inserted[t]; i++)
+        {
+            ASSERT_TRUE(this->filter_.Lookup(t * items_per_thread + i));
+        }
+    }
+
+    // Delete concurrently, the remaining items must stay visible
+    threads.clear();
+    for (uint64_t t = 0; t < this->num_threads; t++)
+    {
+        threads.emplace_back([this, t, items_per_thread, &num_inserted, &ok] {
+            const uint64_t begin = t * items_per_thread,
+                           end = begin + num_inserted[t];
+            for (uint64_t i = begin; i < end; i++)
+            {
+                if (!this->filter_.Delete(i) ||
+                    (i + 1 < end && !this->filter_.Lookup(end - 1)))
+                {
+                    ok = false;
+                    return;
+                }
+            }
+        });
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+    ASSERT_TRUE(ok);
+    ASSERT_EQ(this->filter_.GetItemNum(), 0);
+}
+
+namespace veqf
+{
+// Internals of VEQF checked against their slot at a time counterparts
+struct TestAccess
+{
+    // hash bits which only feed the remainder of a filter without expansions
+    template <typename F>
+    constexpr static uint64_t kRemainderBits = F::kRemainderBits;
+
+    // LookupHash scanning the run one slot at a time
+    template <typename F>
+    static bool ScalarLookupHash(const F &filter, uint64_t hash)
+    {
+        uint64_t quotient, remainder;
+        filter.QuotientRemainderFromHash(hash, &quotient, &remainder);
+        return filter.template LookupImpl<false>(quotient, remainder);
+    }
+
+    // A hash of a filter without expansions whose quotient is `quotient`
+    template <typename F>
+    static uint64_t HashOfQuotient(uint64_t quotient, uint64_t remainder_bits)
+    {
+        return quotient << F::kRemainderBits | (remainder_bits & bitmask(F::kRemainderBits));
+    }
+
+    template <typename F>
+    static uint64_t NumSlots(const F &filter)
+    {
+        return filter.max_entries_;
+    }
+
+    template <typename F>
+    static bool IsOccupied(const F &filter, uint64_t quotient)
+    {
+        return filter.IsOccupied(filter.GetSlot(quotient));
+    }
+
+    template <typename F>
+    static uint64_t FindRunStart(const F &filter, uint64_t quotient)
+    {
+        return filter.FindRunStart(quotient);
+    }
+
+    // FindRunStart a slot at a time: back to the cluster start, then on by one
+    // run per occupied quotient up to `quotient`
+    template <typename F>
+    static uint64_t ScalarFindRunStart(const F &filter, uint64_t quotient)
+    {
+        const auto in_cluster = [&filter](uint64_t idx) {
+            const uint64_t slot{filter.GetSlot(idx)};
+            return filter.IsShifted(slot) || filter.IsContinuation(slot);
+        };
+        uint64_t occupied{quotient};
+        while (in_cluster(occupied))
+        {
+            occupied = filter.DecrIdx(occupied);
+        }
+        uint64_t run_start{occupied};
+        while (occupied != quotient)
+        {
+            do
+            {
+                occupied = filter.IncrIdx(occupied, 1);
+            } while (!filter.IsOccupied(filter.GetSlot(occupied)));
+            do
+            {
+                run_start = filter.IncrIdx(run_start, 1);
+            } while (filter.IsContinuation(filter.GetSlot(run_start)));
+        }
+        return run_start;
+    }
+};
+} // namespace veqf
+
+template <typename T>
+using VEQFTest = FilterTest<T>;
+
+using VEQFImplementations =
+    testing::Types<veqf::VEQF<uint64_t, 8>, veqf::VEQF<uint64_t, 10>,
+                   veqf::VEQF<uint64_t, 12>, veqf::VEQF<uint64_t, 14>,
+                   veqf::VEQF<uint64_t, 16>,
+                   veqf::VEQF<uint64_t, 10, hashutil::TwoIndependentMultiplyShift,
+                              fieldutil::AlignedFields>,
+                   veqf::VEQF<uint64_t, 14, hashutil::TwoIndependentMultiplyShift,
+                              fieldutil::AlignedFields>>;
+TYPED_TEST_SUITE(VEQFTest, VEQFImplementations);
+
+TYPED_TEST(VEQFTest, InsertLookupBatch)
+{
+    // Insert items in batches, crossing the threshold of two slot remainders
+    const uint64_t num_inserted = this->total_items * 0.9;
+    std::vector<uint64_t> keys(2 * this->total_items);
+    std::iota(keys.begin(), keys.end(), 0);
+    std::unique_ptr<bool[]> found(new bool[keys.size()]);
+    ASSERT_EQ(this->filter_.InsertBatch(keys.data(), num_inserted, found.get()),
+              num_inserted);
+    ASSERT_TRUE(std::all_of(found.get(), found.get() + num_inserted,
+                            [](bool inserted) { return inserted; }));
+
+    std::vector<uint64_t> bitmap((keys.size() + 63) / 64);
+    this->filter_.LookupBatch(keys.data(), keys.size(), found.get());
+    this->filter_.LookupBatch(keys.data(), keys.size(), bitmap.data());
+
+    for (uint64_t i = 0; i < keys.size(); i++)
+    {
+        bool expected = this->filter_.Lookup(keys[i]);
+        ASSERT_EQ(found[i], expected);
+        ASSERT_EQ((bitmap[i / 64] >> (i % 64)) & 1, expected);
+        if (i < num_inserted)
+        {
+            ASSERT_TRUE(found[i]);
+        }
+    }
+
+    for (uint64_t i = 0; i < num_inserted; i++)
+    {
+        ASSERT_TRUE(this->filter_.Delete(keys[i]));
+    }
+
+    // A batch which does not fit reports each key: the inserted ones are the
+    // ones found, as Insert reports them
+    TypeParam small_filter(1024);
+    ASSERT_EQ(small_filter.InsertBatch(keys.data(), 2048, found.get()), 1024);
+    for (uint64_t i = 0; i < 2048; i++)
+    {
+        if (found[i])
+        {
+            ASSERT_TRUE(small_filter.Lookup(keys[i]));
+            ASSERT_TRUE(small_filter.Delete(keys[i]));
+        }
+    }
+    ASSERT_EQ(small_filter.Size(), 0);
+}
+
+TYPED_TEST(VEQFTest, Expand)
+{
+    // Grow a filter to 16 times its size, by hand and then automatically.
+    // Random keys, as runs and clusters of sequential keys are too regular.
+    const uint64_t initial_items = 1 << 16, num_inserted = 8 * initial_items;
+    std::vector<uint64_t> keys(2 * num_inserted);
+    uint64_t state = 1;
+    for (auto &key : keys)
+    {
+        key = hashutil::SplitMix64(&state);
+    }
+    TypeParam filter(initial_items, 1);
+    uint64_t i = 0;
+    // Two slot remainders only, which the expansion compacts as it reinserts
+    // them
+    filter.SetInsertLargeRemainderThreshold(1.0);
+    for (; i < initial_items / 2; i++)
+    {
+        ASSERT_TRUE(filter.Insert(keys[i]));
+    }
+    filter.SetInsertLargeRemainderThreshold(0.0);
+    ASSERT_TRUE(filter.Expand());
+    for (uint64_t j = 0; j < i; j++)
+    {
+        ASSERT_TRUE(filter.Lookup(keys[j]));
+    }
+    filter.SetInsertLargeRemainderThreshold(0.2);
+    filter.SetAutoExpandThreshold(0.9);
+    for (; i < num_inserted / 2; i++)
+    {
+        ASSERT_TRUE(filter.Insert(keys[i]));
+    }
+    std::unique_ptr<bool[]> inserted(new bool[num_inserted - i]);
+    ASSERT_EQ(filter.InsertBatch(&keys[i], num_inserted - i, inserted.get()),
+              num_inserted - i);
+    ASSERT_EQ(filter.NumExpansions(), 4);
+    ASSERT_EQ(filter.Size(), num_inserted);
+    ASSERT_LE(filter.LoadFactor(), 0.9);
+
+    uint64_t false_positives = 0;
+    for (uint64_t j = 0; j < keys.size(); j++)
+    {
+        if (j < num_inserted)
+        {
+            ASSERT_TRUE(filter.Lookup(keys[j]));
+        }
+        else
+        {
+            false_positives += filter.Lookup(keys[j]);
+        }
+    }
+    ASSERT_LT(1.0 * false_positives / num_inserted, 0.1);
+
+    // Expanded filters are saved with their expansions
+    const std::string path = testing::TempDir() + "veqf_expand_test.bin";
+    ASSERT_TRUE(filter.Save(path));
+    auto loaded = TypeParam::Load(path);
+    ASSERT_NE(loaded, nullptr);
+    ASSERT_EQ(loaded->NumExpansions(), 4);
+    for (const auto key : keys)
+    {
+        ASSERT_EQ(loaded->Lookup(key), filter.Lookup(key));
+    }
+    std::remove(path.c_str());
+
+    for (uint64_t j = 0; j < num_inserted; j++)
+    {
+        ASSERT_TRUE(filter.Delete(keys[j]));
+    }
+    ASSERT_EQ(filter.Size(), 0);
+}
+
+TYPED_TEST(VEQFTest, ScanWindow)
+{
+    // Lookups which scan runs a window of slots at a time must decide every
+    // hash as the scan of one slot at a time does: inserted ones, ones which
+    // differ from an inserted one in a single remainder bit, so they share its
+    // run and are told apart by the comparisons of the window, and random
+    // ones. Checked at high loads up to a full table, with one slot, mixed and
+    // two slot remainders, and after expansions.
+    constexpr uint64_t remainder_bits = veqf::TestAccess::kRemainderBits<TypeParam>;
+    uint64_t state = 1;
+    for (const double threshold : {0.0, 0.5, 1.0})
+    {
+        SCOPED_TRACE(threshold);
+        TypeParam filter(1 << 12, 1);
+        filter.SetInsertLargeRemainderThreshold(threshold);
+        std::vector<uint64_t> hashes;
+        for (uint64_t expansions = 0; expansions <= 2; expansions++)
+        {
+            SCOPED_TRACE(expansions);
+            if (expansions != 0)
+            {
+                ASSERT_TRUE(filter.Expand());
+            }
+            // 2 stands for a full table, which takes inserts until it holds
+            // one item per slot by turning two slot remainders into one slot
+            // ones
+            for (const double load : {0.9, 0.95, 0.99, 2.0})
+            {
+                SCOPED_TRACE(load);
+                while (filter.LoadFactor() < load)
+                {
+                    const uint64_t hash{hashutil::SplitMix64(&state)};
+                    if (!filter.InsertHash(hash))
+                    {
+                        break;
+                    }
+                    hashes.push_back(hash);
+                }
+                for (const uint64_t hash : hashes)
+                {
+                    ASSERT_TRUE(filter.LookupHash(hash));
+                    ASSERT_TRUE(veqf::TestAccess::ScalarLookupHash(filter, hash));
+                    const uint64_t near{
+                        hash ^ 1ull << (hashutil::SplitMix64(&state) % remainder_bits)},
+                        random{hashutil::SplitMix64(&state)};
+                    ASSERT_EQ(filter.LookupHash(near),
+                              veqf::TestAccess::ScalarLookupHash(filter, near));
+                    ASSERT_EQ(filter.LookupHash(random),
+                              veqf::TestAccess::ScalarLookupHash(filter, random));
+                }
+            }
+        }
+    }
+}
+
+TYPED_TEST(VEQFTest, FindRunStart)
+{
+    // The block at a time FindRunStart against the slot at a time walk, for
+    // every occupied quotient. 3 in 4 keys go to the last few quotients,
+    // so that at a load of 0.97 one cluster spans several blocks and wraps
+    // from the last block to block 0, also in tables of less than a block.
+    // Deletes then shrink the clusters, clearing shifted and continuation bits
+    // across block boundaries.
+    using Access = veqf::TestAccess;
+    const auto check = [](const TypeParam &filter, bool *wrapped, bool *spans_blocks) {
+        const uint64_t num_slots{Access::NumSlots(filter)};
+        for (uint64_t quotient = 0; quotient < num_slots; quotient++)
+        {
+            if (!Access::IsOccupied(filter, quotient))
+            {
+                continue;
+            }
+            const uint64_t run_start{Access::FindRunStart(filter, quotient)};
+            ASSERT_EQ(run_start, Access::ScalarFindRunStart(filter, quotient)) << quotient;
+            *wrapped |= run_start < quotient;
+            *spans_blocks |= ((run_start - quotient) & (num_slots - 1)) >= 64;
+        }
+    };
+    uint64_t state = 1;
+    for (const uint64_t num_slots : {16, 32, 64, 256, 1024})
+    {
+        SCOPED_TRACE(num_slots);
+        for (const double threshold : {0.0, 1.0})
+        {
+            SCOPED_TRACE(threshold);
+            TypeParam filter(num_slots, 1);
+            filter.SetInsertLargeRemainderThreshold(threshold);
+            const uint64_t hot_slots{std::max<uint64_t>(num_slots / 32, 2)};
+            std::vector<uint64_t> hashes;
+            while (filter.LoadFactor() < 0.97)
+            {
+                const uint64_t random{hashutil::SplitMix64(&state)},
+                    hash{hashes.size() % 4 != 0
+                             ? Access::HashOfQuotient<TypeParam>(
+                                   num_slots - 1 - random % hot_slots,
+                                   hashutil::SplitMix64(&state))
+                             : random};
+                if (!filter.InsertHash(hash))
+                {
+                    break;
+                }
+                hashes.push_back(hash);
+            }
+            ASSERT_GT(filter.LoadFactor(), 0.95);
+            bool wrapped = false, spans_blocks = false;
+            check(filter, &wrapped, &spans_blocks);
+            ASSERT_TRUE(wrapped);
+            ASSERT_TRUE(spans_blocks || num_slots <= 64);
+
+            // delete the keys in random order, checking every 1/16 of them
+            for (uint64_t i = 0; i < hashes.size(); i++)
+            {
+                std::swap(hashes[i],
+                          hashes[i + hashutil::SplitMix64(&state) % (hashes.size() - i)]);
+                ASSERT_TRUE(filter.DeleteHash(hashes[i]));
+                if (i % std::max<size_t>(hashes.size() / 16, 1) == 0)
+                {
+                    check(filter, &wrapped, &spans_blocks);
+                }
+            }
+            ASSERT_EQ(filter.Size(), 0);
+        }
+    }
+}
+
+template <typename T>
+using ConcurrentVEQFTest = FilterTest<T>;
+
+using ConcurrentVEQFImplementations =
+    testing::Types<veqf::ConcurrentVEQF<uint64_t, 8>,
+                   veqf::ConcurrentVEQF<uint64_t, 12>,
+                   veqf::ConcurrentVEQF<uint64_t, 16>>;
+TYPED_TEST_SUITE(ConcurrentVEQFTest, ConcurrentVEQFImplementations);
+
+TYPED_TEST(ConcurrentVEQFTest, Correctness)
+{
+    // Insert concurrently up to 90% load, crossing the threshold of two slot
+    // remainders, while looking up the inserted items
+    const uint64_t items_per_thread = this->total_items * 0.9 / this->num_threads;
+    std::atomic<bool> ok{true};
+    std::vector<std::thread> threads;
+    for (uint64_t t = 0; t < this->num_threads; t++)
+    {
+        threads.emplace_back([this, t, items_per_thread, &ok] {
+            const uint64_t begin = t * items_per_thread;
+            for (uint64_t i = begin; i < begin + items_per_thread; i++)
+            {
+                if (!this->filter_.Insert(i) || !this->filter_.Lookup(i) ||
+                    !this->filter_.Lookup(begin + (i - begin) / 2))
+                {
+                    ok = false;
+                    return;
+                }
+            }
+        });
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+    ASSERT_TRUE(ok);
+    const uint64_t num_inserted = this->num_threads * items_per_thread;
+    ASSERT_EQ(this->filter_.Size(), num_inserted);
+    for (uint64_t i = 0; i < num_inserted; i++)
+    {
+        ASSERT_TRUE(this->filter_.Lookup(i));
+    }
+
+    // Delete concurrently, the remaining items must stay visible
+    threads.clear();
+    for (uint64_t t = 0; t < this->num_threads; t++)
+    {
+        threads.emplace_back([this, t, items_per_thread, &ok] {
+            const uint64_t begin = t * items_per_thread,
+                           end = begin + items_per_thread;
+            for (uint64_t i = begin; i < end; i++)
+            {
+                if (!this->filter_.Delete(i) ||
+                    (i + 1 < end && !this->filter_.Lookup(end - 1)))
+                {
+                    ok = false;
+                    return;
+                }
+            }
+        });
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+    ASSERT_TRUE(ok);
+    ASSERT_EQ(this->filter_.Size(), 0);
+
+    // Fill a small filter beyond capacity, the last slots are taken with all
+    // regions locked
+    TypeParam small_filter(1024);
+    std::atomic<uint64_t> num_small_inserted{0};
+    threads.clear();
+    for (uint64_t t = 0; t < this->num_threads; t++)
+    {
+        threads.emplace_back([t, &small_filter, &num_small_inserted] {
+            for (uint64_t i = t * 512; i < (t + 1) * 512; i++)
+            {
+                num_small_inserted += small_filter.Insert(i);
+            }
+        });
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+    ASSERT_EQ(num_small_inserted, 1024);
+}
+
+template <typename T>
+using VECBFTest = FilterTest<T>;
+
+using VECBFImplementations =
+    testing::Types<vecbf::VECBF<uint64_t, 8>, vecbf::VECBF<uint64_t, 10>,
+                   vecbf::VECBF<uint64_t, 10, hashutil::TwoIndependentMultiplyShift,
+                                fieldutil::AlignedFields>,
+                   vecbf::BlockedVECBF<uint64_t, 8>,
+                   vecbf::BlockedVECBF<uint64_t, 10>>;
+TYPED_TEST_SUITE(VECBFTest, VECBFImplementations);
+
+TYPED_TEST(VECBFTest, Batch)
+{
+    // Insert items in batches, crossing the switch to phase 2
+    std::vector<uint64_t> keys(2 * this->total_items);
+    std::iota(keys.begin(), keys.end(), 0);
+    ASSERT_EQ(this->filter_.InsertBatch(keys.data(), this->total_items),
+              this->total_items);
+
+    std::unique_ptr<bool[]> found(new bool[keys.size()]);
+    std::vector<uint64_t> bitmap((keys.size() + 63) / 64);
+    this->filter_.LookupBatch(keys.data(), keys.size(), found.get());
+    this->filter_.LookupBatch(keys.data(), keys.size(), bitmap.data());
+
+    for (uint64_t i = 0; i < keys.size(); i++)
+    {
+        bool expected = this->filter_.Lookup(keys[i]);
+        ASSERT_EQ(found[i], expected);
+        ASSERT_EQ((bitmap[i / 64] >> (i % 64)) & 1, expected);
+        if (i < this->total_items)
+        {
+            ASSERT_TRUE(found[i]);
+        }
+    }
+
+    std::unique_ptr<bool[]> deleted(new bool[this->total_items]);
+    this->filter_.DeleteBatch(keys.data(), this->total_items, deleted.get());
+    for (uint64_t i = 0; i < this->total_items; i++)
+    {
+        ASSERT_TRUE(deleted[i]);
+    }
+    ASSERT_TRUE(this->filter_.CheckAllZero());
+}
+
+TYPED_TEST(VECBFTest, FalsePositiveRate)
+{
+    // Random keys and a fixed seed, as sequential keys make the rate depend
+    // on the seed. At 0.4 load, phase 1 probes 2k counters per key; at full
+    // load, phase 2 must stay within twice the 4% target of the filter.
+    std::vector<uint64_t> keys(2 * this->total_items);
+    uint64_t state = 1;
+    for (auto &key : keys)
+    {
+        key = hashutil::SplitMix64(&state);
+    }
+    TypeParam filter(this->total_items, 0.04, 1);
+    auto false_positive_rate = [this, &filter, &keys] {
+        uint64_t false_positives = 0;
+        for (uint64_t i = this->total_items; i < keys.size(); i++)
+        {
+            false_positives += filter.Lookup(keys[i]);
+        }
+        return 1.0 * false_positives / this->total_items;
+    };
+
+    uint64_t i = 0;
+    for (; i < this->total_items * 0.4; i++)
+    {
+        ASSERT_TRUE(filter.Insert(keys[i]));
+    }
+    ASSERT_LT(false_positive_rate(), 0.02);
+    for (; i < this->total_items; i++)
+    {
+        ASSERT_TRUE(filter.Insert(keys[i]));
+    }
+    ASSERT_LT(false_positive_rate(), 0.08);
+}
+
+template <typename T>
+using ConcurrentVECBFTest = FilterTest<T>;
+
+using ConcurrentVECBFImplementations =
+    testing::Types<vecbf::ConcurrentVECBF<uint64_t, 8>,
+                   vecbf::ConcurrentVECBF<uint64_t, 10>>;
+TYPED_TEST_SUITE(ConcurrentVECBFTest, ConcurrentVECBFImplementations);
+
+TYPED_TEST(ConcurrentVECBFTest, Correctness)
+{
+    // Insert concurrently, crossing the switch to phase 2, while looking up the
+    // inserted items
+    const uint64_t items_per_thread = this->total_items / this->num_threads;
+    std::atomic<bool> ok{true};
+    std::vector<std::thread> threads;
+    for (uint64_t t = 0; t < this->num_threads; t++)
+    {
+        threads.emplace_back([this, t, items_per_thread, &ok] {
+            const uint64_t begin = t * items_per_thread;
+            for (uint64_t i = begin; i < begin + items_per_thread; i++)
+            {
+                if (!this->filter_.Insert(i) || !this->filter_.Lookup(i) ||
+                    !this->filter_.Lookup(begin + (i - begin) / 2))
+                {
+                    ok = false;
+                    return;
+                }
+            }
+        });
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+    ASSERT_TRUE(ok);
+    ASSERT_EQ(this->filter_.Size(), this->total_items);
+    for (uint64_t i = 0; i < this->total_items; i++)
+    {
+        ASSERT_TRUE(this->filter_.Lookup(i));
+    }
+
+    // Delete concurrently, the remaining items must stay visible
+    threads.clear();
+    for (uint64_t t = 0; t < this->num_threads; t++)
+    {
+        threads.emplace_back([this, t, items_per_thread, &ok] {
+            const uint64_t begin = t * items_per_thread,
+                           end = begin + items_per_thread;
+            for (uint64_t i = begin; i < end; i++)
+            {
+                if (!this->filter_.Delete(i) ||
+                    (i + 1 < end && !this->filter_.Lookup(end - 1)))
+                {
+                    ok = false;
+                    return;
+                }
+            }
+        });
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+    ASSERT_TRUE(ok);
+    ASSERT_EQ(this->filter_.Size(), 0);
+    ASSERT_TRUE(this->filter_.CheckAllZero());
+}
+
+template <typename T>
+using ScalableVECFTest = FilterTest<T, 1024 * 1024, 1024>;
+
+using ScalableVECFImplementations =
+    testing::Types<vecf::ScalableVECF<uint64_t, 8>, vecf::ScalableVECF<uint64_t, 12>,
+                   vecf::ScalableVECF<uint64_t, 12, vecf::AlignedSingleTable>>;
+TYPED_TEST_SUITE(ScalableVECFTest, ScalableVECFImplementations);
+
+TYPED_TEST(ScalableVECFTest, Growth)
+{
+    // Inserts never fail however far the filter outgrows its initial size
+    for (uint64_t i = 0; i < this->total_items; i++)
+    {
+        ASSERT_TRUE(this->filter_.Insert(i));
+    }
+    ASSERT_EQ(this->filter_.GetItemNum(), this->total_items);
+    // Stages double, so their number is logarithmic
+    ASSERT_LE(this->filter_.NumStages(), 12);
+    for (uint64_t i = 0; i < this->total_items; i++)
+    {
+        ASSERT_TRUE(this->filter_.Lookup(i));
+    }
+
+    uint64_t false_positives = 0;
+    for (uint64_t i = this->total_items; i < 2 * this->total_items; i++)
+    {
+        false_positives += this->filter_.Lookup(i);
+    }
+    printf("Stages: %zu, false positive rate: %f, bits per item: %f\n",
+           this->filter_.NumStages(), 1.0 * false_positives / this->total_items,
+           this->filter_.BitsPerItem());
+
+    // Deletes never remove the tag of another key: keys which are not deleted
+    // are all still found. A key several stages report keeps its tag, which
+    // happens about as often as a false positive.
+    for (uint64_t i = 0; i < this->total_items; i += 2)
+    {
+        ASSERT_TRUE(this->filter_.Delete(i));
+    }
+    ASSERT_EQ(this->filter_.GetItemNum(), this->total_items / 2);
+    for (uint64_t i = 1; i < this->total_items; i += 2)
+    {
+        ASSERT_TRUE(this->filter_.Lookup(i));
+    }
+    for (uint64_t i = 1; i < this->total_items; i += 2)
+    {
+        ASSERT_TRUE(this->filter_.Delete(i));
+    }
+    ASSERT_EQ(this->filter_.GetItemNum(), 0);
+    ASSERT_LE(this->filter_.NumKeptTags(), 2 * false_positives);
+}
+
+TEST(MemUtilTest, AllocOptions)
+{
+    const memutil::AllocOptions all_options[]{
+        {},
+        {memutil::PageSize::kTransparentHuge, memutil::NumaPolicy::kDefault, 0},
+        {memutil::PageSize::kHuge2MB, memutil::NumaPolicy::kInterleave, 0},
+        {memutil::PageSize::kDefault, memutil::NumaPolicy::kBind, 1},
+    };
+    for (const auto &options : all_options)
+    {
+        // Tables are line aligned and zeroed whatever the pages are backed by
+        auto words = memutil::Allocate<uint64_t>(1000003, options);
+        ASSERT_EQ(reinterpret_cast<uintptr_t>(words.get()) % memutil::kCacheLineSize, 0);
+        for (uint64_t i = 0; i < 1000003; i++)
+        {
+            ASSERT_EQ(words[i], 0);
+        }
+
+        vecf::VECF<uint64_t, 12, vecf::AlignedSingleTable> cf(1 << 16, options);
+        veqf::VEQF<uint64_t, 12> qf(1 << 16, options);
+        vecbf::VECBF<uint64_t, 8> bf(1 << 16, 0.04, options);
+        for (uint64_t i = 0; i < (1 << 15); i++)
+        {
+            ASSERT_TRUE(cf.Insert(i));
+            ASSERT_TRUE(qf.Insert(i));
+            ASSERT_TRUE(bf.Insert(i));
+        }
+        for (uint64_t i = 0; i < (1 << 15); i++)
+        {
+            ASSERT_TRUE(cf.Lookup(i));
+            ASSERT_TRUE(qf.Lookup(i));
+            ASSERT_TRUE(bf.Lookup(i));
+        }
+    }
+}
+
+// One bit at a time, as the instructions are specified
+uint64_t NaivePext(uint64_t x, uint64_t mask)
+{
+    uint64_t ret{0}, k{0};
+    for (uint64_t i = 0; i < 64; i++)
+    {
+        if (mask >> i & 1)
+        {
+            ret |= (x >> i & 1) << k++;
+        }
+    }
+    return ret;
+}
+
+uint64_t NaivePdep(uint64_t x, uint64_t mask)
+{
+    uint64_t ret{0}, k{0};
+    for (uint64_t i = 0; i < 64; i++)
+    {
+        if (mask >> i & 1)
+        {
+            ret |= (x >> k++ & 1) << i;
+        }
+    }
+    return ret;
+}
+
+TEST(BmiUtilTest, Codecs)
+{
+    const bmiutil::Codec codecs[]{bmiutil::Codec::kBmi2, bmiutil::Codec::kVbmi2,
+                                  bmiutil::Codec::kPortable};
+    ASSERT_TRUE(bmiutil::IsSupported(bmiutil::DetectCodec()));
+    for (const auto codec : codecs)
+    {
+        if (!bmiutil::IsSupported(codec))
+        {
+            continue;
+        }
+        const bmiutil::CodecOps ops{bmiutil::OpsOf(codec)};
+        hashutil::WyHash hasher(1);
+        const uint64_t fixed_masks[]{0, ~0ull, 1ull << 63, 0x0f7b7eff, 0xffff3ff7ff7fffff};
+        for (uint64_t i = 0; i < 100000; i++)
+        {
+            const uint64_t x{hasher(2 * i)}, random_mask{hasher(2 * i + 1)};
+            const uint64_t sparse_mask{random_mask & hasher(i)};
+            for (const uint64_t mask : {random_mask, sparse_mask, fixed_masks[i % 5]})
+            {
+                ASSERT_EQ(ops.pext(x, mask), NaivePext(x, mask));
+                ASSERT_EQ(ops.pdep(x, mask), NaivePdep(x, mask));
+            }
+        }
+
+        // Filters built with VEFILTER_DISPATCH run on every codec
+        if (!bmiutil::kDispatch)
+        {
+            continue;
+        }
+        ASSERT_TRUE(bmiutil::SetCodec(codec));
+        vecf::VECF<uint64_t, 8> cf8(1 << 16);
+        vecf::VECF<uint64_t, 16> cf16(1 << 16);
+        veqf::VEQF<uint64_t, 12> qf(1 << 16);
+        for (uint64_t i = 0; i < (1 << 15); i++)
+        {
+            ASSERT_TRUE(cf8.Insert(i));
+            ASSERT_TRUE(cf16.Insert(i));
+            ASSERT_TRUE(qf.Insert(i));
+        }
+        for (uint64_t i = 0; i < (1 << 15); i++)
+        {
+            ASSERT_TRUE(cf8.Lookup(i));
+            ASSERT_TRUE(cf16.Lookup(i));
+            ASSERT_TRUE(qf.Lookup(i));
+        }
+    }
+    bmiutil::SetCodec(bmiutil::DetectCodec());
+}
+
+template <typename T>
+using SerializeTest = FilterTest<T>;
+
+using SerializeImplementations =
+    testing::Types<vecf::VECF<uint64_t, 8>, vecf::VECF<uint64_t, 12>,
+                   vecf::VECF<uint64_t, 16>,
+                   vecf::VECF<uint64_t, 12, vecf::AlignedSingleTable>,
+                   veqf::VEQF<uint64_t, 8>, veqf::VEQF<uint64_t, 12>,
+                   veqf::VEQF<uint64_t, 10, hashutil::TwoIndependentMultiplyShift,
+                              fieldutil::AlignedFields>,
+                   vecbf::VECBF<uint64_t, 8>, vecbf::VECBF<uint64_t, 10>,
+                   vecbf::VECBF<uint64_t, 10, hashutil::TwoIndependentMultiplyShift,
+                                fieldutil::AlignedFields>>;
+TYPED_TEST_SUITE(SerializeTest, SerializeImplementations);
+
+TYPED_TEST(SerializeTest, SaveLoad)
+{
+    const std::string path = testing::TempDir() + "serialize_test.bin";
+    for (uint64_t i = 0; i < this->total_items * 0.9; i++)
+    {
+        ASSERT_TRUE(this->filter_.Insert(i));
+    }
+    ASSERT_TRUE(this->filter_.Save(path));
+
+    // The loaded filter answers exactly as the saved one, false positives
+    // included
+    auto loaded = TypeParam::Load(path);
+    ASSERT_NE(loaded, nullptr);
+    for (uint64_t i = 0; i < 2 * this->total_items; i++)
+    {
+        ASSERT_EQ(loaded->Lookup(i), this->filter_.Lookup(i));
+    }
+
+    // It can be updated without touching the file
+    for (uint64_t i = 0; i < this->total_items * 0.9; i++)
+    {
+        ASSERT_TRUE(loaded->Delete(i));
+    }
+    auto reloaded = TypeParam::Load(path);
+    ASSERT_NE(reloaded, nullptr);
+    for (uint64_t i = 0; i < this->total_items * 0.9; i++)
+    {
+        ASSERT_TRUE(reloaded->Lookup(i));
+    }
+
+    // Files of other filters are refused
+    ASSERT_EQ((veqf::VEQF<uint64_t, 16>::Load(path)), nullptr);
+    ASSERT_EQ((veqf::VEQF<uint64_t, 12, hashutil::TwoIndependentMultiplyShift,
+                          fieldutil::AlignedFields>::Load(path)),
+              nullptr);
+    ASSERT_EQ(TypeParam::Load(path + ".missing"), nullptr);
+    std::remove(path.c_str());
+}
+
+template <typename HashFamily>
+void CheckHashFamily()
+{
+    SCOPED_TRACE(typeid(HashFamily).name());
+    const HashFamily a(42), b(42), c(43);
+    uint64_t differences = 0;
+    for (uint64_t i = 0; i < 1000; i++)
+    {
+        ASSERT_EQ(a(i), b(i));
+        differences += a(i) != c(i);
+    }
+    ASSERT_GT(differences, 990);
+}
+
+TEST(HashTest, Seeded)
+{
+    CheckHashFamily<hashutil::TwoIndependentMultiplyShift>();
+    CheckHashFamily<hashutil::WyHash>();
+    CheckHashFamily<hashutil::SimdMultiplyShift>();
+}
+
+TEST(HashTest, SimdMultiplyShiftBatch)
+{
+    const hashutil::SimdMultiplyShift hasher(1);
+    std::vector<uint64_t> keys(1003), hashes(keys.size());
+    std::iota(keys.begin(), keys.end(), 0xfffffff0ULL);
+    hasher.HashBatch(keys.data(), keys.size(), hashes.data());
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        ASSERT_EQ(hashes[i], hasher(keys[i]));
+    }
+}
+
+// Build two filters of type Filter(args..., seed) with the same seed, insert
+// the same keys, and check that they give equal answers, false positives
+// included, and that the false positive rate stays below `max_fpr`
+template <typename Filter, typename... Args>
+void CheckSeededFilter(double max_fpr, Args... args)
+{
+    SCOPED_TRACE(typeid(Filter).name());
+    constexpr uint64_t total_items = 1 << 16;
+    Filter a(total_items, args..., 42), b(total_items, args..., 42);
+    for (Filter *filter : {&a, &b})
+    {
+        for (uint64_t i = 0; i < total_items * 0.9; i++)
+        {
+            ASSERT_TRUE(filter->Insert(i));
+        }
+    }
+    uint64_t false_positives = 0;
+    for (uint64_t i = total_items; i < 5 * total_items; i++)
+    {
+        ASSERT_EQ(a.Lookup(i), b.Lookup(i));
+        false_positives += a.Lookup(i);
+    }
+    ASSERT_LT(false_positives, max_fpr * 4 * total_items);
+}
+
+TEST(HashTest, SeededFilters)
+{
+    CheckSeededFilter<vecf::VECF<uint64_t, 12>>(0.01);
+    CheckSeededFilter<vecf::VECF<uint64_t, 12, vecf::SingleTable, hashutil::WyHash>>(
+        0.01);
+    CheckSeededFilter<
+        vecf::VECF<uint64_t, 12, vecf::SingleTable, hashutil::SimdMultiplyShift>>(0.01);
+    CheckSeededFilter<veqf::VEQF<uint64_t, 12>>(0.01);
+    CheckSeededFilter<veqf::VEQF<uint64_t, 12, hashutil::WyHash>>(0.01);
+    CheckSeededFilter<veqf::VEQF<uint64_t, 12, hashutil::SimdMultiplyShift>>(0.01);
+    CheckSeededFilter<vecbf::VECBF<uint64_t, 8>>(0.08, 0.04);
+    CheckSeededFilter<vecbf::VECBF<uint64_t, 8, hashutil::WyHash>>(0.08, 0.04);
+    CheckSeededFilter<vecbf::VECBF<uint64_t, 8, hashutil::SimdMultiplyShift>>(0.08,
+                                                                              0.04);
+    CheckSeededFilter<vecbf::BlockedVECBF<uint64_t, 8, hashutil::WyHash>>(0.08, 0.04);
+    CheckSeededFilter<vecf::ConcurrentVECF<uint64_t, 12>>(0.01);
+    CheckSeededFilter<veqf::ConcurrentVEQF<uint64_t, 12, hashutil::WyHash>>(0.01);
+    CheckSeededFilter<vecbf::ConcurrentVECBF<uint64_t, 8>>(0.08, 0.04);
+}
+
+TEST(HashTest, Bytes)
+{
+    std::string text;
+    for (int i = 0; i < 200; i++)
+    {
+        text += static_cast<char>('a' + i % 26);
+    }
+    std::vector<std::string_view> keys;
+    for (size_t length = 0; length <= text.size(); length++)
+    {
+        const std::string_view key(text.data(), length);
+        keys.push_back(key);
+        // Any split of a key hashes as the whole key
+        for (size_t split = 0; split <= length; split += 3)
+        {
+            hashutil::StreamingHash stream;
+            stream.Update(key.substr(0, split));
+            stream.Update(key.substr(split, 5));
+            stream.Update(key.substr(std::min(length, split + 5)));
+            ASSERT_EQ(stream.Digest(), hashutil::HashBytes(key));
+        }
+    }
+    // Trailing zero bytes change the hash
+    ASSERT_NE(hashutil::HashBytes(std::string_view("ab", 2)),
+              hashutil::HashBytes(std::string_view("ab\0", 3)));
+
+    std::vector<uint64_t> hashes(keys.size());
+    hashutil::HashBytesBatch(keys.data(), keys.size(), hashes.data());
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        ASSERT_EQ(hashes[i], hashutil::HashBytes(keys[i]));
+    }
+}
+
+// The concurrent and scalable filters have no LookupBatch
+template <typename Filter, bool kHasLookupBatch = true>
+void CheckStringKeys()
+{
+    SCOPED_TRACE(typeid(Filter).name());
+    constexpr uint64_t total_items = 1 << 16;
+    Filter filter(total_items);
+    std::vector<std::string> strings;
+    for (uint64_t i = 0; i < total_items * 0.9; i++)
+    {
+        strings.push_back("https://example.com/" + std::to_string(i * 7919));
+        ASSERT_TRUE(filter.Insert(strings.back()));
+    }
+    const std::vector<std::string_view> keys(strings.begin(), strings.end());
+    for (const auto key : keys)
+    {
+        ASSERT_TRUE(filter.Lookup(key));
+    }
+    if constexpr (kHasLookupBatch)
+    {
+        std::unique_ptr<bool[]> found(new bool[keys.size()]);
+        filter.LookupBatch(keys.data(), keys.size(), found.get());
+        for (size_t i = 0; i < keys.size(); i++)
+        {
+            ASSERT_TRUE(found[i]);
+        }
+    }
+    for (const auto key : keys)
+    {
+        ASSERT_TRUE(filter.Delete(key));
+    }
+}
+
+TEST(HashTest, StringKeys)
+{
+    CheckStringKeys<vecf::VECF<uint64_t, 12>>();
+    CheckStringKeys<veqf::VEQF<uint64_t, 12>>();
+    CheckStringKeys<vecbf::VECBF<uint64_t, 8>>();
+    CheckStringKeys<vecbf::BlockedVECBF<uint64_t, 8>>();
+    // Byte string keys do not depend on ItemType
+    CheckStringKeys<vecf::VECF<uint32_t, 12>>();
+    CheckStringKeys<veqf::VEQF<uint32_t, 12>>();
+    CheckStringKeys<vecbf::VECBF<uint32_t, 8>>();
+    CheckStringKeys<vecbf::BlockedVECBF<uint32_t, 8>>();
+    CheckStringKeys<vecf::ScalableVECF<uint32_t, 12>, false>();
+    CheckStringKeys<vecf::ConcurrentVECF<uint64_t, 12>, false>();
+    CheckStringKeys<veqf::ConcurrentVEQF<uint64_t, 12>, false>();
+    CheckStringKeys<vecbf::ConcurrentVECBF<uint64_t, 8>, false>();
+}
+
+// Insert pre-hashed keys, check there is no false negative, a false positive
+// rate below `max_fpr`, and that all keys can be deleted
+template <typename Filter>
+void CheckPreHashed(double max_fpr)
+{
+    SCOPED_TRACE(typeid(Filter).name());
+    constexpr uint64_t total_items = 1 << 16;
+    Filter filter(total_items);
+    uint64_t state = 1;
+    std::vector<uint64_t> hashes(total_items * 0.9);
+    for (auto &hash : hashes)
+    {
+        hash = hashutil::SplitMix64(&state);
+        ASSERT_TRUE(filter.InsertHash(hash));
+    }
+    for (const auto hash : hashes)
+    {
+        ASSERT_TRUE(filter.LookupHash(hash));
+    }
+    uint64_t false_positives = 0;
+    for (uint64_t i = 0; i < 4 * total_items; i++)
+    {
+        false_positives += filter.LookupHash(hashutil::SplitMix64(&state));
+    }
+    ASSERT_LT(false_positives, max_fpr * 4 * total_items);
+    for (const auto hash : hashes)
+    {
+        ASSERT_TRUE(filter.DeleteHash(hash));
+    }
+}
+
+TEST(HashTest, PreHashed)
+{
+    CheckPreHashed<vecf::VECF<uint64_t, 12>>(0.01);
+    CheckPreHashed<veqf::VEQF<uint64_t, 12>>(0.01);
+    CheckPreHashed<vecbf::VECBF<uint64_t, 8>>(0.08);
+    CheckPreHashed<vecbf::BlockedVECBF<uint64_t, 8>>(0.08);
+    CheckPreHashed<vecf::ConcurrentVECF<uint64_t, 12>>(0.01);
+    CheckPreHashed<veqf::ConcurrentVEQF<uint64_t, 12>>(0.01);
+    CheckPreHashed<vecbf::ConcurrentVECBF<uint64_t, 8>>(0.08);
+}
+
+// The load of a VECF sets how many tags share a bucket and thus the mix of
+// tag encodings, so single-hash mode must match the false positive rate of
+// two hashes at every load
+template <size_t bits_per_item>
+void CheckSingleHashFpr()
+{
+    SCOPED_TRACE(bits_per_item);
+    constexpr uint64_t total_items = 1 << 16, lookups = 1 << 20;
+    for (double load : {0.25, 0.5, 0.75, 0.9})
+    {
+        SCOPED_TRACE(load);
+        vecf::VECF<uint64_t, bits_per_item> two_hashes(total_items, 1);
+        vecf::VECF<uint64_t, bits_per_item, vecf::SingleTable,
+                   hashutil::TwoIndependentMultiplyShift, true>
+            single_hash(total_items, 1);
+        for (uint64_t i = 0; i < total_items * load; i++)
+        {
+            ASSERT_TRUE(two_hashes.Insert(i));
+            ASSERT_TRUE(single_hash.Insert(i));
+        }
+        double two_hashes_fp = 0, single_hash_fp = 0;
+        for (uint64_t i = total_items; i < total_items + lookups; i++)
+        {
+            two_hashes_fp += two_hashes.Lookup(i);
+            single_hash_fp += single_hash.Lookup(i);
+        }
+        // both counts are about Poisson distributed: allow 5 standard
+        // deviations of their difference
+        ASSERT_LE(std::abs(two_hashes_fp - single_hash_fp),
+                  5 * std::sqrt(two_hashes_fp + single_hash_fp) + 5);
+    }
+}
+
+// Fill every bucket of a single-hash VECF with `level` tags, so that all
+// buckets use the tag encoding of that level, and probe it with hashes sharing
+// the primary bucket of a stored key. `tag_len[n]` is the tag length of a
+// bucket with n tags. Hashes are inserted pre-hashed to place them, and keys
+// map to their index and tag the same way in single-hash mode.
+template <size_t bits_per_item>
+void CheckSingleHashLevelFpr(const uint32_t (&tag_len)[5])
+{
+    SCOPED_TRACE(bits_per_item);
+    constexpr uint64_t index_bits = 14, num_buckets = 1 << index_bits,
+                       index_mask = num_buckets - 1, probes = 1 << 21;
+    for (uint64_t level = 1; level <= 4; level++)
+    {
+        SCOPED_TRACE(level);
+        // 3 keys per bucket on average keep the table at num_buckets buckets
+        vecf::VECF<uint64_t, bits_per_item, vecf::SingleTable,
+                   hashutil::TwoIndependentMultiplyShift, true>
+            filter(3 * num_buckets, 1);
+        uint64_t state = level;
+        std::vector<uint64_t> hashes;
+        for (uint64_t b = 0; b < num_buckets; b++)
+        {
+            for (uint64_t i = 0; i < level; i++)
+            {
+                hashes.push_back(hashutil::SplitMix64(&state) << index_bits | b);
+                ASSERT_TRUE(filter.InsertHash(hashes.back()));
+            }
+        }
+        ASSERT_DOUBLE_EQ(filter.LoadFactor(), level / 4.0);
+
+        double random_fp = 0, low_bits_fp = 0;
+        for (uint64_t i = 0; i < probes; i++)
+        {
+            const uint64_t hash{hashes[hashutil::SplitMix64(&state) % hashes.size()]};
+            // all bits above the index drawn at random
+            random_fp += filter.LookupHash(hashutil::SplitMix64(&state) << index_bits |
+                                           (hash & index_mask));
+            // only the bits between the index and bit 32 drawn at random
+            low_bits_fp += filter.LookupHash(
+                hash ^ ((hashutil::SplitMix64(&state) << index_bits) & 0xffffffff));
+        }
+
+        // A stored tag of a bucket with n tags matches the probe tag masked to
+        // the tag length of any m >= n buckets, each with probability
+        // 2^-tag_len[n]. Masks m and m + 1 give the same value unless the
+        // probe tag has a set bit between their lengths. Two buckets of
+        // `level` tags are probed. Counts are about Poisson distributed: allow
+        // 5 standard deviations.
+        double masks{1};
+        for (uint64_t m = level; m < 4; m++)
+        {
+            masks += 1 - std::ldexp(1.0, -static_cast<int>(tag_len[m] - tag_len[m + 1]));
+        }
+        const double tag_fpr{masks * std::ldexp(1.0, -tag_len[level])},
+            expected{probes * (1 - std::pow(1 - tag_fpr, 2 * level))};
+        ASSERT_LE(std::abs(random_fp - expected), 5 * std::sqrt(expected) + 5);
+        // A one-slot tag covers the bits just above the index, so keys sharing
+        // them with a stored key are still told apart
+        if (level == 1)
+        {
+            const double low_bits_expected{
+                probes * (std::ldexp(1.0, static_cast<int>(index_bits) - 32) + tag_fpr)};
+            ASSERT_LE(low_bits_fp, low_bits_expected + 5 * std::sqrt(low_bits_expected) + 5);
+        }
+    }
+}
+
+TEST(HashTest, SingleHashFalsePositiveRate)
+{
+    CheckSingleHashFpr<8>();
+    CheckSingleHashFpr<12>();
+    CheckSingleHashFpr<16>();
+    CheckSingleHashLevelFpr<8>({0, 29, 14, 9, 8});
+    CheckSingleHashLevelFpr<12>({0, 45, 22, 15, 12});
+    CheckSingleHashLevelFpr<16>({0, 61, 30, 20, 16});
+}